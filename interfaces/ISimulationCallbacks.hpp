@@ -7,4 +7,8 @@ public:
     virtual void launchObject() = 0;
     virtual void processMouseMovement(double xpos, double ypos) = 0;
     virtual void processScroll(double yoffset) = 0;
+    virtual void toggleGridDisplacement() = 0;
+    virtual void saveCheckpoint() = 0;
+    virtual void toggleTrajectory() = 0;
+    virtual void dumpProfile() = 0;
 };
\ No newline at end of file
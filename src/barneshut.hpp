@@ -0,0 +1,257 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "bodystore.hpp"
+#include "gravitykernel.hpp"
+#include "octree.hpp"
+#include "profiler.hpp"
+#include "threadpool.hpp"
+
+// Barnes-Hut gravity: a cell is replaced by its center of mass when
+// cellSize / distance < theta. theta = 0 degenerates to direct summation.
+//
+// The tree is walked once per group of up to GROUP_SIZE bodies rather than
+// once per body: distance is taken to the nearest point of the group's
+// bounding box, so a cell accepted there is accepted for every body in it.
+// The walk collects one interaction list per group, cells as point masses
+// and the bodies of every leaf it opens, and the group's bodies are summed
+// against it by the SIMD kernel from the tree-ordered copies. Each group
+// writes only its own bodies, so the result is the same for any thread
+// count.
+class BarnesHut {
+private:
+    // Reused by the groups of one task
+    struct InteractionList {
+        std::vector<float> x, y, z, mass;
+        std::vector<float> accX, accY, accZ; // per body of the group
+
+        void clear() {
+            x.clear();
+            y.clear();
+            z.clear();
+            mass.clear();
+        }
+
+        void add(float px, float py, float pz, float m) {
+            x.push_back(px);
+            y.push_back(py);
+            z.push_back(pz);
+            mass.push_back(m);
+        }
+
+        void add(const float* px, const float* py, const float* pz, const float* m, size_t count) {
+            x.insert(x.end(), px, px + count);
+            y.insert(y.end(), py, py + count);
+            z.insert(z.end(), pz, pz + count);
+            mass.insert(mass.end(), m, m + count);
+        }
+    };
+
+    Octree tree;
+    GravityKernel kernel; // group sums; also holds the softening
+    std::vector<uint32_t> groups; // nodes walked for, each the largest holding at most GROUP_SIZE bodies
+    float theta;
+
+    // Each level pushes at most 8 children and pops one
+    static constexpr int STACK_SIZE = 8 * 34;
+    // Measured on clouds of 1k to 1M bodies: smaller groups make the walks
+    // dominate, larger ones the sums
+    static constexpr uint32_t LEAF_CAPACITY = 16;
+    static constexpr uint32_t GROUP_SIZE = 256;
+    // Groups handed to one task
+    static constexpr size_t GROUP_GRAIN = 4;
+
+public:
+    explicit BarnesHut(float theta = 0.5f) : tree(LEAF_CAPACITY), theta(theta) {}
+
+    void setOpeningAngle(float angle) { theta = std::max(0.0f, angle); }
+    float getOpeningAngle() const { return theta; }
+
+    // Plummer softening, the same law as the direct sum: |d|^2 + eps^2
+    void setSoftening(float epsilon) { kernel.setSoftening(epsilon); }
+
+    void setInstructionSet(GravityKernel::InstructionSet set) { kernel.setInstructionSet(set); }
+
+    const Octree& getTree() const { return tree; }
+
+    // G is the gravitational constant in store units; writes one
+    // acceleration per body slot into ax/ay/az. The tree is built serially,
+    // the leaves are walked on the pool.
+    void computeAccelerations(const BodyStore& bodies, float G, float* ax, float* ay, float* az, ThreadPool& pool) {
+        {
+            PROFILE_SCOPE("octree build");
+            tree.build(bodies);
+        }
+
+        PROFILE_SCOPE("tree walk");
+        const std::vector<OctreeNode>& nodes = tree.getNodes();
+        collectGroups();
+
+        const std::vector<uint32_t>& order = tree.getOrder();
+        pool.parallelFor(groups.size(), GROUP_GRAIN, [&](size_t begin, size_t end) {
+            InteractionList list;
+            for (size_t g = begin; g < end; ++g) {
+                const OctreeNode& group = nodes[groups[g]];
+                collectInteractions(group, list);
+                sumGroup(group, list);
+                for (uint32_t k = group.begin; k < group.end; ++k) {
+                    const uint32_t i = order[k];
+                    ax[i] = G * list.accX[k - group.begin];
+                    ay[i] = G * list.accY[k - group.begin];
+                    az[i] = G * list.accZ[k - group.begin];
+                }
+            }
+        });
+
+        // Bodies left out of the tree still feel it, one walk each
+        if (order.size() < bodies.size()) {
+            const uint8_t* initializing = bodies.initializing();
+            const float* x = bodies.x();
+            const float* y = bodies.y();
+            const float* z = bodies.z();
+            for (size_t i = 0; i < bodies.size(); ++i) {
+                if (!initializing[i]) continue;
+                glm::vec3 acc = accelerationAt(x[i], y[i], z[i]);
+                ax[i] = G * acc.x;
+                ay[i] = G * acc.y;
+                az[i] = G * acc.z;
+            }
+        }
+    }
+
+private:
+    void collectGroups() {
+        groups.clear();
+        if (tree.empty()) return;
+        const std::vector<OctreeNode>& nodes = tree.getNodes();
+        uint32_t stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const uint32_t n = stack[--top];
+            const OctreeNode& node = nodes[n];
+            if (node.childCount == 0 || node.end - node.begin <= GROUP_SIZE) {
+                groups.push_back(n);
+                continue;
+            }
+            for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; ++c) {
+                stack[top++] = c;
+            }
+        }
+    }
+
+    // Cells far enough from every point of the group's bounding box go in
+    // as their center of mass, the bodies of the leaves reached otherwise go
+    // in whole, the group's own included
+    void collectInteractions(const OctreeNode& group, InteractionList& list) const {
+        const float* x = tree.x();
+        const float* y = tree.y();
+        const float* z = tree.z();
+        const float* mass = tree.mass();
+        float minX = x[group.begin], maxX = minX;
+        float minY = y[group.begin], maxY = minY;
+        float minZ = z[group.begin], maxZ = minZ;
+        for (uint32_t k = group.begin + 1; k < group.end; ++k) {
+            minX = std::min(minX, x[k]); maxX = std::max(maxX, x[k]);
+            minY = std::min(minY, y[k]); maxY = std::max(maxY, y[k]);
+            minZ = std::min(minZ, z[k]); maxZ = std::max(maxZ, z[k]);
+        }
+
+        const std::vector<OctreeNode>& nodes = tree.getNodes();
+        const float thetaSq = theta * theta;
+        list.clear();
+
+        uint32_t stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const OctreeNode& node = nodes[stack[--top]];
+
+            float dx = std::max({0.0f, minX - node.comX, node.comX - maxX});
+            float dy = std::max({0.0f, minY - node.comY, node.comY - maxY});
+            float dz = std::max({0.0f, minZ - node.comZ, node.comZ - maxZ});
+            float distSq = dx * dx + dy * dy + dz * dz;
+            float size = 2.0f * node.halfSize;
+
+            if (size * size < thetaSq * distSq) {
+                list.add(node.comX, node.comY, node.comZ, node.mass);
+            } else if (node.childCount == 0) {
+                list.add(x + node.begin, y + node.begin, z + node.begin, mass + node.begin, node.end - node.begin);
+            } else {
+                for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; ++c) {
+                    stack[top++] = c;
+                }
+            }
+        }
+    }
+
+    void sumGroup(const OctreeNode& group, InteractionList& list) const {
+        const uint32_t count = group.end - group.begin;
+        list.accX.assign(count, 0.0f);
+        list.accY.assign(count, 0.0f);
+        list.accZ.assign(count, 0.0f);
+        kernel.accumulate(tree.x() + group.begin, tree.y() + group.begin, tree.z() + group.begin, count, list.x.data(),
+                          list.y.data(), list.z.data(), list.mass.data(), list.x.size(), list.accX.data(),
+                          list.accY.data(), list.accZ.data());
+    }
+
+    // Returns sum(m * d / (|d|^2 + eps^2)^1.5) over the tree as seen from (px, py, pz)
+    glm::vec3 accelerationAt(float px, float py, float pz) const {
+        if (tree.empty()) return glm::vec3(0.0f);
+
+        const std::vector<OctreeNode>& nodes = tree.getNodes();
+        const float* x = tree.x();
+        const float* y = tree.y();
+        const float* z = tree.z();
+        const float* mass = tree.mass();
+        const float thetaSq = theta * theta;
+        const float softeningSq = kernel.getSoftening() * kernel.getSoftening();
+        float sumX = 0.0f, sumY = 0.0f, sumZ = 0.0f;
+
+        uint32_t stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const OctreeNode& node = nodes[stack[--top]];
+
+            float dx = node.comX - px;
+            float dy = node.comY - py;
+            float dz = node.comZ - pz;
+            float distSq = dx * dx + dy * dy + dz * dz;
+            float size = 2.0f * node.halfSize;
+
+            if (node.childCount == 0) {
+                // Leaf: sum its bodies directly
+                for (uint32_t k = node.begin; k < node.end; ++k) {
+                    float bx = x[k] - px;
+                    float by = y[k] - py;
+                    float bz = z[k] - pz;
+                    float d2 = bx * bx + by * by + bz * bz;
+                    if (d2 <= 0.0f) continue;
+                    float invDist = 1.0f / std::sqrt(d2 + softeningSq);
+                    float s = mass[k] * invDist * invDist * invDist;
+                    sumX += bx * s;
+                    sumY += by * s;
+                    sumZ += bz * s;
+                }
+            } else if (size * size < thetaSq * distSq) {
+                // Far enough away: use the cell's center of mass
+                float invDist = 1.0f / std::sqrt(distSq + softeningSq);
+                float s = node.mass * invDist * invDist * invDist;
+                sumX += dx * s;
+                sumY += dy * s;
+                sumZ += dz * s;
+            } else {
+                for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; ++c) {
+                    stack[top++] = c;
+                }
+            }
+        }
+
+        return glm::vec3(sumX, sumY, sumZ);
+    }
+};
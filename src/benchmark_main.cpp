@@ -0,0 +1,356 @@
+// Benchmark suite: times the per-step and per-frame CPU work over a sweep
+// of body counts and writes one JSON record per case, so runs of different
+// commits can be diffed. Needs no window or GL context.
+//
+//   benchmark [options]
+//
+// Options:
+//   -o, --output <file>   JSON results, "-" for stdout (default)
+//   --sizes a,b,...       body counts (default 10,100,1000,10000,100000,1000000)
+//   --filter <text>       only cases whose name contains text
+//   --threads <n>         threads including the caller (default: every core)
+//   --min-time <s>        measure each case for at least s seconds (default 0.5)
+//   --budget <s>          skip sizes whose iteration is predicted to take longer (default 5)
+//
+// Cases:
+//   update/<solver>       PhysicsEngine::update of one leapfrog step, collisions included
+//   update/direct-double  the same with the double-precision engine
+//   collisions/broadphase sweep-and-prune over the swept boxes of one step
+//   grid/update           the grid's CPU update after the bodies changed: refine and field
+//   render/cull           frustum test of every body against the default camera
+//
+// ns_per_body_step is the time per iteration divided by the body count.
+// interactions_per_second counts N(N - 1) pair interactions per force
+// evaluation whatever the solver, so tree solvers report the direct-sum
+// rate they are equivalent to; it is null for cases without force passes.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "broadphase.hpp"
+#include "constants.hpp"
+#include "frustum.hpp"
+#include "gridfield.hpp"
+#include "physicsengine.hpp"
+#include "quadgrid.hpp"
+#include "scenario.hpp"
+#include "threadpool.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::vector<size_t> sizes = {10, 100, 1000, 10000, 100000, 1000000};
+    std::string output = "-";
+    std::string filter;
+    size_t threads = 0;
+    double minTime = 0.5;
+    double budget = 5.0;
+};
+
+struct Result {
+    std::string name;
+    size_t bodies;
+    bool skipped;
+    uint64_t iterations;
+    double meanSeconds, minSeconds;
+    double interactionsPerSecond; // negative when not applicable
+};
+
+// One benchmark case. setup() builds the state for a body count outside
+// the timing; iterate() runs one timed iteration and returns the number
+// of force evaluations (bodies) it made, 0 if it makes none.
+struct Case {
+    std::string name;
+    double exponent; // how the iteration time grows with N, to skip sizes over budget
+    std::function<void(size_t bodies)> setup;
+    std::function<size_t()> iterate;
+};
+
+// The windowed app's grid and camera defaults
+const float GRID_SIZE = 20000.0f;
+const int GRID_DIVISIONS = 25;
+const glm::vec3 CAMERA_POSITION(0.0f, 1000.0f, 5000.0f);
+
+void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [-o file] [--sizes a,b,...] [--filter text] [--threads n]\n"
+              << "       [--min-time s] [--budget s]" << std::endl;
+}
+
+bool parseSizes(const std::string& text, std::vector<size_t>& sizes) {
+    sizes.clear();
+    std::stringstream in(text);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        char* end = nullptr;
+        unsigned long long value = std::strtoull(item.c_str(), &end, 10);
+        if (item.empty() || *end != '\0' || value == 0) return false;
+        sizes.push_back(static_cast<size_t>(value));
+    }
+    return !sizes.empty();
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    for (int a = 1; a < argc; ++a) {
+        std::string option = argv[a];
+        if (a + 1 >= argc) {
+            std::cerr << "Missing value for " << option << std::endl;
+            return false;
+        }
+        std::string value = argv[++a];
+        char* end = nullptr;
+        if (option == "-o" || option == "--output") {
+            options.output = value;
+        } else if (option == "--sizes") {
+            if (!parseSizes(value, options.sizes)) {
+                std::cerr << "Invalid sizes '" << value << "'" << std::endl;
+                return false;
+            }
+        } else if (option == "--filter") {
+            options.filter = value;
+        } else if (option == "--threads") {
+            long threads = std::strtol(value.c_str(), &end, 10);
+            if (*end != '\0' || threads < 1) {
+                std::cerr << "Invalid thread count '" << value << "'" << std::endl;
+                return false;
+            }
+            options.threads = static_cast<size_t>(threads);
+        } else if (option == "--min-time" || option == "--budget") {
+            double seconds = std::strtod(value.c_str(), &end);
+            if (*end != '\0' || !(seconds > 0.0)) {
+                std::cerr << "Invalid time '" << value << "' for " << option << std::endl;
+                return false;
+            }
+            (option == "--min-time" ? options.minTime : options.budget) = seconds;
+        } else {
+            std::cerr << "Unknown option " << option << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Runs one warm-up iteration, then iterates until minTime has passed and
+// at least three iterations ran, unless one alone already took longer
+Result measure(const Case& benchmark, size_t bodies, double minTime) {
+    Result result = {benchmark.name, bodies, false, 0, 0.0, 0.0, -1.0};
+    benchmark.iterate();
+
+    double total = 0.0, fastest = 1e300;
+    size_t forceEvaluations = 0;
+    while (total < minTime || result.iterations < 3) {
+        Clock::time_point start = Clock::now();
+        forceEvaluations += benchmark.iterate();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        total += seconds;
+        fastest = std::min(fastest, seconds);
+        ++result.iterations;
+        if (result.iterations == 1 && seconds >= minTime) break;
+    }
+    result.meanSeconds = total / result.iterations;
+    result.minSeconds = fastest;
+    if (forceEvaluations > 0 && total > 0.0) {
+        result.interactionsPerSecond = double(forceEvaluations) * double(bodies - 1) / total;
+    }
+    return result;
+}
+
+// Each size gets a fresh engine; the engine owns its pool and cannot be
+// reassigned, so the case holds it by pointer
+template <typename Engine>
+void addUpdateCase(std::vector<Case>& cases, const char* name, GravitySolver method, double exponent, size_t threads) {
+    auto engine = std::make_shared<std::unique_ptr<Engine>>();
+    cases.push_back({name, exponent,
+                     [engine, method, threads](size_t count) {
+                         engine->reset();
+                         *engine = std::make_unique<Engine>();
+                         Engine& physics = **engine;
+                         physics.setThreadCount(threads);
+                         physics.setGravitySolver(method);
+                         physics.setPaused(false);
+                         Scenario::cloud(count).populate(physics.getBodies(), physics.getThreadPool());
+                     },
+                     [engine] {
+                         Engine& physics = **engine;
+                         physics.update(physics.getFixedTimeStep());
+                         return physics.getForceEvaluations();
+                     }});
+}
+
+std::vector<Case> makeCases(size_t threads) {
+    auto pool = std::make_shared<ThreadPool>(threads);
+    auto bodies = std::make_shared<BodyStore>();
+
+    std::vector<Case> cases;
+    addUpdateCase<PhysicsEngine>(cases, "update/direct", GravitySolver::DirectSum, 2.0, threads);
+    addUpdateCase<PhysicsEngine>(cases, "update/barnes-hut", GravitySolver::BarnesHut, 1.2, threads);
+    addUpdateCase<PhysicsEngine>(cases, "update/fmm", GravitySolver::FastMultipole, 1.1, threads);
+    addUpdateCase<DoublePhysicsEngine>(cases, "update/direct-double", GravitySolver::DirectSum, 2.0, threads);
+
+    // The swept boxes come from a drift outside the timing, so the sort
+    // sees the small reorderings a real step makes
+    auto sweep = std::make_shared<SweepAndPrune>();
+    cases.push_back({"collisions/broadphase", 1.1,
+                     [bodies, sweep, pool](size_t count) {
+                         *bodies = BodyStore();
+                         *sweep = SweepAndPrune();
+                         Scenario::cloud(count).populate(*bodies, *pool);
+                     },
+                     [bodies, sweep, pool] {
+                         const size_t count = bodies->size();
+                         const float h = (1.0f / 60.0f) / Constants::TIME_SCALE;
+                         std::copy(bodies->x(), bodies->x() + count, bodies->previousX());
+                         std::copy(bodies->y(), bodies->y() + count, bodies->previousY());
+                         std::copy(bodies->z(), bodies->z() + count, bodies->previousZ());
+                         for (size_t i = 0; i < count; ++i) {
+                             bodies->x()[i] += bodies->vx()[i] * h;
+                             bodies->y()[i] += bodies->vy()[i] * h;
+                             bodies->z()[i] += bodies->vz()[i] * h;
+                         }
+                         sweep->findPairs(*bodies, *pool);
+                         return size_t(0);
+                     }});
+
+    // Marking the store changed makes the grid redo everything, as after a
+    // merge or a body moved by hand
+    const float planeY = -GRID_SIZE / 2.0f * 0.3f + 3 * (GRID_SIZE / GRID_DIVISIONS);
+    auto layout = std::make_shared<QuadGrid>(GRID_SIZE, size_t(4) * GRID_DIVISIONS * (GRID_DIVISIONS + 1));
+    auto field = std::make_shared<GridField>(GRID_SIZE, planeY);
+    cases.push_back({"grid/update", 1.0,
+                     [bodies, layout, field, planeY, pool](size_t count) {
+                         *bodies = BodyStore();
+                         *layout = QuadGrid(GRID_SIZE, size_t(4) * GRID_DIVISIONS * (GRID_DIVISIONS + 1));
+                         *field = GridField(GRID_SIZE, planeY);
+                         field->setPoints(layout->getPointX(), layout->getPointZ());
+                         Scenario::cloud(count).populate(*bodies, *pool);
+                     },
+                     [bodies, layout, field, pool] {
+                         bodies->markChanged();
+                         field->setBodies(*bodies);
+                         if (layout->refine(*bodies, *pool, field->getSourceX(), field->getSourceY(), field->getSourceZ(),
+                                            field->getSourceRs(), field->getSourceCount(), field->getPlaneY())) {
+                             field->setPoints(layout->getPointX(), layout->getPointZ());
+                         }
+                         field->update(*bodies, *pool);
+                         return size_t(0);
+                     }});
+
+    auto visible = std::make_shared<size_t>(0);
+    cases.push_back({"render/cull", 1.0,
+                     [bodies, pool](size_t count) {
+                         *bodies = BodyStore();
+                         Scenario::cloud(count).populate(*bodies, *pool);
+                     },
+                     [bodies, visible] {
+                         const glm::mat4 view = glm::lookAt(CAMERA_POSITION, CAMERA_POSITION + glm::vec3(0.0f, 0.0f, -1.0f),
+                                                            glm::vec3(0.0f, 1.0f, 0.0f));
+                         const glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 750000.0f);
+                         Frustum frustum(projection * view);
+                         size_t inside = 0;
+                         for (size_t i = 0; i < bodies->size(); ++i) {
+                             glm::vec3 center(bodies->x()[i], bodies->y()[i], bodies->z()[i]);
+                             inside += frustum.intersectsSphere(center, bodies->radius()[i]);
+                         }
+                         *visible = inside;
+                         return size_t(0);
+                     }});
+    return cases;
+}
+
+std::string formatNumber(double value) {
+    if (value < 0.0) return "null";
+    std::ostringstream out;
+    out << std::setprecision(6) << value;
+    return out.str();
+}
+
+bool writeResults(const Options& options, size_t threads, const std::vector<Result>& results) {
+    std::ofstream file;
+    if (options.output != "-") {
+        file.open(options.output);
+        if (!file) {
+            std::cerr << "Failed to open '" << options.output << "' for writing" << std::endl;
+            return false;
+        }
+    }
+    std::ostream& out = options.output == "-" ? std::cout : file;
+
+    // One result per line so two runs diff line by line
+    out << "{\n  \"version\": 1,\n  \"threads\": " << threads << ",\n  \"min_time\": " << options.minTime
+        << ",\n  \"results\": [\n";
+    for (size_t r = 0; r < results.size(); ++r) {
+        const Result& result = results[r];
+        out << "    {\"name\": \"" << result.name << "\", \"bodies\": " << result.bodies;
+        if (result.skipped) {
+            out << ", \"skipped\": true";
+        } else {
+            out << ", \"iterations\": " << result.iterations
+                << ", \"seconds_per_iteration\": " << formatNumber(result.meanSeconds)
+                << ", \"min_seconds\": " << formatNumber(result.minSeconds)
+                << ", \"ns_per_body_step\": " << formatNumber(result.meanSeconds * 1.0e9 / result.bodies)
+                << ", \"interactions_per_second\": " << formatNumber(result.interactionsPerSecond);
+        }
+        out << "}" << (r + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    out.flush();
+    return static_cast<bool>(out);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    const size_t threads = options.threads == 0 ? ThreadPool::defaultThreadCount() : options.threads;
+
+    std::vector<Result> results;
+    std::cerr << std::left << std::setw(24) << "case" << std::right << std::setw(10) << "bodies" << std::setw(12)
+              << "iterations" << std::setw(14) << "ms/iter" << std::setw(14) << "ns/body" << std::setw(16)
+              << "interactions/s" << std::endl;
+    for (const Case& benchmark : makeCases(threads)) {
+        if (benchmark.name.find(options.filter) == std::string::npos) continue;
+
+        double lastSeconds = 0.0;
+        size_t lastBodies = 0;
+        for (size_t bodies : options.sizes) {
+            double predicted = lastBodies == 0 ? 0.0
+                : lastSeconds * std::pow(double(bodies) / double(lastBodies), benchmark.exponent);
+            Result result = {benchmark.name, bodies, true, 0, 0.0, 0.0, -1.0};
+            if (predicted <= options.budget) {
+                benchmark.setup(bodies);
+                result = measure(benchmark, bodies, options.minTime);
+                lastSeconds = result.meanSeconds;
+                lastBodies = bodies;
+            }
+            results.push_back(result);
+
+            std::cerr << std::left << std::setw(24) << result.name << std::right << std::setw(10) << bodies;
+            if (result.skipped) {
+                std::cerr << "   skipped, predicted " << predicted << " s per iteration" << std::endl;
+                continue;
+            }
+            std::cerr << std::setw(12) << result.iterations << std::setw(14) << result.meanSeconds * 1.0e3
+                      << std::setw(14) << result.meanSeconds * 1.0e9 / bodies << std::setw(16)
+                      << formatNumber(result.interactionsPerSecond) << std::endl;
+        }
+    }
+
+    return writeResults(options, threads, results) ? 0 : 1;
+}
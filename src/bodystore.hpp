@@ -0,0 +1,340 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "constants.hpp"
+
+using BodyId = uint32_t;
+
+// Structure-of-arrays storage for every body in the simulation.
+// Each physical property lives in its own contiguous column so the force
+// loop streams linearly through memory. Bodies are addressed by a stable
+// BodyId; the slot a body occupies may change, its id never does.
+//
+// The previous-position columns hold the state before the last fixed step;
+// display positions blend them with the current ones by a factor the
+// reader picks from how long ago that step finished.
+//
+// Real is the precision of every physical column. The simulation, renderer
+// and file formats use BodyStore (float); DoubleBodyStore backs validation
+// runs of the double-precision engine.
+template <typename Real>
+class BasicBodyStore {
+public:
+    static constexpr BodyId INVALID_ID = ~BodyId(0);
+    static constexpr uint32_t INVALID_SLOT = ~uint32_t(0);
+
+private:
+    std::vector<Real> posX, posY, posZ;
+    std::vector<Real> prevX, prevY, prevZ;
+    std::vector<Real> velX, velY, velZ;
+    std::vector<Real> accX, accY, accZ;
+    std::vector<Real> jerkX, jerkY, jerkZ;
+    std::vector<Real> timeSteps; // individual block step, used by the Hermite integrator
+    std::vector<Real> masses;
+    std::vector<Real> densities;
+    std::vector<Real> radii;
+    std::vector<uint8_t> initializingFlags;
+    std::vector<BodyId> ids;
+    std::vector<uint32_t> slots; // BodyId -> slot, INVALID_SLOT once removed
+    uint64_t revision;           // bumped by every change that affects gravity
+
+public:
+    BasicBodyStore() : revision(0) {}
+
+    // Takes double precision so a DoubleBodyStore starts from exact values;
+    // a BodyStore rounds them to float once, here
+    BodyId add(const glm::dvec3& position, const glm::dvec3& velocity, double mass, double density) {
+        BodyId id = static_cast<BodyId>(slots.size());
+        slots.push_back(static_cast<uint32_t>(ids.size()));
+        ids.push_back(id);
+
+        posX.push_back(static_cast<Real>(position.x));
+        posY.push_back(static_cast<Real>(position.y));
+        posZ.push_back(static_cast<Real>(position.z));
+        prevX.push_back(posX.back());
+        prevY.push_back(posY.back());
+        prevZ.push_back(posZ.back());
+        velX.push_back(static_cast<Real>(velocity.x));
+        velY.push_back(static_cast<Real>(velocity.y));
+        velZ.push_back(static_cast<Real>(velocity.z));
+        accX.push_back(0);
+        accY.push_back(0);
+        accZ.push_back(0);
+        jerkX.push_back(0);
+        jerkY.push_back(0);
+        jerkZ.push_back(0);
+        timeSteps.push_back(0);
+        masses.push_back(static_cast<Real>(mass));
+        densities.push_back(static_cast<Real>(density));
+        radii.push_back(computeRadius(masses.back(), densities.back()));
+        initializingFlags.push_back(0);
+        ++revision;
+        return id;
+    }
+
+    // Adds count massless bodies at the origin for place() to fill in, and
+    // returns the slot of the first; their ids follow in slot order
+    size_t append(size_t count) {
+        const size_t first = ids.size();
+        const size_t total = first + count;
+        for (size_t s = first; s < total; ++s) {
+            slots.push_back(static_cast<uint32_t>(s));
+            ids.push_back(static_cast<BodyId>(slots.size() - 1));
+        }
+        posX.resize(total); posY.resize(total); posZ.resize(total);
+        prevX.resize(total); prevY.resize(total); prevZ.resize(total);
+        velX.resize(total); velY.resize(total); velZ.resize(total);
+        accX.resize(total); accY.resize(total); accZ.resize(total);
+        jerkX.resize(total); jerkY.resize(total); jerkZ.resize(total);
+        timeSteps.resize(total);
+        masses.resize(total);
+        densities.resize(total, Real(1));
+        radii.resize(total);
+        initializingFlags.resize(total);
+        ++revision;
+        return first;
+    }
+
+    // Sets every property of the body in a slot as add() would, without
+    // touching the revision. Distinct slots may be placed concurrently.
+    void place(size_t slot, const glm::dvec3& position, const glm::dvec3& velocity, double mass, double density) {
+        posX[slot] = prevX[slot] = static_cast<Real>(position.x);
+        posY[slot] = prevY[slot] = static_cast<Real>(position.y);
+        posZ[slot] = prevZ[slot] = static_cast<Real>(position.z);
+        velX[slot] = static_cast<Real>(velocity.x);
+        velY[slot] = static_cast<Real>(velocity.y);
+        velZ[slot] = static_cast<Real>(velocity.z);
+        masses[slot] = static_cast<Real>(mass);
+        densities[slot] = static_cast<Real>(density);
+        radii[slot] = computeRadius(masses[slot], densities[slot]);
+    }
+
+    void reserve(size_t count) {
+        posX.reserve(count); posY.reserve(count); posZ.reserve(count);
+        prevX.reserve(count); prevY.reserve(count); prevZ.reserve(count);
+        velX.reserve(count); velY.reserve(count); velZ.reserve(count);
+        accX.reserve(count); accY.reserve(count); accZ.reserve(count);
+        jerkX.reserve(count); jerkY.reserve(count); jerkZ.reserve(count);
+        timeSteps.reserve(count);
+        masses.reserve(count);
+        densities.reserve(count);
+        radii.reserve(count);
+        initializingFlags.reserve(count);
+        ids.reserve(count);
+    }
+
+    size_t size() const { return ids.size(); }
+    bool empty() const { return ids.empty(); }
+
+    bool contains(BodyId id) const { return id < slots.size() && slots[id] != INVALID_SLOT; }
+    // Ids are handed out in order and never reused
+    BodyId nextId() const { return static_cast<BodyId>(slots.size()); }
+    uint32_t slotOf(BodyId id) const { return slots[id]; }
+    BodyId idAt(size_t slot) const { return ids[slot]; }
+
+    // Changes whenever bodies are added, merged, removed, moved by hand, or
+    // change mass or initializing state, so cached forces know when they are stale
+    uint64_t getRevision() const { return revision; }
+
+    // Fraction of a fixed step between the previous and current positions
+
+    // Raw column access for the hot loops
+    Real* x() { return posX.data(); }
+    Real* y() { return posY.data(); }
+    Real* z() { return posZ.data(); }
+    Real* previousX() { return prevX.data(); }
+    Real* previousY() { return prevY.data(); }
+    Real* previousZ() { return prevZ.data(); }
+    Real* vx() { return velX.data(); }
+    Real* vy() { return velY.data(); }
+    Real* vz() { return velZ.data(); }
+    Real* ax() { return accX.data(); }
+    Real* ay() { return accY.data(); }
+    Real* az() { return accZ.data(); }
+    Real* jx() { return jerkX.data(); }
+    Real* jy() { return jerkY.data(); }
+    Real* jz() { return jerkZ.data(); }
+    Real* timeStep() { return timeSteps.data(); }
+    const Real* x() const { return posX.data(); }
+    const Real* y() const { return posY.data(); }
+    const Real* z() const { return posZ.data(); }
+    const Real* previousX() const { return prevX.data(); }
+    const Real* previousY() const { return prevY.data(); }
+    const Real* previousZ() const { return prevZ.data(); }
+    const Real* vx() const { return velX.data(); }
+    const Real* vy() const { return velY.data(); }
+    const Real* vz() const { return velZ.data(); }
+    const Real* ax() const { return accX.data(); }
+    const Real* ay() const { return accY.data(); }
+    const Real* az() const { return accZ.data(); }
+    const Real* jx() const { return jerkX.data(); }
+    const Real* jy() const { return jerkY.data(); }
+    const Real* jz() const { return jerkZ.data(); }
+    const Real* timeStep() const { return timeSteps.data(); }
+    const Real* mass() const { return masses.data(); }
+    const Real* radius() const { return radii.data(); }
+    const Real* density() const { return densities.data(); }
+    const uint8_t* initializing() const { return initializingFlags.data(); }
+
+    // Per-body access by id
+    glm::vec3 getPosition(BodyId id) const {
+        uint32_t s = slots[id];
+        return glm::vec3(posX[s], posY[s], posZ[s]);
+    }
+
+    // blend runs from 0, the state before the last step, to 1, the current one
+    glm::vec3 getDisplayPosition(BodyId id, float blend) const {
+        uint32_t s = slots[id];
+        return glm::vec3(prevX[s] + (posX[s] - prevX[s]) * blend,
+                         prevY[s] + (posY[s] - prevY[s]) * blend,
+                         prevZ[s] + (posZ[s] - prevZ[s]) * blend);
+    }
+
+    glm::vec3 getVelocity(BodyId id) const {
+        uint32_t s = slots[id];
+        return glm::vec3(velX[s], velY[s], velZ[s]);
+    }
+
+    Real getMass(BodyId id) const { return masses[slots[id]]; }
+    Real getRadius(BodyId id) const { return radii[slots[id]]; }
+    Real getDensity(BodyId id) const { return densities[slots[id]]; }
+    bool isInitializing(BodyId id) const { return initializingFlags[slots[id]] != 0; }
+
+    // Moves a body without a trail to interpolate along
+    void setPosition(BodyId id, const glm::vec3& pos) {
+        uint32_t s = slots[id];
+        posX[s] = prevX[s] = pos.x;
+        posY[s] = prevY[s] = pos.y;
+        posZ[s] = prevZ[s] = pos.z;
+        ++revision;
+    }
+
+    void setVelocity(BodyId id, const glm::vec3& vel) {
+        uint32_t s = slots[id];
+        velX[s] = vel.x;
+        velY[s] = vel.y;
+        velZ[s] = vel.z;
+    }
+
+    void setMass(BodyId id, Real mass) {
+        uint32_t s = slots[id];
+        masses[s] = mass;
+        radii[s] = computeRadius(mass, densities[s]);
+        ++revision;
+    }
+
+    void setInitializing(BodyId id, bool init) {
+        initializingFlags[slots[id]] = init ? 1 : 0;
+        ++revision;
+    }
+
+    // Folds the body in slot `from` into the one in slot `into`: masses add,
+    // momentum is conserved, the survivor moves to the centre of mass and
+    // takes the density that keeps the combined volume. The absorbed body is
+    // left massless until compact() removes it.
+    void absorb(uint32_t into, uint32_t from) {
+        const Real m1 = masses[into], m2 = masses[from];
+        const Real total = m1 + m2;
+        if (total <= 0) return;
+        const Real w1 = m1 / total, w2 = m2 / total;
+
+        posX[into] = posX[into] * w1 + posX[from] * w2;
+        posY[into] = posY[into] * w1 + posY[from] * w2;
+        posZ[into] = posZ[into] * w1 + posZ[from] * w2;
+        prevX[into] = prevX[into] * w1 + prevX[from] * w2;
+        prevY[into] = prevY[into] * w1 + prevY[from] * w2;
+        prevZ[into] = prevZ[into] * w1 + prevZ[from] * w2;
+        velX[into] = velX[into] * w1 + velX[from] * w2;
+        velY[into] = velY[into] * w1 + velY[from] * w2;
+        velZ[into] = velZ[into] * w1 + velZ[from] * w2;
+        densities[into] = total / (m1 / densities[into] + m2 / densities[from]);
+        masses[into] = total;
+        radii[into] = computeRadius(total, densities[into]);
+        masses[from] = 0;
+        ++revision;
+    }
+
+    // Drops every slot flagged in `removed`, sliding the survivors down in
+    // order. Columns only shrink, so nothing is reallocated; ids of removed
+    // bodies stop being contained. Returns the number of bodies removed.
+    size_t compact(const std::vector<uint8_t>& removed) {
+        const size_t count = ids.size();
+        size_t kept = 0;
+        for (size_t s = 0; s < count; ++s) {
+            if (removed[s]) {
+                slots[ids[s]] = INVALID_SLOT;
+                continue;
+            }
+            if (kept != s) {
+                posX[kept] = posX[s]; posY[kept] = posY[s]; posZ[kept] = posZ[s];
+                prevX[kept] = prevX[s]; prevY[kept] = prevY[s]; prevZ[kept] = prevZ[s];
+                velX[kept] = velX[s]; velY[kept] = velY[s]; velZ[kept] = velZ[s];
+                accX[kept] = accX[s]; accY[kept] = accY[s]; accZ[kept] = accZ[s];
+                jerkX[kept] = jerkX[s]; jerkY[kept] = jerkY[s]; jerkZ[kept] = jerkZ[s];
+                timeSteps[kept] = timeSteps[s];
+                masses[kept] = masses[s];
+                densities[kept] = densities[s];
+                radii[kept] = radii[s];
+                initializingFlags[kept] = initializingFlags[s];
+                ids[kept] = ids[s];
+                slots[ids[kept]] = static_cast<uint32_t>(kept);
+            }
+            ++kept;
+        }
+        if (kept == count) return 0;
+
+        posX.resize(kept); posY.resize(kept); posZ.resize(kept);
+        prevX.resize(kept); prevY.resize(kept); prevZ.resize(kept);
+        velX.resize(kept); velY.resize(kept); velZ.resize(kept);
+        accX.resize(kept); accY.resize(kept); accZ.resize(kept);
+        jerkX.resize(kept); jerkY.resize(kept); jerkZ.resize(kept);
+        timeSteps.resize(kept);
+        masses.resize(kept);
+        densities.resize(kept);
+        radii.resize(kept);
+        initializingFlags.resize(kept);
+        ids.resize(kept);
+        ++revision;
+        return count - kept;
+    }
+
+    // Every column in a fixed order, for bulk serialization: the per-body
+    // columns, then the id -> slot map. The visitor gets each std::vector.
+    static constexpr size_t COLUMN_COUNT = 22;
+
+    template <typename Visitor>
+    void visitColumns(Visitor&& visit) {
+        visit(posX); visit(posY); visit(posZ);
+        visit(prevX); visit(prevY); visit(prevZ);
+        visit(velX); visit(velY); visit(velZ);
+        visit(accX); visit(accY); visit(accZ);
+        visit(jerkX); visit(jerkY); visit(jerkZ);
+        visit(timeSteps);
+        visit(masses);
+        visit(densities);
+        visit(radii);
+        visit(initializingFlags);
+        visit(ids);
+        visit(slots);
+    }
+
+    template <typename Visitor>
+    void visitColumns(Visitor&& visit) const {
+        const_cast<BasicBodyStore*>(this)->visitColumns([&](const auto& column) { visit(column); });
+    }
+
+    // After columns were replaced wholesale
+    void markChanged() { ++revision; }
+
+    static Real computeRadius(Real mass, Real density) {
+        return std::pow(((Real(3) * mass / density) / (Real(4) * Real(Constants::PI))), (Real(1) / Real(3))) /
+               Real(Constants::SIZE_RATIO);
+    }
+};
+
+using BodyStore = BasicBodyStore<float>;
+using DoubleBodyStore = BasicBodyStore<double>;
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "bodystore.hpp"
+#include "threadpool.hpp"
+
+struct CollisionPair {
+    uint32_t first, second; // body slots, first < second
+};
+
+// Sweep-and-prune broad phase over swept spheres. Every body covers the
+// box around its previous and current positions grown by its radius, so
+// bodies that passed through each other during a step are still paired.
+// Boxes are sorted as intervals along the axis on which the bodies are most
+// spread out. The interval order is kept from call to call and repaired
+// with an insertion sort, which is close to linear while bodies move little
+// between steps. The sweep emits each pair whose boxes overlap exactly once.
+// Boxes are kept in the store's precision, so no contact is lost to rounding.
+template <typename Real>
+class BasicSweepAndPrune {
+private:
+    struct Interval {
+        Real min, max;
+        uint32_t slot;
+    };
+
+    struct Box {
+        Real minU, maxU, minW, maxW; // the two axes not swept along
+    };
+
+    static constexpr size_t SWEEP_CHUNK = 1024;
+
+    std::vector<Interval> intervals;
+    std::vector<Box> boxes; // by slot
+    std::vector<std::vector<CollisionPair>> chunkPairs;
+    std::vector<CollisionPair> pairs;
+    int axis;
+    size_t builtCount;
+    uint64_t builtRevision;
+
+public:
+    BasicSweepAndPrune() : axis(0), builtCount(0), builtRevision(~uint64_t(0)) {}
+
+    // Candidate pairs of bodies that are not being initialized
+    const std::vector<CollisionPair>& findPairs(const BasicBodyStore<Real>& bodies, ThreadPool& pool) {
+        const size_t count = bodies.size();
+        const Real* radius = bodies.radius();
+        const uint8_t* initializing = bodies.initializing();
+        const Real* columns[3] = {bodies.x(), bodies.y(), bodies.z()};
+        const Real* previous[3] = {bodies.previousX(), bodies.previousY(), bodies.previousZ()};
+
+        int widest = widestAxis(bodies);
+        bool rebuilt = false;
+        if (widest != axis || count != builtCount || bodies.getRevision() != builtRevision) {
+            // Bodies came, went or were moved by hand: sort from scratch
+            axis = widest;
+            builtCount = count;
+            builtRevision = bodies.getRevision();
+            intervals.clear();
+            for (uint32_t i = 0; i < count; ++i) {
+                if (!initializing[i]) intervals.push_back({Real(0), Real(0), i});
+            }
+            rebuilt = true;
+        }
+
+        const int axisU = (axis + 1) % 3, axisW = (axis + 2) % 3;
+        boxes.resize(count);
+        for (Interval& interval : intervals) {
+            const uint32_t i = interval.slot;
+            const Real r = radius[i];
+            interval.min = std::min(columns[axis][i], previous[axis][i]) - r;
+            interval.max = std::max(columns[axis][i], previous[axis][i]) + r;
+            boxes[i].minU = std::min(columns[axisU][i], previous[axisU][i]) - r;
+            boxes[i].maxU = std::max(columns[axisU][i], previous[axisU][i]) + r;
+            boxes[i].minW = std::min(columns[axisW][i], previous[axisW][i]) - r;
+            boxes[i].maxW = std::max(columns[axisW][i], previous[axisW][i]) + r;
+        }
+        if (rebuilt) {
+            std::sort(intervals.begin(), intervals.end(), [](const Interval& a, const Interval& b) {
+                return a.min < b.min || (a.min == b.min && a.slot < b.slot);
+            });
+        }
+        for (size_t k = 1; k < intervals.size(); ++k) {
+            Interval moving = intervals[k];
+            size_t m = k;
+            while (m > 0 && intervals[m - 1].min > moving.min) {
+                intervals[m] = intervals[m - 1];
+                --m;
+            }
+            intervals[m] = moving;
+        }
+
+        // Sweep in fixed chunks and concatenate in chunk order
+        const size_t chunks = (intervals.size() + SWEEP_CHUNK - 1) / SWEEP_CHUNK;
+        chunkPairs.resize(chunks);
+        pool.parallelFor(chunks, 1, [&](size_t begin, size_t end) {
+            for (size_t chunk = begin; chunk < end; ++chunk) {
+                std::vector<CollisionPair>& out = chunkPairs[chunk];
+                out.clear();
+                size_t last = std::min(intervals.size(), (chunk + 1) * SWEEP_CHUNK);
+                for (size_t k = chunk * SWEEP_CHUNK; k < last; ++k) {
+                    const Interval& a = intervals[k];
+                    const Box& boxA = boxes[a.slot];
+                    for (size_t m = k + 1; m < intervals.size() && intervals[m].min <= a.max; ++m) {
+                        const uint32_t b = intervals[m].slot;
+                        const Box& boxB = boxes[b];
+                        if (boxB.minU > boxA.maxU || boxA.minU > boxB.maxU ||
+                            boxB.minW > boxA.maxW || boxA.minW > boxB.maxW) continue;
+                        out.push_back({std::min(a.slot, b), std::max(a.slot, b)});
+                    }
+                }
+            }
+        });
+
+        pairs.clear();
+        for (const std::vector<CollisionPair>& out : chunkPairs) {
+            pairs.insert(pairs.end(), out.begin(), out.end());
+        }
+        return pairs;
+    }
+
+    const std::vector<CollisionPair>& getPairs() const { return pairs; }
+
+private:
+    // Axis with the largest positional variance, so the fewest intervals
+    // overlap. The current axis is kept unless another is clearly wider,
+    // since switching throws away the warm order.
+    int widestAxis(const BasicBodyStore<Real>& bodies) const {
+        const size_t count = bodies.size();
+        const Real* columns[3] = {bodies.x(), bodies.y(), bodies.z()};
+        const uint8_t* initializing = bodies.initializing();
+
+        double variance[3];
+        for (int d = 0; d < 3; ++d) {
+            double sum = 0.0, sumSq = 0.0;
+            size_t n = 0;
+            for (size_t i = 0; i < count; ++i) {
+                if (initializing[i]) continue;
+                sum += columns[d][i];
+                sumSq += double(columns[d][i]) * columns[d][i];
+                ++n;
+            }
+            variance[d] = n > 0 ? sumSq / n - (sum / n) * (sum / n) : 0.0;
+        }
+
+        int best = static_cast<int>(std::max_element(variance, variance + 3) - variance);
+        return variance[best] > 1.25 * variance[axis] ? best : axis;
+    }
+};
+
+using SweepAndPrune = BasicSweepAndPrune<float>;
@@ -0,0 +1,398 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bodystore.hpp"
+#include "mappedfile.hpp"
+#include "profiler.hpp"
+#include "physicsengine.hpp"
+
+// How the windowed app draws a body; the physics does not need it, so it
+// is kept in a side table keyed by id
+struct BodyAppearance {
+    uint32_t id;
+    uint32_t glowing;
+    float color[4];
+};
+
+// Everything a checkpoint holds, captured from an engine in one copy
+struct CheckpointState {
+    BodyStore bodies;
+    double simulationTime;
+    uint64_t stepCount;
+    uint64_t seed; // of the scenario generator, 0 if none
+    Integrator integrator;
+    GravitySolver solver;
+    CollisionMode collisionMode;
+    float fixedStep;
+    float softening;
+    double hermiteAccuracy;
+    float openingAngle;
+    float multipoleOpeningAngle;
+    int expansionOrder;
+    bool forcesCurrent;
+    bool hermiteCurrent;
+    std::vector<BodyAppearance> appearance; // empty unless the app saved it
+};
+
+// Versioned binary checkpoint of a PhysicsEngine. The file is a fixed
+// little-endian header followed by every BodyStore column as a raw array,
+// each starting on a 64-byte boundary, in BodyStore::visitColumns order,
+// and the table of body appearances, which may be empty. The run's
+// settings, including the tree solvers' opening angles and expansion
+// order, time and step count, the scenario seed and whether the saved
+// accelerations, jerks and block steps are current are kept in the header,
+// so a restored run takes the same next step the saved one would have.
+//
+// Restoring maps the file and copies each column into the store in one
+// block; nothing is parsed beyond the header and a bounds check of the
+// id map, so it runs at memory bandwidth.
+class Checkpoint {
+public:
+    static constexpr uint32_t VERSION = 2;
+    static constexpr size_t COLUMN_COUNT = BodyStore::COLUMN_COUNT;
+    static constexpr size_t ALIGNMENT = 64;
+
+private:
+    struct Column {
+        uint64_t offset, bytes;
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t columnCount;
+        uint64_t bodyCount;
+        uint64_t idCount;
+        double simulationTime;
+        uint64_t stepCount;
+        uint64_t seed;
+        uint32_t integrator;
+        uint32_t solver;
+        uint32_t collisionMode;
+        uint32_t flags;
+        float fixedStep;
+        float softening;
+        double hermiteAccuracy;
+        float openingAngle;
+        float multipoleOpeningAngle;
+        uint32_t expansionOrder;
+        uint32_t reserved;
+        Column columns[COLUMN_COUNT];
+        Column appearance;
+    };
+    static_assert(sizeof(Header) == 104 + (COLUMN_COUNT + 1) * sizeof(Column), "checkpoint header must not be padded");
+    static_assert(sizeof(BodyAppearance) == 24, "appearance entry must not be padded");
+
+    static constexpr char MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'C', 'K', 'P'};
+    static constexpr uint32_t FORCES_CURRENT = 1;
+    static constexpr uint32_t HERMITE_CURRENT = 2;
+    static constexpr char PADDING[ALIGNMENT] = {};
+
+public:
+    // Copies the engine's state and the given appearances; the store's
+    // columns keep their capacity across captures
+    static void capture(const PhysicsEngine& engine, uint64_t seed, CheckpointState& state,
+                        const std::vector<BodyAppearance>& appearance = std::vector<BodyAppearance>()) {
+        state.bodies = engine.getBodies();
+        state.simulationTime = engine.getSimulationTime();
+        state.stepCount = engine.getStepCount();
+        state.seed = seed;
+        state.integrator = engine.getIntegrator();
+        state.solver = engine.getGravitySolver();
+        state.collisionMode = engine.getCollisionMode();
+        state.fixedStep = engine.getFixedTimeStep();
+        state.softening = engine.getSoftening();
+        state.hermiteAccuracy = engine.getHermiteAccuracy();
+        state.openingAngle = engine.getOpeningAngle();
+        state.multipoleOpeningAngle = engine.getMultipoleOpeningAngle();
+        state.expansionOrder = engine.getExpansionOrder();
+        state.forcesCurrent = engine.hasCurrentForces();
+        state.hermiteCurrent = engine.hasCurrentHermiteState();
+        state.appearance = appearance;
+    }
+
+    // Writes to a temporary file next to path and renames it over path, so
+    // a crash mid-write never leaves a torn checkpoint behind
+    static bool write(const CheckpointState& state, const std::string& path) {
+        if (!littleEndianHost()) {
+            std::cerr << "Checkpoints are little-endian; this host is not" << std::endl;
+            return false;
+        }
+
+        Header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.columnCount = COLUMN_COUNT;
+        header.bodyCount = state.bodies.size();
+        header.idCount = state.bodies.nextId();
+        header.simulationTime = state.simulationTime;
+        header.stepCount = state.stepCount;
+        header.seed = state.seed;
+        header.integrator = static_cast<uint32_t>(state.integrator);
+        header.solver = static_cast<uint32_t>(state.solver);
+        header.collisionMode = static_cast<uint32_t>(state.collisionMode);
+        header.flags = (state.forcesCurrent ? FORCES_CURRENT : 0) | (state.hermiteCurrent ? HERMITE_CURRENT : 0);
+        header.fixedStep = state.fixedStep;
+        header.softening = state.softening;
+        header.hermiteAccuracy = state.hermiteAccuracy;
+        header.openingAngle = state.openingAngle;
+        header.multipoleOpeningAngle = state.multipoleOpeningAngle;
+        header.expansionOrder = static_cast<uint32_t>(state.expansionOrder);
+
+        size_t column = 0;
+        uint64_t offset = alignUp(sizeof(Header));
+        state.bodies.visitColumns([&](const auto& values) {
+            header.columns[column].offset = offset;
+            header.columns[column].bytes = values.size() * sizeof(values[0]);
+            offset = alignUp(offset + header.columns[column].bytes);
+            ++column;
+        });
+        header.appearance.offset = offset;
+        header.appearance.bytes = state.appearance.size() * sizeof(BodyAppearance);
+
+        const std::string temporary = path + ".tmp";
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            std::cerr << "Failed to open '" << temporary << "' for writing" << std::endl;
+            return false;
+        }
+        uint64_t written = sizeof(Header);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+        column = 0;
+        state.bodies.visitColumns([&](const auto& values) {
+            file.write(PADDING, static_cast<std::streamsize>(header.columns[column].offset - written));
+            file.write(reinterpret_cast<const char*>(values.data()),
+                       static_cast<std::streamsize>(header.columns[column].bytes));
+            written = header.columns[column].offset + header.columns[column].bytes;
+            ++column;
+        });
+        file.write(PADDING, static_cast<std::streamsize>(header.appearance.offset - written));
+        file.write(reinterpret_cast<const char*>(state.appearance.data()),
+                   static_cast<std::streamsize>(header.appearance.bytes));
+        file.close();
+        if (!file) {
+            std::cerr << "Failed to write checkpoint '" << temporary << "'" << std::endl;
+            std::remove(temporary.c_str());
+            return false;
+        }
+
+#ifdef _WIN32
+        if (!MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+#else
+        if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+#endif
+            std::cerr << "Failed to move checkpoint into place at '" << path << "'" << std::endl;
+            std::remove(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    static bool write(const PhysicsEngine& engine, uint64_t seed, const std::string& path) {
+        CheckpointState state;
+        capture(engine, seed, state);
+        return write(state, path);
+    }
+
+    // Replaces the engine's bodies and settings with the checkpoint's and
+    // hands back the appearances saved with them. The engine is left
+    // untouched if the file is unreadable or malformed.
+    static bool restore(const std::string& path, PhysicsEngine& engine, uint64_t* seed = nullptr,
+                        std::vector<BodyAppearance>* appearance = nullptr) {
+        if (!littleEndianHost()) {
+            std::cerr << "Checkpoints are little-endian; this host is not" << std::endl;
+            return false;
+        }
+        MappedFile file;
+        if (!file.open(path)) {
+            std::cerr << "Failed to map checkpoint '" << path << "'" << std::endl;
+            return false;
+        }
+
+        Header header;
+        if (file.size() < sizeof(Header)) return malformed(path, "truncated header");
+        std::memcpy(&header, file.data(), sizeof(Header));
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) return malformed(path, "not a checkpoint");
+        if (header.version != VERSION) return malformed(path, "unsupported version " + std::to_string(header.version));
+        if (header.columnCount != COLUMN_COUNT) return malformed(path, "unexpected column count");
+        if (header.idCount < header.bodyCount || header.idCount > BodyStore::INVALID_ID) {
+            return malformed(path, "inconsistent body and id counts");
+        }
+        if (header.integrator > static_cast<uint32_t>(Integrator::Hermite) ||
+            header.solver > static_cast<uint32_t>(GravitySolver::FastMultipole) ||
+            header.collisionMode > static_cast<uint32_t>(CollisionMode::Merge)) {
+            return malformed(path, "unknown engine setting");
+        }
+
+        // Every column must have its exact size and lie inside the file
+        size_t column = 0;
+        bool sized = true;
+        engine.getBodies().visitColumns([&](const auto& values) {
+            const uint64_t count = column + 1 == COLUMN_COUNT ? header.idCount : header.bodyCount;
+            const Column& entry = header.columns[column];
+            if (entry.bytes != count * sizeof(values[0]) || entry.offset % ALIGNMENT != 0 ||
+                entry.offset > file.size() || entry.bytes > file.size() - entry.offset) {
+                sized = false;
+            }
+            ++column;
+        });
+        if (!sized) return malformed(path, "column out of bounds");
+        const Column& table = header.appearance;
+        if (table.bytes % sizeof(BodyAppearance) != 0 || table.offset % ALIGNMENT != 0 ||
+            table.offset > file.size() || table.bytes > file.size() - table.offset) {
+            return malformed(path, "appearance table out of bounds");
+        }
+
+        // The id map is the only data indexed by other data
+        const uint32_t* ids = reinterpret_cast<const uint32_t*>(file.data() + header.columns[COLUMN_COUNT - 2].offset);
+        const uint32_t* slots = reinterpret_cast<const uint32_t*>(file.data() + header.columns[COLUMN_COUNT - 1].offset);
+        for (uint64_t id = 0; id < header.idCount; ++id) {
+            if (slots[id] != BodyStore::INVALID_SLOT && slots[id] >= header.bodyCount) return malformed(path, "corrupt id map");
+        }
+        for (uint64_t i = 0; i < header.bodyCount; ++i) {
+            if (ids[i] >= header.idCount || slots[ids[i]] != i) return malformed(path, "corrupt id map");
+        }
+
+        engine.setIntegrator(static_cast<Integrator>(header.integrator));
+        engine.setGravitySolver(static_cast<GravitySolver>(header.solver));
+        engine.setCollisionMode(static_cast<CollisionMode>(header.collisionMode));
+        engine.setFixedTimeStep(header.fixedStep);
+        engine.setSoftening(header.softening);
+        engine.setHermiteAccuracy(header.hermiteAccuracy);
+        engine.setOpeningAngle(header.openingAngle);
+        engine.setMultipoleOpeningAngle(header.multipoleOpeningAngle);
+        engine.setExpansionOrder(static_cast<int>(header.expansionOrder));
+
+        BodyStore& bodies = engine.getBodies();
+        column = 0;
+        bodies.visitColumns([&](auto& values) {
+            const Column& entry = header.columns[column];
+            values.resize(entry.bytes / sizeof(values[0]));
+            if (entry.bytes > 0) std::memcpy(values.data(), file.data() + entry.offset, entry.bytes);
+            ++column;
+        });
+        bodies.markChanged();
+        engine.resumeState(header.simulationTime, header.stepCount,
+                           (header.flags & FORCES_CURRENT) != 0, (header.flags & HERMITE_CURRENT) != 0);
+        if (seed) *seed = header.seed;
+        if (appearance) {
+            appearance->resize(table.bytes / sizeof(BodyAppearance));
+            if (table.bytes > 0) std::memcpy(appearance->data(), file.data() + table.offset, table.bytes);
+        }
+        return true;
+    }
+
+private:
+    static uint64_t alignUp(uint64_t offset) {
+        return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+    static bool littleEndianHost() {
+        const uint16_t probe = 1;
+        uint8_t first;
+        std::memcpy(&first, &probe, 1);
+        return first == 1;
+    }
+
+    static bool malformed(const std::string& path, const std::string& reason) {
+        std::cerr << "Invalid checkpoint '" << path << "': " << reason << std::endl;
+        return false;
+    }
+};
+
+// Writes checkpoints on a background thread. submit() only copies the
+// engine's state, so the caller goes on stepping while the file is written.
+class CheckpointWriter {
+private:
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable changed;
+    CheckpointState staged; // owned by the caller while idle, by the thread while busy
+    std::string stagedPath;
+    bool busy;
+    bool stopping;
+    bool lastSucceeded;
+
+public:
+    CheckpointWriter() : busy(false), stopping(false), lastSucceeded(true) {
+        thread = std::thread([this] { loop(); });
+    }
+
+    ~CheckpointWriter() {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [this] { return !busy; });
+            stopping = true;
+        }
+        changed.notify_all();
+        thread.join();
+    }
+
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+    // Captures the engine and queues the write. Returns false, without
+    // copying anything, while the previous checkpoint is still being written.
+    bool submit(const PhysicsEngine& engine, uint64_t seed, const std::string& path,
+                const std::vector<BodyAppearance>& appearance = std::vector<BodyAppearance>()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (busy) return false;
+        }
+        PROFILE_SCOPE("capture checkpoint");
+        Checkpoint::capture(engine, seed, staged, appearance);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stagedPath = path;
+            busy = true;
+        }
+        changed.notify_all();
+        return true;
+    }
+
+    // Blocks until the last submitted checkpoint is on disk and reports
+    // whether writing it succeeded
+    bool wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return !busy; });
+        return lastSucceeded;
+    }
+
+    bool isBusy() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return busy;
+    }
+
+private:
+    void loop() {
+        PROFILE_THREAD("checkpoint writer");
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            changed.wait(lock, [this] { return stopping || busy; });
+            if (!busy) return; // stopping
+
+            lock.unlock();
+            bool succeeded;
+            {
+                PROFILE_SCOPE("write checkpoint");
+                succeeded = Checkpoint::write(staged, stagedPath);
+            }
+            lock.lock();
+            lastSucceeded = succeeded;
+            busy = false;
+            changed.notify_all();
+        }
+    }
+};
@@ -1,9 +1,16 @@
 #pragma once
 
+#include <cmath>
+
 namespace Constants {
     const double G = 6.6743e-10; // Gravitational constant (m^3 kg^-1 s^-2)
     const float C = 299792458.0f; // Speed of light (m/s)
     const float DEFAULT_MASS = float(pow(10, 22));
     const float SIZE_RATIO = 30000.0f;
     const float PI = 3.14159265359f;
+    const float TIME_SCALE = 94.0f; // Wall-clock seconds per unit of simulation time
+    const float FORCE_SCALE = 60.0f / 96.0f; // Keeps the original per-frame kick strength at 60 fps
+    const float SOFTENING_LENGTH = 1.0f; // Plummer softening of every solver (km)
+    // G in store units: kilometres, kilograms and simulation time
+    const double SIMULATION_G = G * 1.0e-6 * TIME_SCALE * FORCE_SCALE;
 }
\ No newline at end of file
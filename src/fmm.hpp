@@ -0,0 +1,646 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "bodystore.hpp"
+#include "gravitykernel.hpp"
+#include "octree.hpp"
+#include "profiler.hpp"
+#include "threadpool.hpp"
+
+// Cartesian Taylor-series fast multipole method.
+//
+// Multipoles about a cell's center of mass z_B are M_k = sum m (x - z_B)^k and
+// locals about z_A are L_n with psi(x) = sum L_n (x - z_A)^n, psi = sum m / r.
+// With Plummer softening r is sqrt(|x|^2 + eps^2) throughout. M2L uses the
+// scaled derivatives T_m = D^m(1/r) / m! of the kernel, built with the
+// recurrence
+//   |m| r^2 T_m + (2|m| - 1) sum_d R_d T_{m-e_d} + (|m| - 1) sum_d T_{m-2e_d} = 0,
+// which holds for the softened kernel because eps^2 is constant.
+// All expansions are truncated at total degree |n| + |k| <= order.
+//
+// Far-field work is found by a dual-tree traversal: two cells interact through
+// M2L when (r_A + r_B) < theta * |z_A - z_B|, otherwise the larger one is split
+// until both are leaves and are summed directly.
+//
+// Every pair of cells is visited once and updates both sides: M2L builds
+// T(R) once and reuses it for the other direction as T(-R) = (-1)^|m| T(R),
+// and two leaves are summed against each other by the SIMD kernel from the
+// tree-ordered copies. The pairs are scheduled into rounds that share no
+// cell, so each round runs on the pool and every cell still receives its
+// contributions in the same order for any thread count.
+class FastMultipole {
+public:
+    static constexpr int MAX_ORDER = 10;
+    static constexpr int TERM_CAPACITY = (MAX_ORDER + 1) * (MAX_ORDER + 2) * (MAX_ORDER + 3) / 6;
+
+private:
+    // Unordered pair of cells
+    struct Interaction {
+        uint32_t a;
+        uint32_t b;
+    };
+
+    Octree tree;
+    GravityKernel kernel; // near field; also holds the softening
+    int order;
+    float theta;
+    double softeningSq;
+
+    // Multi-index tables, sorted by total degree
+    int termCount;
+    std::vector<int> termI, termJ, termK;
+    std::vector<int> termIndex;  // (i, j, k) -> term, -1 above order
+    std::vector<double> factorials;              // m!
+    std::vector<double> inverseFactorials;       // 1 / m!
+    std::vector<double> signedInverseFactorials; // (-1)^|m| / m!
+    std::vector<double> binomials; // (MAX_ORDER + 1)^2 Pascal triangle
+
+    // Flattened translation operators: out[t] += sum coefficient * a[aTerm] * b[bTerm]
+    // over the products listed in [offsets[t], offsets[t + 1])
+    struct OperatorTerm {
+        uint16_t aTerm;
+        uint16_t bTerm;
+        double coefficient;
+    };
+    struct Operator {
+        std::vector<OperatorTerm> products;
+        std::vector<uint32_t> offsets;
+
+        void apply(double* out, const double* a, const double* b) const {
+            for (size_t t = 0; t + 1 < offsets.size(); ++t) {
+                double sum = 0.0;
+                for (uint32_t p = offsets[t]; p < offsets[t + 1]; ++p) {
+                    sum += products[p].coefficient * a[products[p].aTerm] * b[products[p].bTerm];
+                }
+                out[t] += sum;
+            }
+        }
+    };
+    Operator m2m; // M_k += C(k,j) M_j s^(k-j)
+    // M2L without coefficients: with D_m = m! T_m,
+    //   L_n += (1/n!) sum_k D_(n+k) (-1)^|k| M_k / k!
+    // Terms are sorted by degree, so the k of row n are the first
+    // m2lOffsets[n + 1] - m2lOffsets[n] terms; m2lTerms lists n + k.
+    std::vector<uint16_t> m2lTerms;
+    std::vector<uint32_t> m2lOffsets;
+    Operator l2l; // L_j += C(n,j) L_n s^(n-j)
+
+    // Terms m - e_d and m - 2e_d feeding the derivative recurrence, -1 if absent
+    struct Recurrence {
+        int lower1[3];
+        int lower2[3];
+        double firstScale;  // (2|m| - 1) / |m|
+        double secondScale; // (|m| - 1) / |m|
+    };
+    std::vector<Recurrence> recurrences;
+
+    std::vector<double> multipoles;
+    std::vector<double> locals;
+    // Pairs in round order; round r is [rounds[r], rounds[r + 1])
+    std::vector<Interaction> farList, nearList;
+    std::vector<uint32_t> farRounds, nearRounds;
+    // Scheduling scratch
+    std::vector<Interaction> scheduled;
+    std::vector<uint32_t> pairRounds, nodeDegrees;
+    std::vector<uint64_t> busyRounds;
+    std::vector<uint32_t> leaves;
+    std::vector<float> nearX, nearY, nearZ; // tree order
+
+    // Measured on clouds of 2k to 1M bodies: with the SIMD near field, 128
+    // balances M2L against P2P; 16-body leaves took four times as long
+    static constexpr uint32_t LEAF_CAPACITY = 128;
+    // Pairs handed to one task
+    static constexpr size_t FAR_GRAIN = 16;
+    // M2L pairs evaluated side by side
+    static constexpr size_t M2L_BATCH = 4;
+    static constexpr size_t NEAR_GRAIN = 4;
+
+public:
+    // Order 4 at theta 0.7 comes out about as accurate as Barnes-Hut at 0.5
+    explicit FastMultipole(int order = 4, float theta = 0.7f)
+        : tree(LEAF_CAPACITY), order(0), theta(theta), softeningSq(0.0), termCount(0) {
+        setOrder(order);
+    }
+
+    void setOrder(int expansionOrder) {
+        order = std::max(1, std::min(MAX_ORDER, expansionOrder));
+        buildTermTables();
+    }
+    int getOrder() const { return order; }
+
+    void setOpeningAngle(float angle) { theta = std::max(0.0f, angle); }
+    float getOpeningAngle() const { return theta; }
+
+    // Plummer softening of both the near field and the expansions
+    void setSoftening(float epsilon) {
+        softeningSq = double(epsilon) * epsilon;
+        kernel.setSoftening(epsilon);
+    }
+
+    void setInstructionSet(GravityKernel::InstructionSet set) { kernel.setInstructionSet(set); }
+
+    const Octree& getTree() const { return tree; }
+    size_t getFarInteractionCount() const { return farList.size(); }
+    size_t getNearInteractionCount() const { return nearList.size(); }
+
+    // The tree build, traversal, M2M and L2L run serially; P2M and L2P are
+    // spread over the pool by leaf, M2L and P2P by round.
+    void computeAccelerations(const BodyStore& bodies, float G, float* ax, float* ay, float* az, ThreadPool& pool) {
+        const size_t count = bodies.size();
+        std::fill(ax, ax + count, 0.0f);
+        std::fill(ay, ay + count, 0.0f);
+        std::fill(az, az + count, 0.0f);
+
+        {
+            PROFILE_SCOPE("octree build");
+            tree.build(bodies);
+        }
+        if (tree.empty()) return;
+
+        const std::vector<OctreeNode>& nodes = tree.getNodes();
+        multipoles.assign(nodes.size() * termCount, 0.0);
+        locals.assign(nodes.size() * termCount, 0.0);
+        const size_t treeCount = tree.getOrder().size();
+        nearX.assign(treeCount, 0.0f);
+        nearY.assign(treeCount, 0.0f);
+        nearZ.assign(treeCount, 0.0f);
+
+        leaves.clear();
+        for (uint32_t n = 0; n < nodes.size(); ++n) {
+            if (nodes[n].childCount == 0) leaves.push_back(n);
+        }
+
+        {
+            PROFILE_SCOPE("P2M");
+            pool.parallelFor(leaves.size(), 16, [&](size_t begin, size_t end) {
+                for (size_t l = begin; l < end; ++l) {
+                    particleToMultipole(bodies, leaves[l]);
+                }
+            });
+        }
+        {
+            PROFILE_SCOPE("M2M");
+            upwardPass();
+        }
+
+        {
+            PROFILE_SCOPE("dual tree traversal");
+            farList.clear();
+            nearList.clear();
+            traverse(0, 0);
+            scheduleRounds(farList, farRounds);
+            scheduleRounds(nearList, nearRounds);
+        }
+
+        {
+            PROFILE_SCOPE("M2L");
+            for (size_t r = 0; r + 1 < farRounds.size(); ++r) {
+                const Interaction* pairs = farList.data() + farRounds[r];
+                pool.parallelFor(farRounds[r + 1] - farRounds[r], FAR_GRAIN, [&](size_t begin, size_t end) {
+                    for (size_t k = begin; k < end; k += M2L_BATCH) {
+                        multipoleToLocal(pairs + k, std::min(M2L_BATCH, end - k));
+                    }
+                });
+            }
+        }
+        {
+            PROFILE_SCOPE("P2P");
+            pool.parallelFor(leaves.size(), NEAR_GRAIN, [&](size_t begin, size_t end) {
+                for (size_t l = begin; l < end; ++l) {
+                    particleToParticle(leaves[l]);
+                }
+            });
+            for (size_t r = 0; r + 1 < nearRounds.size(); ++r) {
+                const Interaction* pairs = nearList.data() + nearRounds[r];
+                pool.parallelFor(nearRounds[r + 1] - nearRounds[r], NEAR_GRAIN, [&](size_t begin, size_t end) {
+                    for (size_t k = begin; k < end; ++k) {
+                        particleToParticle(pairs[k]);
+                    }
+                });
+            }
+        }
+
+        {
+            PROFILE_SCOPE("L2L");
+            downwardPass();
+        }
+        PROFILE_SCOPE("L2P");
+        pool.parallelFor(leaves.size(), 16, [&](size_t begin, size_t end) {
+            for (size_t l = begin; l < end; ++l) {
+                localToParticle(bodies, leaves[l], G, ax, ay, az);
+            }
+        });
+    }
+
+private:
+    void buildTermTables() {
+        int side = order + 1;
+        termIndex.assign(side * side * side, -1);
+        termI.clear();
+        termJ.clear();
+        termK.clear();
+        for (int degree = 0; degree <= order; ++degree) {
+            for (int i = degree; i >= 0; --i) {
+                for (int j = degree - i; j >= 0; --j) {
+                    int k = degree - i - j;
+                    termIndex[(i * side + j) * side + k] = static_cast<int>(termI.size());
+                    termI.push_back(i);
+                    termJ.push_back(j);
+                    termK.push_back(k);
+                }
+            }
+        }
+        termCount = static_cast<int>(termI.size());
+        factorials.resize(termCount);
+        inverseFactorials.resize(termCount);
+        signedInverseFactorials.resize(termCount);
+        for (int t = 0; t < termCount; ++t) {
+            double factorial = 1.0;
+            for (int n : {termI[t], termJ[t], termK[t]}) {
+                for (int f = 2; f <= n; ++f) factorial *= f;
+            }
+            factorials[t] = factorial;
+            inverseFactorials[t] = 1.0 / factorial;
+            signedInverseFactorials[t] = ((termI[t] + termJ[t] + termK[t]) & 1) ? -1.0 / factorial : 1.0 / factorial;
+        }
+
+        binomials.assign((MAX_ORDER + 1) * (MAX_ORDER + 1), 0.0);
+        for (int n = 0; n <= MAX_ORDER; ++n) {
+            binomials[n * (MAX_ORDER + 1)] = 1.0;
+            for (int k = 1; k <= n; ++k) {
+                binomials[n * (MAX_ORDER + 1) + k] = binomials[(n - 1) * (MAX_ORDER + 1) + k - 1]
+                    + (k <= n - 1 ? binomials[(n - 1) * (MAX_ORDER + 1) + k] : 0.0);
+            }
+        }
+
+        recurrences.assign(termCount, Recurrence());
+        for (int t = 0; t < termCount; ++t) {
+            const int m[3] = {termI[t], termJ[t], termK[t]};
+            const int degree = m[0] + m[1] + m[2];
+            Recurrence& rec = recurrences[t];
+            for (int d = 0; d < 3; ++d) {
+                int lower[3] = {m[0], m[1], m[2]};
+                lower[d] -= 1;
+                rec.lower1[d] = term(lower[0], lower[1], lower[2]);
+                lower[d] -= 1;
+                rec.lower2[d] = term(lower[0], lower[1], lower[2]);
+            }
+            rec.firstScale = degree > 0 ? (2.0 * degree - 1.0) / degree : 0.0;
+            rec.secondScale = degree > 0 ? (degree - 1.0) / degree : 0.0;
+        }
+
+        m2m = Operator();
+        m2lTerms.clear();
+        m2lOffsets.clear();
+        l2l = Operator();
+        for (int out = 0; out < termCount; ++out) {
+            m2m.offsets.push_back(static_cast<uint32_t>(m2m.products.size()));
+            m2lOffsets.push_back(static_cast<uint32_t>(m2lTerms.size()));
+            l2l.offsets.push_back(static_cast<uint32_t>(l2l.products.size()));
+            const int oi = termI[out], oj = termJ[out], ok = termK[out];
+
+            for (int in = 0; in < termCount; ++in) {
+                const int ii = termI[in], ij = termJ[in], ik = termK[in];
+
+                // Center shifts between parent and child: M2M gathers lower
+                // moments, L2L gathers higher coefficients
+                if (ii <= oi && ij <= oj && ik <= ok) {
+                    uint16_t shift = static_cast<uint16_t>(term(oi - ii, oj - ij, ok - ik));
+                    double c = binomial(oi, ii) * binomial(oj, ij) * binomial(ok, ik);
+                    m2m.products.push_back({uint16_t(in), shift, c});
+                }
+                if (oi <= ii && oj <= ij && ok <= ik) {
+                    uint16_t shift = static_cast<uint16_t>(term(ii - oi, ij - oj, ik - ok));
+                    double c = binomial(ii, oi) * binomial(ij, oj) * binomial(ik, ok);
+                    l2l.products.push_back({uint16_t(in), shift, c});
+                }
+
+                const int sum = term(oi + ii, oj + ij, ok + ik);
+                if (sum >= 0) m2lTerms.push_back(static_cast<uint16_t>(sum));
+            }
+        }
+        m2m.offsets.push_back(static_cast<uint32_t>(m2m.products.size()));
+        m2lOffsets.push_back(static_cast<uint32_t>(m2lTerms.size()));
+        l2l.offsets.push_back(static_cast<uint32_t>(l2l.products.size()));
+    }
+
+    // Monomials s^t for every term t
+    void monomials(double dx, double dy, double dz, double* S) const {
+        double px[MAX_ORDER + 1], py[MAX_ORDER + 1], pz[MAX_ORDER + 1];
+        powers(dx, dy, dz, px, py, pz);
+        for (int t = 0; t < termCount; ++t) {
+            S[t] = px[termI[t]] * py[termJ[t]] * pz[termK[t]];
+        }
+    }
+
+    int term(int i, int j, int k) const {
+        int side = order + 1;
+        if (i < 0 || j < 0 || k < 0 || i + j + k > order) return -1;
+        return termIndex[(i * side + j) * side + k];
+    }
+
+    double binomial(int n, int k) const { return binomials[n * (MAX_ORDER + 1) + k]; }
+
+    void powers(double dx, double dy, double dz, double* px, double* py, double* pz) const {
+        px[0] = py[0] = pz[0] = 1.0;
+        for (int n = 1; n <= order; ++n) {
+            px[n] = px[n - 1] * dx;
+            py[n] = py[n - 1] * dy;
+            pz[n] = pz[n - 1] * dz;
+        }
+    }
+
+    void particleToMultipole(const BodyStore& bodies, uint32_t leaf) {
+        const OctreeNode& node = tree.getNodes()[leaf];
+        const std::vector<uint32_t>& bodyOrder = tree.getOrder();
+        const float* x = bodies.x();
+        const float* y = bodies.y();
+        const float* z = bodies.z();
+        const float* mass = bodies.mass();
+        double* M = &multipoles[leaf * termCount];
+        double S[TERM_CAPACITY];
+
+        for (uint32_t b = node.begin; b < node.end; ++b) {
+            uint32_t i = bodyOrder[b];
+            monomials(double(x[i]) - node.comX, double(y[i]) - node.comY, double(z[i]) - node.comZ, S);
+            for (int t = 0; t < termCount; ++t) {
+                M[t] += mass[i] * S[t];
+            }
+        }
+    }
+
+    // M2M towards the root. Children always follow their parent in the node
+    // array, so a reverse sweep visits children first.
+    void upwardPass() {
+        const std::vector<OctreeNode>& nodes = tree.getNodes();
+        double S[TERM_CAPACITY];
+
+        for (size_t n = nodes.size(); n-- > 0;) {
+            const OctreeNode& node = nodes[n];
+            if (node.childCount == 0) continue;
+
+            double* M = &multipoles[n * termCount];
+            for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; ++c) {
+                const OctreeNode& child = nodes[c];
+                const double* C = &multipoles[c * termCount];
+                monomials(double(child.comX) - node.comX, double(child.comY) - node.comY, double(child.comZ) - node.comZ, S);
+                m2m.apply(M, C, S);
+            }
+        }
+    }
+
+    // Greedy edge colouring in traversal order: each pair takes the first
+    // round neither of its cells is in yet, at most 2 * degree - 1 rounds.
+    // The list is then stably sorted by round.
+    void scheduleRounds(std::vector<Interaction>& list, std::vector<uint32_t>& rounds) {
+        const size_t nodeCount = tree.getNodes().size();
+        nodeDegrees.assign(nodeCount, 0);
+        uint32_t maxDegree = 0;
+        for (const Interaction& pair : list) {
+            maxDegree = std::max({maxDegree, ++nodeDegrees[pair.a], ++nodeDegrees[pair.b]});
+        }
+        const size_t words = 2 * size_t(maxDegree) / 64 + 1;
+        busyRounds.assign(nodeCount * words, 0);
+        pairRounds.resize(list.size());
+
+        uint32_t roundCount = 0;
+        for (size_t p = 0; p < list.size(); ++p) {
+            uint64_t* busyA = &busyRounds[list[p].a * words];
+            uint64_t* busyB = &busyRounds[list[p].b * words];
+            size_t w = 0;
+            while (~(busyA[w] | busyB[w]) == 0) ++w;
+            const uint64_t free = ~(busyA[w] | busyB[w]);
+            uint32_t bit = 0;
+            while (!((free >> bit) & 1)) ++bit;
+            busyA[w] |= uint64_t(1) << bit;
+            busyB[w] |= uint64_t(1) << bit;
+            pairRounds[p] = static_cast<uint32_t>(w * 64 + bit);
+            roundCount = std::max(roundCount, pairRounds[p] + 1);
+        }
+
+        rounds.assign(roundCount + 1, 0);
+        for (uint32_t r : pairRounds) {
+            ++rounds[r + 1];
+        }
+        for (uint32_t r = 0; r < roundCount; ++r) {
+            rounds[r + 1] += rounds[r];
+        }
+        std::vector<uint32_t> cursor(rounds.begin(), rounds.end() - 1);
+        scheduled.resize(list.size());
+        for (size_t p = 0; p < list.size(); ++p) {
+            scheduled[cursor[pairRounds[p]]++] = list[p];
+        }
+        list.swap(scheduled);
+    }
+
+    bool wellSeparated(const OctreeNode& a, const OctreeNode& b) const {
+        float dx = a.comX - b.comX, dy = a.comY - b.comY, dz = a.comZ - b.comZ;
+        float reach = a.radius + b.radius;
+        return reach * reach < theta * theta * (dx * dx + dy * dy + dz * dz);
+    }
+
+    void traverse(uint32_t a, uint32_t b) {
+        const std::vector<OctreeNode>& nodes = tree.getNodes();
+        const OctreeNode& nodeA = nodes[a];
+        const OctreeNode& nodeB = nodes[b];
+
+        // A leaf with itself is summed by particleToParticle(leaf)
+        if (a == b) {
+            for (uint32_t ca = nodeA.firstChild; ca < nodeA.firstChild + nodeA.childCount; ++ca) {
+                for (uint32_t cb = ca; cb < nodeA.firstChild + nodeA.childCount; ++cb) {
+                    traverse(ca, cb);
+                }
+            }
+            return;
+        }
+
+        if (wellSeparated(nodeA, nodeB)) {
+            farList.push_back({a, b});
+            return;
+        }
+
+        bool leafA = nodeA.childCount == 0;
+        bool leafB = nodeB.childCount == 0;
+        if (leafA && leafB) {
+            nearList.push_back({a, b});
+        } else if (leafB || (!leafA && nodeA.radius >= nodeB.radius)) {
+            for (uint32_t ca = nodeA.firstChild; ca < nodeA.firstChild + nodeA.childCount; ++ca) {
+                traverse(ca, b);
+            }
+        } else {
+            for (uint32_t cb = nodeB.firstChild; cb < nodeB.firstChild + nodeB.childCount; ++cb) {
+                traverse(a, cb);
+            }
+        }
+    }
+
+    void multipoleToLocal(const Interaction* pairs, size_t count) {
+#ifdef GRAVITY_KERNEL_X86
+        if (kernel.getInstructionSet() != GravityKernel::InstructionSet::Scalar) {
+            multipoleToLocalAVX2(pairs, count);
+            return;
+        }
+#endif
+        multipoleToLocalBatch(pairs, count);
+    }
+
+#ifdef GRAVITY_KERNEL_X86
+    // The same loops compiled for 256-bit vectors with FMA
+    __attribute__((target("avx2,fma")))
+    void multipoleToLocalAVX2(const Interaction* pairs, size_t count) { multipoleToLocalBatch(pairs, count); }
+#endif
+
+    // Both directions of up to M2L_BATCH pairs of one round. The pairs run
+    // in the innermost loops, so the recurrence and operator tables are read
+    // once per batch and the pairs' arithmetic overlaps; unused lanes are
+    // padded with an empty pair.
+    __attribute__((always_inline))
+    inline void multipoleToLocalBatch(const Interaction* pairs, size_t count) {
+        constexpr size_t B = M2L_BATCH;
+        const std::vector<OctreeNode>& nodes = tree.getNodes();
+        double R[3][B], invR2[B];
+        double D[TERM_CAPACITY][B], Ma[TERM_CAPACITY][B], Mb[TERM_CAPACITY][B];
+
+        for (size_t l = 0; l < B; ++l) {
+            if (l < count) {
+                const OctreeNode& a = nodes[pairs[l].a];
+                const OctreeNode& b = nodes[pairs[l].b];
+                R[0][l] = double(a.comX) - b.comX;
+                R[1][l] = double(a.comY) - b.comY;
+                R[2][l] = double(a.comZ) - b.comZ;
+                const double* multipoleA = &multipoles[pairs[l].a * termCount];
+                const double* multipoleB = &multipoles[pairs[l].b * termCount];
+                for (int t = 0; t < termCount; ++t) {
+                    Ma[t][l] = multipoleA[t] * inverseFactorials[t];
+                    Mb[t][l] = multipoleB[t] * signedInverseFactorials[t];
+                }
+            } else {
+                R[0][l] = 1.0;
+                R[1][l] = R[2][l] = 0.0;
+                for (int t = 0; t < termCount; ++t) {
+                    Ma[t][l] = Mb[t][l] = 0.0;
+                }
+            }
+        }
+
+        // T_m = D^m(1/r) / m! by the recurrence, r^2 = |R|^2 + eps^2
+        for (size_t l = 0; l < B; ++l) {
+            invR2[l] = 1.0 / (R[0][l] * R[0][l] + R[1][l] * R[1][l] + R[2][l] * R[2][l] + softeningSq);
+            D[0][l] = std::sqrt(invR2[l]);
+        }
+        for (int t = 1; t < termCount; ++t) {
+            const Recurrence& rec = recurrences[t];
+            double first[B] = {}, second[B] = {};
+            for (int d = 0; d < 3; ++d) {
+                if (rec.lower1[d] >= 0) {
+                    for (size_t l = 0; l < B; ++l) first[l] += R[d][l] * D[rec.lower1[d]][l];
+                }
+                if (rec.lower2[d] >= 0) {
+                    for (size_t l = 0; l < B; ++l) second[l] += D[rec.lower2[d]][l];
+                }
+            }
+            for (size_t l = 0; l < B; ++l) {
+                D[t][l] = -(rec.firstScale * first[l] + rec.secondScale * second[l]) * invR2[l];
+            }
+        }
+        for (int t = 1; t < termCount; ++t) {
+            for (size_t l = 0; l < B; ++l) D[t][l] *= factorials[t];
+        }
+
+        // Row k of the table lists k + n as well, so k can be the outer
+        // loop and no sum waits on the previous product. b sees -R, which
+        // flips D_(n+k) for odd |n| + |k|.
+        double toA[TERM_CAPACITY][B], toB[TERM_CAPACITY][B];
+        for (int n = 0; n < termCount; ++n) {
+            for (size_t l = 0; l < B; ++l) toA[n][l] = toB[n][l] = 0.0;
+        }
+        for (int k = 0; k < termCount; ++k) {
+            for (uint32_t p = m2lOffsets[k], n = 0; p < m2lOffsets[k + 1]; ++p, ++n) {
+                const double* Dnk = D[m2lTerms[p]];
+                for (size_t l = 0; l < B; ++l) {
+                    toA[n][l] += Dnk[l] * Mb[k][l];
+                    toB[n][l] += Dnk[l] * Ma[k][l];
+                }
+            }
+        }
+        for (size_t l = 0; l < count; ++l) {
+            double* La = &locals[pairs[l].a * termCount];
+            double* Lb = &locals[pairs[l].b * termCount];
+            for (int n = 0; n < termCount; ++n) {
+                La[n] += toA[n][l] * inverseFactorials[n];
+                Lb[n] += toB[n][l] * signedInverseFactorials[n];
+            }
+        }
+    }
+
+    // A leaf's bodies with each other
+    void particleToParticle(uint32_t leaf) {
+        const OctreeNode& node = tree.getNodes()[leaf];
+        const uint32_t k = node.begin;
+        kernel.accumulate(tree.x() + k, tree.y() + k, tree.z() + k, node.end - k, tree.x() + k, tree.y() + k,
+                          tree.z() + k, tree.mass() + k, node.end - k, &nearX[k], &nearY[k], &nearZ[k]);
+    }
+
+    void particleToParticle(const Interaction& pair) {
+        const std::vector<OctreeNode>& nodes = tree.getNodes();
+        const OctreeNode& a = nodes[pair.a];
+        const OctreeNode& b = nodes[pair.b];
+        const float* x = tree.x();
+        const float* y = tree.y();
+        const float* z = tree.z();
+        const float* mass = tree.mass();
+        kernel.accumulateMutual(x + a.begin, y + a.begin, z + a.begin, mass + a.begin, a.end - a.begin, x + b.begin,
+                                y + b.begin, z + b.begin, mass + b.begin, b.end - b.begin, &nearX[a.begin],
+                                &nearY[a.begin], &nearZ[a.begin], &nearX[b.begin], &nearY[b.begin], &nearZ[b.begin]);
+    }
+
+    // L2L towards the leaves, parents before children
+    void downwardPass() {
+        const std::vector<OctreeNode>& nodes = tree.getNodes();
+        double S[TERM_CAPACITY];
+
+        for (size_t n = 0; n < nodes.size(); ++n) {
+            const OctreeNode& node = nodes[n];
+            const double* L = &locals[n * termCount];
+
+            for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; ++c) {
+                const OctreeNode& child = nodes[c];
+                double* C = &locals[c * termCount];
+                monomials(double(child.comX) - node.comX, double(child.comY) - node.comY, double(child.comZ) - node.comZ, S);
+                l2l.apply(C, L, S);
+            }
+        }
+    }
+
+    // L2P: the acceleration is G * grad(psi) plus the near field
+    void localToParticle(const BodyStore& bodies, uint32_t leaf, float G, float* ax, float* ay, float* az) const {
+        const OctreeNode& node = tree.getNodes()[leaf];
+        const std::vector<uint32_t>& bodyOrder = tree.getOrder();
+        const float* x = bodies.x();
+        const float* y = bodies.y();
+        const float* z = bodies.z();
+        const double* L = &locals[leaf * termCount];
+        double px[MAX_ORDER + 1], py[MAX_ORDER + 1], pz[MAX_ORDER + 1];
+
+        for (uint32_t b = node.begin; b < node.end; ++b) {
+            uint32_t i = bodyOrder[b];
+            powers(double(x[i]) - node.comX, double(y[i]) - node.comY, double(z[i]) - node.comZ, px, py, pz);
+
+            double gx = 0.0, gy = 0.0, gz = 0.0;
+            for (int t = 1; t < termCount; ++t) {
+                const int ti = termI[t], tj = termJ[t], tk = termK[t];
+                if (ti > 0) gx += ti * L[t] * px[ti - 1] * py[tj] * pz[tk];
+                if (tj > 0) gy += tj * L[t] * px[ti] * py[tj - 1] * pz[tk];
+                if (tk > 0) gz += tk * L[t] * px[ti] * py[tj] * pz[tk - 1];
+            }
+
+            ax[i] = static_cast<float>(G * (gx + nearX[b]));
+            ay[i] = static_cast<float>(G * (gy + nearY[b]));
+            az[i] = static_cast<float>(G * (gz + nearZ[b]));
+        }
+    }
+};
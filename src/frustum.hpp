@@ -0,0 +1,35 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cmath>
+
+// View frustum as six inward-facing planes taken from the rows of a
+// projection * view matrix (Gribb and Hartmann). Planes are normalized so
+// a sphere test is a signed distance against its radius.
+class Frustum {
+private:
+    glm::vec4 planes[6]; // normal in xyz, offset in w
+
+public:
+    explicit Frustum(const glm::mat4& clip = glm::mat4(1.0f)) {
+        for (int axis = 0; axis < 3; ++axis) {
+            for (int side = 0; side < 2; ++side) {
+                float sign = side == 0 ? 1.0f : -1.0f;
+                glm::vec4& plane = planes[2 * axis + side];
+                for (int column = 0; column < 4; ++column) {
+                    plane[column] = clip[column][3] + sign * clip[column][axis];
+                }
+                float length = std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+                if (length > 0.0f) plane /= length;
+            }
+        }
+    }
+
+    // False only when the sphere lies entirely outside one plane
+    bool intersectsSphere(const glm::vec3& center, float radius) const {
+        for (const glm::vec4& plane : planes) {
+            if (plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w < -radius) return false;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,613 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GRAVITY_KERNEL_X86 1
+#endif
+
+#include "threadpool.hpp"
+
+// Instruction sets the direct-sum kernel can run on, shared by every precision
+class GravityKernelBase {
+public:
+    enum class InstructionSet {
+        Scalar,
+        AVX2,
+        AVX512
+    };
+
+    static InstructionSet detectInstructionSet() {
+#if defined(GRAVITY_KERNEL_X86) && (defined(__GNUC__) || defined(__clang__))
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return InstructionSet::AVX512;
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return InstructionSet::AVX2;
+#endif
+        return InstructionSet::Scalar;
+    }
+
+    static const char* instructionSetName(InstructionSet set) {
+        switch (set) {
+            case InstructionSet::AVX512: return "AVX-512";
+            case InstructionSet::AVX2: return "AVX2";
+            case InstructionSet::Scalar:
+            default: return "scalar";
+        }
+    }
+};
+
+// Direct-sum gravity that evaluates every unordered pair once and applies
+// equal and opposite accelerations. Bodies are packed into padded blocks of
+// BLOCK_SIZE and block pairs are scheduled as a round-robin tournament:
+// within a round no two tiles share a block, so tiles run in parallel
+// without atomics, and every body accumulates its tiles in round order no
+// matter how many threads there are. The tree solvers use the one-way
+// accumulate() and the two-set accumulateMutual() for their near-field sums.
+//
+// In single precision the inner loop is picked at runtime from AVX-512,
+// AVX2 + FMA or plain scalar code; the vector paths use rsqrt with one
+// Newton step. Double precision always runs the scalar loop with an exact
+// square root.
+template <typename Real>
+class BasicGravityKernel : public GravityKernelBase {
+public:
+    static constexpr size_t BLOCK_SIZE = 128;
+
+private:
+    static constexpr bool VECTORIZED = std::is_same<Real, float>::value;
+
+    // Padded copies of the inputs; padding bodies have zero mass
+    std::vector<Real> px, py, pz, pm;
+    std::vector<Real> accX, accY, accZ;
+    std::vector<uint32_t> schedule; // block pairs of every round, flattened
+    std::vector<size_t> roundStart;
+    size_t scheduledBlocks;
+    Real softeningSq;
+    InstructionSet instructionSet;
+
+public:
+    BasicGravityKernel() : scheduledBlocks(0), softeningSq(0), instructionSet(supportedInstructionSet()) {}
+
+    // Plummer softening: |d|^2 is replaced by |d|^2 + eps^2
+    void setSoftening(Real epsilon) { softeningSq = epsilon * epsilon; }
+    Real getSoftening() const { return std::sqrt(softeningSq); }
+
+    // Falls back to the best supported set if the CPU, or the precision, lacks the requested one
+    void setInstructionSet(InstructionSet set) { instructionSet = std::min(set, supportedInstructionSet()); }
+    InstructionSet getInstructionSet() const { return instructionSet; }
+
+    static InstructionSet supportedInstructionSet() {
+        return VECTORIZED ? detectInstructionSet() : InstructionSet::Scalar;
+    }
+
+    // gm holds G * mass per body; bodies with gm = 0 still receive forces.
+    // Pairs at zero distance are skipped.
+    void computeAccelerations(const Real* x, const Real* y, const Real* z, const Real* gm, size_t count,
+                              Real* ax, Real* ay, Real* az, ThreadPool& pool) {
+        if (count == 0) return;
+
+        const size_t blocks = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        const size_t padded = blocks * BLOCK_SIZE;
+        pack(px, x, count, padded);
+        pack(py, y, count, padded);
+        pack(pz, z, count, padded);
+        pack(pm, gm, count, padded);
+        accX.assign(padded, Real(0));
+        accY.assign(padded, Real(0));
+        accZ.assign(padded, Real(0));
+        buildSchedule(blocks);
+
+        // Round 0 holds the diagonal tiles, the others hold block pairs
+        for (size_t r = 0; r + 1 < roundStart.size(); ++r) {
+            const size_t first = roundStart[r];
+            pool.parallelFor((roundStart[r + 1] - first) / 2, 1, [&](size_t begin, size_t end) {
+                for (size_t t = begin; t < end; ++t) {
+                    uint32_t a = schedule[first + 2 * t];
+                    uint32_t b = schedule[first + 2 * t + 1];
+                    computeTile(a * BLOCK_SIZE, b * BLOCK_SIZE, a == b);
+                }
+            });
+        }
+
+        std::copy(accX.begin(), accX.begin() + count, ax);
+        std::copy(accY.begin(), accY.begin() + count, ay);
+        std::copy(accZ.begin(), accZ.begin() + count, az);
+    }
+
+    // One-way sum for the tree solvers: adds sm[j] * d / (|d|^2 + eps^2)^1.5
+    // over every source j to each target's ax/ay/az. Pairs at zero distance
+    // are skipped, so the targets may be among the sources. Vectorized over
+    // the sources; safe to call from several threads at once.
+    void accumulate(const Real* tx, const Real* ty, const Real* tz, size_t targetCount, const Real* sx,
+                    const Real* sy, const Real* sz, const Real* sm, size_t sourceCount, Real* ax, Real* ay,
+                    Real* az) const {
+#ifdef GRAVITY_KERNEL_X86
+        if constexpr (VECTORIZED) {
+            switch (instructionSet) {
+                case InstructionSet::AVX512:
+                    accumulateAVX512(tx, ty, tz, targetCount, sx, sy, sz, sm, sourceCount, ax, ay, az);
+                    return;
+                case InstructionSet::AVX2:
+                    accumulateAVX2(tx, ty, tz, targetCount, sx, sy, sz, sm, sourceCount, ax, ay, az);
+                    return;
+                default:
+                    break;
+            }
+        }
+#endif
+        for (size_t i = 0; i < targetCount; ++i) {
+            Real sumX = 0, sumY = 0, sumZ = 0;
+            for (size_t j = 0; j < sourceCount; ++j) {
+                Real dx = sx[j] - tx[i];
+                Real dy = sy[j] - ty[i];
+                Real dz = sz[j] - tz[i];
+                Real distSq = dx * dx + dy * dy + dz * dz;
+                if (distSq <= 0) continue;
+                Real invDist = Real(1) / std::sqrt(distSq + softeningSq);
+                Real s = sm[j] * invDist * invDist * invDist;
+                sumX += dx * s;
+                sumY += dy * s;
+                sumZ += dz * s;
+            }
+            ax[i] += sumX;
+            ay[i] += sumY;
+            az[i] += sumZ;
+        }
+    }
+
+    // Mutual sum between two disjoint sets of bodies, each pair evaluated
+    // once: the pull of b on a goes to aAx/aAy/aAz, the pull of a on b to
+    // bAx/bAy/bAz. Vectorized over b.
+    void accumulateMutual(const Real* ax, const Real* ay, const Real* az, const Real* am, size_t aCount, const Real* bx,
+                          const Real* by, const Real* bz, const Real* bm, size_t bCount, Real* aAx, Real* aAy,
+                          Real* aAz, Real* bAx, Real* bAy, Real* bAz) const {
+#ifdef GRAVITY_KERNEL_X86
+        if constexpr (VECTORIZED) {
+            switch (instructionSet) {
+                case InstructionSet::AVX512:
+                    mutualAVX512(ax, ay, az, am, aCount, bx, by, bz, bm, bCount, aAx, aAy, aAz, bAx, bAy, bAz);
+                    return;
+                case InstructionSet::AVX2:
+                    mutualAVX2(ax, ay, az, am, aCount, bx, by, bz, bm, bCount, aAx, aAy, aAz, bAx, bAy, bAz);
+                    return;
+                default:
+                    break;
+            }
+        }
+#endif
+        for (size_t i = 0; i < aCount; ++i) {
+            Real sumX = 0, sumY = 0, sumZ = 0;
+            for (size_t j = 0; j < bCount; ++j) {
+                Real dx = bx[j] - ax[i];
+                Real dy = by[j] - ay[i];
+                Real dz = bz[j] - az[i];
+                Real distSq = dx * dx + dy * dy + dz * dz;
+                if (distSq <= 0) continue;
+                Real invDist = Real(1) / std::sqrt(distSq + softeningSq);
+                Real invDist3 = invDist * invDist * invDist;
+
+                Real sj = bm[j] * invDist3;
+                sumX += dx * sj;
+                sumY += dy * sj;
+                sumZ += dz * sj;
+
+                Real si = am[i] * invDist3;
+                bAx[j] -= dx * si;
+                bAy[j] -= dy * si;
+                bAz[j] -= dz * si;
+            }
+            aAx[i] += sumX;
+            aAy[i] += sumY;
+            aAz[i] += sumZ;
+        }
+    }
+
+private:
+    static void pack(std::vector<Real>& dst, const Real* src, size_t count, size_t padded) {
+        dst.resize(padded);
+        std::copy(src, src + count, dst.begin());
+        std::fill(dst.begin() + count, dst.end(), Real(0));
+    }
+
+    // Circle method: block 0 stays put while the others rotate, which pairs
+    // every two blocks exactly once over blocks - 1 rounds (one more block
+    // is added as a bye when the count is odd)
+    void buildSchedule(size_t blocks) {
+        if (blocks == scheduledBlocks) return;
+        scheduledBlocks = blocks;
+        schedule.clear();
+        roundStart.clear();
+
+        roundStart.push_back(0);
+        for (uint32_t b = 0; b < blocks; ++b) {
+            schedule.push_back(b);
+            schedule.push_back(b);
+        }
+        roundStart.push_back(schedule.size());
+
+        const size_t players = blocks + (blocks & 1);
+        for (size_t r = 0; r + 1 < players; ++r) {
+            for (size_t k = 0; k < players / 2; ++k) {
+                size_t a = k == 0 ? 0 : 1 + (k - 1 + r) % (players - 1);
+                size_t b = 1 + (players - 2 - k + r) % (players - 1);
+                if (a >= blocks || b >= blocks) continue;
+                schedule.push_back(static_cast<uint32_t>(a));
+                schedule.push_back(static_cast<uint32_t>(b));
+            }
+            roundStart.push_back(schedule.size());
+        }
+    }
+
+    void computeTile(size_t a, size_t b, bool diagonal) {
+#ifdef GRAVITY_KERNEL_X86
+        if constexpr (VECTORIZED) {
+            switch (instructionSet) {
+                case InstructionSet::AVX512:
+                    tileAVX512(a, b, diagonal);
+                    return;
+                case InstructionSet::AVX2:
+                    tileAVX2(a, b, diagonal);
+                    return;
+                default:
+                    break;
+            }
+        }
+#endif
+        tileScalar(a, b, diagonal);
+    }
+
+    // On a diagonal tile only pairs with j > i are visited
+    void tileScalar(size_t a, size_t b, bool diagonal) {
+        for (size_t i = a; i < a + BLOCK_SIZE; ++i) {
+            const Real xi = px[i], yi = py[i], zi = pz[i], mi = pm[i];
+            Real sumX = 0, sumY = 0, sumZ = 0;
+
+            for (size_t j = diagonal ? i + 1 : b; j < b + BLOCK_SIZE; ++j) {
+                Real dx = px[j] - xi;
+                Real dy = py[j] - yi;
+                Real dz = pz[j] - zi;
+                Real distSq = dx * dx + dy * dy + dz * dz;
+                if (distSq <= 0) continue;
+                Real invDist = Real(1) / std::sqrt(distSq + softeningSq);
+                Real invDist3 = invDist * invDist * invDist;
+
+                Real sj = pm[j] * invDist3;
+                sumX += dx * sj;
+                sumY += dy * sj;
+                sumZ += dz * sj;
+
+                Real si = mi * invDist3;
+                accX[j] -= dx * si;
+                accY[j] -= dy * si;
+                accZ[j] -= dz * si;
+            }
+
+            accX[i] += sumX;
+            accY[i] += sumY;
+            accZ[i] += sumZ;
+        }
+    }
+
+#ifdef GRAVITY_KERNEL_X86
+    __attribute__((target("avx2,fma")))
+    static float horizontalSum(__m256 v) {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+        return _mm_cvtss_f32(s);
+    }
+
+    __attribute__((target("avx512f")))
+    static float horizontalSum(__m512 v) {
+        // Halving in registers, lane k gaining lane k + 8, k + 4, k + 2 and
+        // k + 1 like a scalar tree would
+        v = _mm512_add_ps(v, _mm512_mask_shuffle_f32x4(v, 0xFFFF, v, v, 0xEE));
+        v = _mm512_add_ps(v, _mm512_mask_shuffle_f32x4(v, 0xFFFF, v, v, 0x55));
+        v = _mm512_add_ps(v, _mm512_mask_permute_ps(v, 0xFFFF, v, 0xEE));
+        v = _mm512_add_ps(v, _mm512_mask_permute_ps(v, 0xFFFF, v, 0x55));
+        return _mm512_cvtss_f32(v);
+    }
+
+    __attribute__((target("avx2,fma")))
+    void tileAVX2(size_t a, size_t b, bool diagonal) {
+        const __m256 eps2 = _mm256_set1_ps(softeningSq);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 threeHalves = _mm256_set1_ps(1.5f);
+        const __m256 lanes = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+
+        for (size_t i = a; i < a + BLOCK_SIZE; ++i) {
+            const __m256 xi = _mm256_set1_ps(px[i]);
+            const __m256 yi = _mm256_set1_ps(py[i]);
+            const __m256 zi = _mm256_set1_ps(pz[i]);
+            const __m256 mi = _mm256_set1_ps(pm[i]);
+            const __m256 iIndex = _mm256_set1_ps(float(i - a));
+            __m256 sumX = zero, sumY = zero, sumZ = zero;
+
+            size_t j = diagonal ? a + ((i + 1 - a) & ~size_t(7)) : b;
+            for (; j < b + BLOCK_SIZE; j += 8) {
+                __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(&px[j]), xi);
+                __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(&py[j]), yi);
+                __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(&pz[j]), zi);
+                __m256 distSq = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+
+                __m256 valid = _mm256_cmp_ps(distSq, zero, _CMP_GT_OQ);
+                if (diagonal) {
+                    __m256 jIndex = _mm256_add_ps(_mm256_set1_ps(float(j - a)), lanes);
+                    valid = _mm256_and_ps(valid, _mm256_cmp_ps(jIndex, iIndex, _CMP_GT_OQ));
+                }
+
+                __m256 r2 = _mm256_add_ps(distSq, eps2);
+                __m256 inv = _mm256_rsqrt_ps(r2);
+                inv = _mm256_mul_ps(inv, _mm256_fnmadd_ps(_mm256_mul_ps(half, r2), _mm256_mul_ps(inv, inv), threeHalves));
+                __m256 inv3 = _mm256_and_ps(_mm256_mul_ps(_mm256_mul_ps(inv, inv), inv), valid);
+
+                __m256 sj = _mm256_mul_ps(_mm256_loadu_ps(&pm[j]), inv3);
+                sumX = _mm256_fmadd_ps(dx, sj, sumX);
+                sumY = _mm256_fmadd_ps(dy, sj, sumY);
+                sumZ = _mm256_fmadd_ps(dz, sj, sumZ);
+
+                __m256 si = _mm256_mul_ps(mi, inv3);
+                _mm256_storeu_ps(&accX[j], _mm256_fnmadd_ps(dx, si, _mm256_loadu_ps(&accX[j])));
+                _mm256_storeu_ps(&accY[j], _mm256_fnmadd_ps(dy, si, _mm256_loadu_ps(&accY[j])));
+                _mm256_storeu_ps(&accZ[j], _mm256_fnmadd_ps(dz, si, _mm256_loadu_ps(&accZ[j])));
+            }
+
+            accX[i] += horizontalSum(sumX);
+            accY[i] += horizontalSum(sumY);
+            accZ[i] += horizontalSum(sumZ);
+        }
+    }
+
+    // The last partial group of sources is read through a lane mask
+    __attribute__((target("avx2,fma")))
+    void accumulateAVX2(const float* tx, const float* ty, const float* tz, size_t targetCount, const float* sx,
+                        const float* sy, const float* sz, const float* sm, size_t sourceCount, float* ax, float* ay,
+                        float* az) const {
+        const __m256 eps2 = _mm256_set1_ps(softeningSq);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 threeHalves = _mm256_set1_ps(1.5f);
+        const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        const size_t full = sourceCount & ~size_t(7);
+        const __m256i tail = _mm256_cmpgt_epi32(_mm256_set1_epi32(int(sourceCount - full)), lanes);
+
+        for (size_t i = 0; i < targetCount; ++i) {
+            const __m256 xi = _mm256_set1_ps(tx[i]);
+            const __m256 yi = _mm256_set1_ps(ty[i]);
+            const __m256 zi = _mm256_set1_ps(tz[i]);
+            __m256 sumX = zero, sumY = zero, sumZ = zero;
+
+            for (size_t j = 0; j < sourceCount; j += 8) {
+                __m256 dx, dy, dz, m;
+                if (j < full) {
+                    dx = _mm256_sub_ps(_mm256_loadu_ps(sx + j), xi);
+                    dy = _mm256_sub_ps(_mm256_loadu_ps(sy + j), yi);
+                    dz = _mm256_sub_ps(_mm256_loadu_ps(sz + j), zi);
+                    m = _mm256_loadu_ps(sm + j);
+                } else {
+                    dx = _mm256_sub_ps(_mm256_maskload_ps(sx + j, tail), xi);
+                    dy = _mm256_sub_ps(_mm256_maskload_ps(sy + j, tail), yi);
+                    dz = _mm256_sub_ps(_mm256_maskload_ps(sz + j, tail), zi);
+                    m = _mm256_maskload_ps(sm + j, tail);
+                }
+                __m256 distSq = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+                __m256 valid = _mm256_cmp_ps(distSq, zero, _CMP_GT_OQ);
+
+                __m256 r2 = _mm256_add_ps(distSq, eps2);
+                __m256 inv = _mm256_rsqrt_ps(r2);
+                inv = _mm256_mul_ps(inv, _mm256_fnmadd_ps(_mm256_mul_ps(half, r2), _mm256_mul_ps(inv, inv), threeHalves));
+                __m256 inv3 = _mm256_and_ps(_mm256_mul_ps(_mm256_mul_ps(inv, inv), inv), valid);
+
+                __m256 s = _mm256_mul_ps(m, inv3);
+                sumX = _mm256_fmadd_ps(dx, s, sumX);
+                sumY = _mm256_fmadd_ps(dy, s, sumY);
+                sumZ = _mm256_fmadd_ps(dz, s, sumZ);
+            }
+
+            ax[i] += horizontalSum(sumX);
+            ay[i] += horizontalSum(sumY);
+            az[i] += horizontalSum(sumZ);
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    void accumulateAVX512(const float* tx, const float* ty, const float* tz, size_t targetCount, const float* sx,
+                          const float* sy, const float* sz, const float* sm, size_t sourceCount, float* ax, float* ay,
+                          float* az) const {
+        const __m512 eps2 = _mm512_set1_ps(softeningSq);
+        const __m512 zero = _mm512_setzero_ps();
+        const __m512 half = _mm512_set1_ps(0.5f);
+        const __m512 threeHalves = _mm512_set1_ps(1.5f);
+        const size_t full = sourceCount & ~size_t(15);
+        const __mmask16 tail = static_cast<__mmask16>((1u << (sourceCount - full)) - 1);
+
+        for (size_t i = 0; i < targetCount; ++i) {
+            const __m512 xi = _mm512_set1_ps(tx[i]);
+            const __m512 yi = _mm512_set1_ps(ty[i]);
+            const __m512 zi = _mm512_set1_ps(tz[i]);
+            __m512 sumX = zero, sumY = zero, sumZ = zero;
+
+            for (size_t j = 0; j < sourceCount; j += 16) {
+                const __mmask16 lanes = j < full ? __mmask16(0xFFFF) : tail;
+                __m512 dx = _mm512_sub_ps(_mm512_maskz_loadu_ps(lanes, sx + j), xi);
+                __m512 dy = _mm512_sub_ps(_mm512_maskz_loadu_ps(lanes, sy + j), yi);
+                __m512 dz = _mm512_sub_ps(_mm512_maskz_loadu_ps(lanes, sz + j), zi);
+                __m512 m = _mm512_maskz_loadu_ps(lanes, sm + j);
+                __m512 distSq = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+                __mmask16 valid = _mm512_cmp_ps_mask(distSq, zero, _CMP_GT_OQ);
+
+                __m512 r2 = _mm512_add_ps(distSq, eps2);
+                __m512 inv = _mm512_maskz_rsqrt14_ps(0xFFFF, r2);
+                inv = _mm512_mul_ps(inv, _mm512_fnmadd_ps(_mm512_mul_ps(half, r2), _mm512_mul_ps(inv, inv), threeHalves));
+                __m512 inv3 = _mm512_maskz_mul_ps(valid, _mm512_mul_ps(inv, inv), inv);
+
+                __m512 s = _mm512_mul_ps(m, inv3);
+                sumX = _mm512_fmadd_ps(dx, s, sumX);
+                sumY = _mm512_fmadd_ps(dy, s, sumY);
+                sumZ = _mm512_fmadd_ps(dz, s, sumZ);
+            }
+
+            ax[i] += horizontalSum(sumX);
+            ay[i] += horizontalSum(sumY);
+            az[i] += horizontalSum(sumZ);
+        }
+    }
+
+    __attribute__((target("avx2,fma")))
+    void mutualAVX2(const float* ax, const float* ay, const float* az, const float* am, size_t aCount, const float* bx,
+                    const float* by, const float* bz, const float* bm, size_t bCount, float* aAx, float* aAy,
+                    float* aAz, float* bAx, float* bAy, float* bAz) const {
+        const __m256 eps2 = _mm256_set1_ps(softeningSq);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 threeHalves = _mm256_set1_ps(1.5f);
+        const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        const size_t full = bCount & ~size_t(7);
+        const __m256i tail = _mm256_cmpgt_epi32(_mm256_set1_epi32(int(bCount - full)), lanes);
+        const __m256i all = _mm256_set1_epi32(-1);
+
+        for (size_t i = 0; i < aCount; ++i) {
+            const __m256 xi = _mm256_set1_ps(ax[i]);
+            const __m256 yi = _mm256_set1_ps(ay[i]);
+            const __m256 zi = _mm256_set1_ps(az[i]);
+            const __m256 mi = _mm256_set1_ps(am[i]);
+            __m256 sumX = zero, sumY = zero, sumZ = zero;
+
+            for (size_t j = 0; j < bCount; j += 8) {
+                const __m256i mask = j < full ? all : tail;
+                __m256 dx = _mm256_sub_ps(_mm256_maskload_ps(bx + j, mask), xi);
+                __m256 dy = _mm256_sub_ps(_mm256_maskload_ps(by + j, mask), yi);
+                __m256 dz = _mm256_sub_ps(_mm256_maskload_ps(bz + j, mask), zi);
+                __m256 distSq = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+                __m256 valid = _mm256_cmp_ps(distSq, zero, _CMP_GT_OQ);
+
+                __m256 r2 = _mm256_add_ps(distSq, eps2);
+                __m256 inv = _mm256_rsqrt_ps(r2);
+                inv = _mm256_mul_ps(inv, _mm256_fnmadd_ps(_mm256_mul_ps(half, r2), _mm256_mul_ps(inv, inv), threeHalves));
+                __m256 inv3 = _mm256_and_ps(_mm256_mul_ps(_mm256_mul_ps(inv, inv), inv), valid);
+
+                __m256 sj = _mm256_mul_ps(_mm256_maskload_ps(bm + j, mask), inv3);
+                sumX = _mm256_fmadd_ps(dx, sj, sumX);
+                sumY = _mm256_fmadd_ps(dy, sj, sumY);
+                sumZ = _mm256_fmadd_ps(dz, sj, sumZ);
+
+                __m256 si = _mm256_mul_ps(mi, inv3);
+                _mm256_maskstore_ps(bAx + j, mask, _mm256_fnmadd_ps(dx, si, _mm256_maskload_ps(bAx + j, mask)));
+                _mm256_maskstore_ps(bAy + j, mask, _mm256_fnmadd_ps(dy, si, _mm256_maskload_ps(bAy + j, mask)));
+                _mm256_maskstore_ps(bAz + j, mask, _mm256_fnmadd_ps(dz, si, _mm256_maskload_ps(bAz + j, mask)));
+            }
+
+            aAx[i] += horizontalSum(sumX);
+            aAy[i] += horizontalSum(sumY);
+            aAz[i] += horizontalSum(sumZ);
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    void mutualAVX512(const float* ax, const float* ay, const float* az, const float* am, size_t aCount,
+                      const float* bx, const float* by, const float* bz, const float* bm, size_t bCount, float* aAx,
+                      float* aAy, float* aAz, float* bAx, float* bAy, float* bAz) const {
+        const __m512 eps2 = _mm512_set1_ps(softeningSq);
+        const __m512 zero = _mm512_setzero_ps();
+        const __m512 half = _mm512_set1_ps(0.5f);
+        const __m512 threeHalves = _mm512_set1_ps(1.5f);
+        const size_t full = bCount & ~size_t(15);
+        const __mmask16 tail = static_cast<__mmask16>((1u << (bCount - full)) - 1);
+
+        for (size_t i = 0; i < aCount; ++i) {
+            const __m512 xi = _mm512_set1_ps(ax[i]);
+            const __m512 yi = _mm512_set1_ps(ay[i]);
+            const __m512 zi = _mm512_set1_ps(az[i]);
+            const __m512 mi = _mm512_set1_ps(am[i]);
+            __m512 sumX = zero, sumY = zero, sumZ = zero;
+
+            for (size_t j = 0; j < bCount; j += 16) {
+                const __mmask16 lanes = j < full ? __mmask16(0xFFFF) : tail;
+                __m512 dx = _mm512_sub_ps(_mm512_maskz_loadu_ps(lanes, bx + j), xi);
+                __m512 dy = _mm512_sub_ps(_mm512_maskz_loadu_ps(lanes, by + j), yi);
+                __m512 dz = _mm512_sub_ps(_mm512_maskz_loadu_ps(lanes, bz + j), zi);
+                __m512 distSq = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+                __mmask16 valid = _mm512_cmp_ps_mask(distSq, zero, _CMP_GT_OQ);
+
+                __m512 r2 = _mm512_add_ps(distSq, eps2);
+                __m512 inv = _mm512_maskz_rsqrt14_ps(0xFFFF, r2);
+                inv = _mm512_mul_ps(inv, _mm512_fnmadd_ps(_mm512_mul_ps(half, r2), _mm512_mul_ps(inv, inv), threeHalves));
+                __m512 inv3 = _mm512_maskz_mul_ps(valid, _mm512_mul_ps(inv, inv), inv);
+
+                __m512 sj = _mm512_mul_ps(_mm512_maskz_loadu_ps(lanes, bm + j), inv3);
+                sumX = _mm512_fmadd_ps(dx, sj, sumX);
+                sumY = _mm512_fmadd_ps(dy, sj, sumY);
+                sumZ = _mm512_fmadd_ps(dz, sj, sumZ);
+
+                __m512 si = _mm512_mul_ps(mi, inv3);
+                _mm512_mask_storeu_ps(bAx + j, lanes, _mm512_fnmadd_ps(dx, si, _mm512_maskz_loadu_ps(lanes, bAx + j)));
+                _mm512_mask_storeu_ps(bAy + j, lanes, _mm512_fnmadd_ps(dy, si, _mm512_maskz_loadu_ps(lanes, bAy + j)));
+                _mm512_mask_storeu_ps(bAz + j, lanes, _mm512_fnmadd_ps(dz, si, _mm512_maskz_loadu_ps(lanes, bAz + j)));
+            }
+
+            aAx[i] += horizontalSum(sumX);
+            aAy[i] += horizontalSum(sumY);
+            aAz[i] += horizontalSum(sumZ);
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    void tileAVX512(size_t a, size_t b, bool diagonal) {
+        const __m512 eps2 = _mm512_set1_ps(softeningSq);
+        const __m512 zero = _mm512_setzero_ps();
+        const __m512 half = _mm512_set1_ps(0.5f);
+        const __m512 threeHalves = _mm512_set1_ps(1.5f);
+        const __m512 lanes = _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+        for (size_t i = a; i < a + BLOCK_SIZE; ++i) {
+            const __m512 xi = _mm512_set1_ps(px[i]);
+            const __m512 yi = _mm512_set1_ps(py[i]);
+            const __m512 zi = _mm512_set1_ps(pz[i]);
+            const __m512 mi = _mm512_set1_ps(pm[i]);
+            const __m512 iIndex = _mm512_set1_ps(float(i - a));
+            __m512 sumX = zero, sumY = zero, sumZ = zero;
+
+            size_t j = diagonal ? a + ((i + 1 - a) & ~size_t(15)) : b;
+            for (; j < b + BLOCK_SIZE; j += 16) {
+                __m512 dx = _mm512_sub_ps(_mm512_loadu_ps(&px[j]), xi);
+                __m512 dy = _mm512_sub_ps(_mm512_loadu_ps(&py[j]), yi);
+                __m512 dz = _mm512_sub_ps(_mm512_loadu_ps(&pz[j]), zi);
+                __m512 distSq = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+
+                __mmask16 valid = _mm512_cmp_ps_mask(distSq, zero, _CMP_GT_OQ);
+                if (diagonal) {
+                    __m512 jIndex = _mm512_add_ps(_mm512_set1_ps(float(j - a)), lanes);
+                    valid &= _mm512_cmp_ps_mask(jIndex, iIndex, _CMP_GT_OQ);
+                }
+
+                __m512 r2 = _mm512_add_ps(distSq, eps2);
+                __m512 inv = _mm512_maskz_rsqrt14_ps(0xFFFF, r2);
+                inv = _mm512_mul_ps(inv, _mm512_fnmadd_ps(_mm512_mul_ps(half, r2), _mm512_mul_ps(inv, inv), threeHalves));
+                __m512 inv3 = _mm512_maskz_mul_ps(valid, _mm512_mul_ps(inv, inv), inv);
+
+                __m512 sj = _mm512_mul_ps(_mm512_loadu_ps(&pm[j]), inv3);
+                sumX = _mm512_fmadd_ps(dx, sj, sumX);
+                sumY = _mm512_fmadd_ps(dy, sj, sumY);
+                sumZ = _mm512_fmadd_ps(dz, sj, sumZ);
+
+                __m512 si = _mm512_mul_ps(mi, inv3);
+                _mm512_storeu_ps(&accX[j], _mm512_fnmadd_ps(dx, si, _mm512_loadu_ps(&accX[j])));
+                _mm512_storeu_ps(&accY[j], _mm512_fnmadd_ps(dy, si, _mm512_loadu_ps(&accY[j])));
+                _mm512_storeu_ps(&accZ[j], _mm512_fnmadd_ps(dz, si, _mm512_loadu_ps(&accZ[j])));
+            }
+
+            accX[i] += horizontalSum(sumX);
+            accY[i] += horizontalSum(sumY);
+            accZ[i] += horizontalSum(sumZ);
+        }
+    }
+#endif
+};
+
+using GravityKernel = BasicGravityKernel<float>;
@@ -1,34 +1,99 @@
 #pragma once
 
 #include <GL/glew.h>
+#include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <cmath>
+#include <cstdint>
 #include <vector>
-#include <memory>
 
 #include "constants.hpp"
 #include "../interfaces/IDrawable.hpp"
-#include "object.hpp"
+#include "bodystore.hpp"
+#include "gridfield.hpp"
+#include "profiler.hpp"
+#include "quadgrid.hpp"
+#include "threadpool.hpp"
 #include "utils.hpp"
 
+// Line grid laid out by a QuadGrid and displaced through the GridField.
+// Cells are refined around massive bodies within the vertex count of a
+// uniform grid of the given divisions; when the layout changes the vertex
+// buffer is rewritten. Otherwise it holds each vertex's height as last
+// evaluated, and only vertices of regions the field rewrote are uploaded,
+// in contiguous runs. The grid is then lifted as a whole through the model
+// matrix so its top follows the bodies' centre of mass, as before.
+//
+// With GPU displacement the vertex heights are never uploaded: the bodies
+// go into a uniform block once per frame and the grid vertex shader sums
+// the displacement itself. Scenes with more bodies than the block holds
+// fall back to the CPU field.
+//
+// An update is split in two so it can run off the GL thread: prepare()
+// does all the CPU work and needs no context, upload() sends what it
+// produced to the buffers and latches the state draw() uses. prepare()
+// may overlap draw(), but not upload(). Frames whose bodies and settings
+// are unchanged, such as every frame while paused, prepare nothing.
 class Grid : public IDrawable {
+public:
+    static constexpr size_t MAX_GPU_BODIES = 1024; // length of the GridBodies block
+    static constexpr GLuint BODY_BLOCK_BINDING = 0;
+
 private:
     GLuint VAO, VBO;
+    GLuint bodyBuffer;
+    std::vector<float> bodyBlock; // x, y, z, rs per body
     std::vector<float> vertices;
-    float size;
-    int divisions;
     glm::vec4 color;
+    QuadGrid layout;
+    GridField field;
+    float verticalOffset;
+    float top; // highest vertex as drawn last frame
+    bool gpuDisplacement;
+    bool gpuActive;   // this frame is displaced on the GPU
+    bool cpuHeights;  // the vertices hold current CPU heights
+    bool stale;       // settings changed since the last prepare()
+
+    // Prepared but not yet uploaded
+    bool layoutPending;                 // every vertex
+    std::vector<uint32_t> pendingRuns;  // first vertex, count
+    bool bodiesPending;
+
+    // Latched by upload() for draw()
+    struct DrawState {
+        size_t vertexCount;
+        float verticalOffset;
+        int bodyCount;
+        bool gpuActive;
+    } drawn;
 
 public:
     Grid(float size = 20000.0f, int divisions = 25, const glm::vec4& color = glm::vec4(1.0f, 1.0f, 1.0f, 0.25f))
-        : size(size), divisions(divisions), color(color) {
+        : color(color),
+          layout(size, uniformVertexCount(divisions)),
+          field(size, planeHeight(size, divisions)),
+          verticalOffset(0.0f), top(planeHeight(size, divisions)),
+          gpuDisplacement(true), gpuActive(false), cpuHeights(false), stale(true),
+          layoutPending(false), bodiesPending(false), drawn{0, 0.0f, 0, false} {
         
-        vertices = createGridVertices();
-        Utils::createVBOVAO(VAO, VBO, vertices.data(), vertices.size());
+        // Sized for the layout's budget so layout changes never reallocate it
+        std::vector<float> capacity(3 * layout.getVertexBudget(), 0.0f);
+        Utils::createVBOVAO(VAO, VBO, capacity.data(), capacity.size(), GL_DYNAMIC_DRAW);
+
+        glGenBuffers(1, &bodyBuffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, bodyBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, MAX_GPU_BODIES * 4 * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, BODY_BLOCK_BINDING, bodyBuffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        applyLayout();
+        upload();
     }
 
     ~Grid() {
         glDeleteVertexArrays(1, &VAO);
         glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &bodyBuffer);
     }
 
     // IDrawable implementation
@@ -37,91 +102,166 @@ public:
         shader.setBool("isGrid", true);
         shader.setBool("GLOW", false);
         
-        glm::mat4 model = glm::mat4(1.0f);
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, drawn.verticalOffset, 0.0f));
         shader.setMat4("model", model);
+        if (drawn.gpuActive) {
+            shader.setInt("bodyCount", drawn.bodyCount);
+            shader.setFloat("planeY", field.getPlaneY());
+        }
         
         glBindVertexArray(VAO);
-        glDrawArrays(GL_LINES, 0, vertices.size() / 3);
+        glDrawArrays(GL_LINES, 0, static_cast<GLsizei>(drawn.vertexCount));
         glBindVertexArray(0);
     }
 
-    // Update grid vertices based on gravitational effects
-    void updateGrid(const std::vector<std::shared_ptr<Object>>& objects) {
-        // Calculate center of mass
-        float totalMass = 0.0f;
-        float comY = 0.0f;
-        
-        for (const auto& obj : objects) {
-            if (obj->isInitializing()) continue;
-            comY += obj->getMass() * obj->getPosition().y;
-            totalMass += obj->getMass();
+    // Heights change by at most this much before they are re-evaluated
+    void setTolerance(float units) {
+        field.setTolerance(units);
+        stale = true;
+    }
+    float getTolerance() const { return field.getTolerance(); }
+
+    // Cells are split while their lines miss the displacement by more
+    void setRefinementTolerance(float units) {
+        layout.setTolerance(units);
+        stale = true;
+    }
+    float getRefinementTolerance() const { return layout.getTolerance(); }
+
+    size_t getVertexCount() const { return vertices.size() / 3; }
+
+    // Displace in the grid vertex shader when the bodies fit its block
+    void setGpuDisplacement(bool enabled) {
+        gpuDisplacement = enabled;
+        stale = true;
+    }
+    bool getGpuDisplacement() const { return gpuDisplacement; }
+
+    // Whether the uploaded frame leaves the displacement to the grid shader
+    bool isGpuDisplaced() const { return drawn.gpuActive; }
+
+    // CPU half of an update; touches no GL state. bodiesChanged is false
+    // when the bodies are the ones the last call saw, and then only a
+    // settings change makes it do any work.
+    void prepare(const BodyStore& bodies, ThreadPool& pool, bool bodiesChanged = true) {
+        if (!bodiesChanged && !stale) return;
+        stale = false;
+        PROFILE_SCOPE("grid prepare");
+        field.setBodies(bodies);
+        bool refined;
+        {
+            PROFILE_SCOPE("grid refine");
+            refined = layout.refine(bodies, pool, field.getSourceX(), field.getSourceY(), field.getSourceZ(), field.getSourceRs(),
+                          field.getSourceCount(), field.getPlaneY());
         }
-        
-        if (totalMass > 0) comY /= totalMass;
-        
-        // Find original max Y
-        float originalMaxY = -std::numeric_limits<float>::infinity();
-        for (int i = 0; i < vertices.size(); i += 3) {
-            originalMaxY = std::max(originalMaxY, vertices[i+1]);
+        if (refined) {
+            applyLayout();
         }
-        
-        float verticalShift = comY - originalMaxY;
-        
-        // Update vertices based on gravitational effects
-        for (int i = 0; i < vertices.size(); i += 3) {
-            glm::vec3 vertexPos(vertices[i], vertices[i+1], vertices[i+2]);
-            glm::vec3 totalDisplacement(0.0f);
-            
-            for (const auto& obj : objects) {
-                glm::vec3 toObject = obj->getPosition() - vertexPos;
-                float distance = glm::length(toObject);
-                float distance_m = distance * 1000.0f;
-                float rs = (2 * Constants::G * obj->getMass()) / (Constants::C * Constants::C);
-                
-                float dz = 2 * sqrt(rs * (distance_m - rs));
-                totalDisplacement.y += dz * 2.0f;
+
+        float maxHeight;
+        gpuActive = gpuDisplacement && bodies.size() <= MAX_GPU_BODIES;
+        if (gpuActive) {
+            maxHeight = field.borderMaxHeight();
+            packBodies(bodies.size());
+            cpuHeights = false;
+        } else {
+            PROFILE_SCOPE("grid field");
+            if (!cpuHeights) field.invalidate();
+            if (field.update(bodies, pool)) {
+                collectUpdatedVertices();
             }
-            
-            vertices[i+1] = totalDisplacement.y + -abs(verticalShift);
+            maxHeight = field.getMaxHeight();
+            cpuHeights = true;
         }
-        
-        // Update VBO with new vertex data
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_DYNAMIC_DRAW);
+
+        verticalOffset = -std::abs(field.getCenterOfMassY() - top);
+        top = maxHeight + verticalOffset;
     }
 
-private:
-    std::vector<float> createGridVertices() const {
-        std::vector<float> gridVertices;
-        float step = size / divisions;
-        float halfSize = size / 2.0f;
-        
-        // X axis lines
-        for (int yStep = 3; yStep <= 3; ++yStep) {
-            float y = -halfSize * 0.3f + yStep * step;
-            for (int zStep = 0; zStep <= divisions; ++zStep) {
-                float z = -halfSize + zStep * step;
-                for (int xStep = 0; xStep < divisions; ++xStep) {
-                    float xStart = -halfSize + xStep * step;
-                    float xEnd = xStart + step;
-                    gridVertices.insert(gridVertices.end(), {xStart, y, z, xEnd, y, z});
-                }
+    // GL half: sends the last prepare() to the buffers
+    void upload() {
+        PROFILE_SCOPE("grid upload");
+        if (layoutPending) {
+            glBindBuffer(GL_ARRAY_BUFFER, VBO);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(float), vertices.data());
+        } else if (!pendingRuns.empty()) {
+            glBindBuffer(GL_ARRAY_BUFFER, VBO);
+            for (size_t r = 0; r < pendingRuns.size(); r += 2) {
+                const size_t first = pendingRuns[r], count = pendingRuns[r + 1];
+                glBufferSubData(GL_ARRAY_BUFFER, 3 * first * sizeof(float), 3 * count * sizeof(float),
+                                &vertices[3 * first]);
             }
         }
-        
-        // Z axis lines
-        for (int xStep = 0; xStep <= divisions; ++xStep) {
-            float x = -halfSize + xStep * step;
-            for (int yStep = 3; yStep <= 3; ++yStep) {
-                float y = -halfSize * 0.3f + yStep * step;
-                for (int zStep = 0; zStep < divisions; ++zStep) {
-                    float zStart = -halfSize + zStep * step;
-                    float zEnd = zStart + step;
-                    gridVertices.insert(gridVertices.end(), {x, y, zStart, x, y, zEnd});
-                }
+        if (bodiesPending && !bodyBlock.empty()) {
+            glBindBuffer(GL_UNIFORM_BUFFER, bodyBuffer);
+            glBufferSubData(GL_UNIFORM_BUFFER, 0, bodyBlock.size() * sizeof(float), bodyBlock.data());
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        }
+        layoutPending = false;
+        pendingRuns.clear();
+        bodiesPending = false;
+
+        drawn = {vertices.size() / 3, verticalOffset, static_cast<int>(bodyBlock.size() / 4), gpuActive};
+    }
+
+private:
+    static float planeHeight(float size, int divisions) {
+        return -size / 2.0f * 0.3f + 3 * (size / divisions);
+    }
+
+    // Line vertices of a uniform grid of the given divisions
+    static size_t uniformVertexCount(int divisions) {
+        return 4 * size_t(divisions) * (divisions + 1);
+    }
+
+    // Heights start at zero and are filled by the next field update
+    void applyLayout() {
+        const std::vector<float>& pointX = layout.getPointX();
+        const std::vector<float>& pointZ = layout.getPointZ();
+        const std::vector<uint32_t>& lines = layout.getLines();
+        vertices.resize(3 * lines.size());
+        for (size_t v = 0; v < lines.size(); ++v) {
+            vertices[3 * v] = pointX[lines[v]];
+            vertices[3 * v + 1] = 0.0f;
+            vertices[3 * v + 2] = pointZ[lines[v]];
+        }
+        field.setPoints(pointX, pointZ);
+        layoutPending = true;
+        cpuHeights = false;
+    }
+
+    // Sources were just prepared by the field, padding included
+    void packBodies(size_t count) {
+        const float* x = field.getSourceX();
+        const float* y = field.getSourceY();
+        const float* z = field.getSourceZ();
+        const float* rs = field.getSourceRs();
+        bodyBlock.resize(4 * count);
+        for (size_t b = 0; b < count; ++b) {
+            bodyBlock[4 * b] = x[b];
+            bodyBlock[4 * b + 1] = y[b];
+            bodyBlock[4 * b + 2] = z[b];
+            bodyBlock[4 * b + 3] = rs[b];
+        }
+        bodiesPending = true;
+    }
+
+    // Copies the rewritten heights into the vertices and queues their runs
+    void collectUpdatedVertices() {
+        const std::vector<uint32_t>& lines = layout.getLines();
+        const size_t count = lines.size();
+        size_t v = 0;
+        while (v < count) {
+            if (!field.wasUpdated(lines[v])) {
+                ++v;
+                continue;
             }
+            size_t first = v;
+            for (; v < count && field.wasUpdated(lines[v]); ++v) {
+                vertices[3 * v + 1] = field.heightAt(lines[v]);
+            }
+            pendingRuns.push_back(static_cast<uint32_t>(first));
+            pendingRuns.push_back(static_cast<uint32_t>(v - first));
         }
-        
-        return gridVertices;
     }
-};
\ No newline at end of file
+};
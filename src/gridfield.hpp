@@ -0,0 +1,315 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "constants.hpp"
+#include "bodystore.hpp"
+#include "gravitykernel.hpp"
+#include "threadpool.hpp"
+
+// Height field behind the spacetime grid, kept free of GL so it can be
+// updated off the render path. Every sample point of the flat grid sinks by
+// 4 * sqrt(rs * (d - rs)) per body, with d the distance in metres and rs the
+// body's Schwarzschild radius, the same law the grid always used.
+//
+// Points are bucketed into a REGIONS_PER_SIDE square of regions. A region
+// is re-evaluated only once the bodies have moved far enough to change its
+// heights by more than the tolerance: each frame adds, per body, the
+// displacement's slope at the region's nearest point times the distance the
+// body moved, which bounds the change from above. Regions are evaluated in
+// parallel, eight points at a time with AVX2 when available.
+class GridField {
+public:
+    static constexpr int REGIONS_PER_SIDE = 8;
+
+private:
+    static constexpr size_t LANES = 8;
+
+    struct Region {
+        float minX, maxX, minZ, maxZ;
+        size_t begin, end;  // packed point range, padded to LANES
+        size_t points;      // real points at the front of the range
+        float error;        // bound on the height change since evaluation
+        float maxHeight;
+    };
+
+    float halfSize, planeY;
+    float tolerance;
+    std::vector<Region> regions;
+    std::vector<uint32_t> packedIndex;  // point -> packed slot
+    std::vector<uint32_t> pointRegion;  // point -> region
+    std::vector<uint32_t> borderPoints; // packed slots on the edge of the square
+    std::vector<float> pointX, pointZ;  // packed by region
+    std::vector<float> heights;
+    std::vector<uint8_t> updated;       // per region, set by the last update
+    std::vector<uint32_t> dirty;
+
+    // Per-body sources for this frame, padded with rs = 0
+    std::vector<float> sourceX, sourceY, sourceZ, sourceRs;
+    std::vector<float> lastX, lastY, lastZ;
+    uint64_t lastRevision;
+    float centerOfMassY;
+    bool useAVX2;
+
+public:
+    // Samples the square [-size/2, size/2] in x and z, lying flat at planeY
+    GridField(float size, float planeY)
+        : halfSize(size / 2.0f), planeY(planeY), tolerance(1.0f), lastRevision(~uint64_t(0)),
+          centerOfMassY(0.0f),
+          useAVX2(GravityKernel::detectInstructionSet() >= GravityKernel::InstructionSet::AVX2) {}
+
+    // Largest height change, in grid units, a region may drift by before it
+    // is evaluated again; 0 evaluates every region every frame
+    void setTolerance(float units) { tolerance = std::max(0.0f, units); }
+    float getTolerance() const { return tolerance; }
+
+    float getPlaneY() const { return planeY; }
+
+    // Replaces the sample points; every height is evaluated on the next update
+    void setPoints(const std::vector<float>& x, const std::vector<float>& z) {
+        const size_t count = x.size();
+        const float cell = 2.0f * halfSize / REGIONS_PER_SIDE;
+        std::vector<std::vector<uint32_t>> buckets(REGIONS_PER_SIDE * REGIONS_PER_SIDE);
+        for (uint32_t i = 0; i < count; ++i) {
+            int column = std::min(REGIONS_PER_SIDE - 1, std::max(0, int((x[i] + halfSize) / cell)));
+            int row = std::min(REGIONS_PER_SIDE - 1, std::max(0, int((z[i] + halfSize) / cell)));
+            buckets[row * REGIONS_PER_SIDE + column].push_back(i);
+        }
+
+        regions.clear();
+        borderPoints.clear();
+        pointX.clear();
+        pointZ.clear();
+        packedIndex.assign(count, 0);
+        pointRegion.assign(count, 0);
+        for (const std::vector<uint32_t>& bucket : buckets) {
+            if (bucket.empty()) continue;
+            Region region;
+            region.begin = pointX.size();
+            region.points = bucket.size();
+            region.minX = region.minZ = halfSize;
+            region.maxX = region.maxZ = -halfSize;
+            region.error = 0.0f;
+            region.maxHeight = 0.0f;
+            for (uint32_t i : bucket) {
+                packedIndex[i] = static_cast<uint32_t>(pointX.size());
+                pointRegion[i] = static_cast<uint32_t>(regions.size());
+                if (std::abs(x[i]) >= halfSize || std::abs(z[i]) >= halfSize) {
+                    borderPoints.push_back(packedIndex[i]);
+                }
+                pointX.push_back(x[i]);
+                pointZ.push_back(z[i]);
+                region.minX = std::min(region.minX, x[i]);
+                region.maxX = std::max(region.maxX, x[i]);
+                region.minZ = std::min(region.minZ, z[i]);
+                region.maxZ = std::max(region.maxZ, z[i]);
+            }
+            // Padding repeats the last point so it stays finite
+            while (pointX.size() % LANES != 0) {
+                pointX.push_back(pointX.back());
+                pointZ.push_back(pointZ.back());
+            }
+            region.end = pointX.size();
+            regions.push_back(region);
+        }
+        heights.assign(pointX.size(), 0.0f);
+        updated.assign(regions.size(), 0);
+        invalidate();
+    }
+
+    float heightAt(uint32_t point) const { return heights[packedIndex[point]]; }
+
+    // Whether the last update rewrote the point's height
+    bool wasUpdated(uint32_t point) const { return updated[pointRegion[point]] != 0; }
+
+    float getMaxHeight() const {
+        float top = regions.empty() ? 0.0f : regions[0].maxHeight;
+        for (const Region& region : regions) top = std::max(top, region.maxHeight);
+        return top;
+    }
+
+    // Mass-weighted height of the bodies that are not being initialized
+    float getCenterOfMassY() const { return centerOfMassY; }
+
+    // Per-body sources of the last setBodies(), padded to a multiple of 8
+    size_t getSourceCount() const { return sourceRs.size(); }
+    const float* getSourceX() const { return sourceX.data(); }
+    const float* getSourceY() const { return sourceY.data(); }
+    const float* getSourceZ() const { return sourceZ.data(); }
+    const float* getSourceRs() const { return sourceRs.data(); }
+
+    // Forces the next update to evaluate every region
+    void invalidate() { lastRevision = ~uint64_t(0); }
+
+    // Schwarzschild radius (m) of every body, computed once per frame;
+    // call before update() or borderMaxHeight()
+    void setBodies(const BodyStore& bodies) {
+        prepareSources(bodies);
+    }
+
+    // Highest point of the grid without evaluating the field: in the plane
+    // every body's displacement has a positive Laplacian, so the maximum of
+    // the sum lies on the border of the square
+    float borderMaxHeight() const {
+        float top = borderPoints.empty() ? 0.0f : -std::numeric_limits<float>::infinity();
+        for (uint32_t p : borderPoints) {
+            top = std::max(top, heightOf(pointX[p], pointZ[p]));
+        }
+        return top;
+    }
+
+    // Re-evaluates the regions the bodies have disturbed beyond the
+    // tolerance. Returns whether any region changed.
+    bool update(const BodyStore& bodies, ThreadPool& pool) {
+        const size_t count = bodies.size();
+        std::fill(updated.begin(), updated.end(), 0);
+        dirty.clear();
+        if (bodies.getRevision() != lastRevision || lastX.size() != count) {
+            // Bodies came, went, changed mass or were moved by hand
+            for (uint32_t r = 0; r < regions.size(); ++r) dirty.push_back(r);
+        } else {
+            accumulateError(pool);
+            for (uint32_t r = 0; r < regions.size(); ++r) {
+                if (regions[r].error > tolerance) dirty.push_back(r);
+            }
+        }
+        lastRevision = bodies.getRevision();
+        lastX.assign(bodies.x(), bodies.x() + count);
+        lastY.assign(bodies.y(), bodies.y() + count);
+        lastZ.assign(bodies.z(), bodies.z() + count);
+        if (dirty.empty()) return false;
+
+        pool.parallelFor(dirty.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t d = begin; d < end; ++d) {
+                evaluateRegion(regions[dirty[d]]);
+            }
+        });
+        for (uint32_t r : dirty) updated[r] = 1;
+        return true;
+    }
+
+private:
+    // Schwarzschild radius (m) of every body, computed once per frame
+    void prepareSources(const BodyStore& bodies) {
+        const size_t count = bodies.size();
+        const size_t padded = (count + LANES - 1) / LANES * LANES;
+        const float* mass = bodies.mass();
+        const uint8_t* initializing = bodies.initializing();
+        sourceX.assign(padded, 0.0f);
+        sourceY.assign(padded, planeY);
+        sourceZ.assign(padded, 0.0f);
+        sourceRs.assign(padded, 0.0f);
+        std::copy(bodies.x(), bodies.x() + count, sourceX.begin());
+        std::copy(bodies.y(), bodies.y() + count, sourceY.begin());
+        std::copy(bodies.z(), bodies.z() + count, sourceZ.begin());
+
+        float totalMass = 0.0f;
+        centerOfMassY = 0.0f;
+        for (size_t b = 0; b < count; ++b) {
+            sourceRs[b] = static_cast<float>(2.0 * Constants::G * mass[b]) / (Constants::C * Constants::C);
+            if (initializing[b]) continue;
+            centerOfMassY += mass[b] * sourceY[b];
+            totalMass += mass[b];
+        }
+        if (totalMass > 0.0f) centerOfMassY /= totalMass;
+    }
+
+    // d/dd of 4 sqrt(rs (1000 d - rs)) is 2000 rs / sqrt(rs (1000 d - rs)),
+    // which falls with distance, so the slope at the region's nearest point
+    // bounds how much a body's move can change any height in it
+    void accumulateError(ThreadPool& pool) {
+        const size_t count = lastX.size();
+        pool.parallelFor(regions.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t r = begin; r < end; ++r) {
+                Region& region = regions[r];
+                float error = region.error;
+                for (size_t b = 0; b < count && error <= tolerance; ++b) {
+                    const float rs = sourceRs[b];
+                    const float mx = sourceX[b] - lastX[b], my = sourceY[b] - lastY[b], mz = sourceZ[b] - lastZ[b];
+                    const float moved = std::sqrt(mx * mx + my * my + mz * mz);
+                    if (rs <= 0.0f || moved <= 0.0f) continue;
+
+                    const float ox = std::max({region.minX - sourceX[b], sourceX[b] - region.maxX, 0.0f});
+                    const float oy = sourceY[b] - planeY;
+                    const float oz = std::max({region.minZ - sourceZ[b], sourceZ[b] - region.maxZ, 0.0f});
+                    const float nearest = std::sqrt(ox * ox + oy * oy + oz * oz) - moved;
+                    const float inside = rs * (1000.0f * nearest - 2.0f * rs);
+                    if (inside <= 0.0f) {
+                        error = tolerance + 1.0f; // too close to bound, evaluate
+                        break;
+                    }
+                    error += 2000.0f * rs / std::sqrt(inside) * moved;
+                }
+                region.error = error;
+            }
+        });
+    }
+
+    void evaluateRegion(Region& region) {
+#ifdef GRAVITY_KERNEL_X86
+        if (useAVX2) {
+            evaluateAVX2(region.begin, region.end);
+        } else
+#endif
+        {
+            evaluateScalar(region.begin, region.end);
+        }
+
+        float top = heights[region.begin];
+        for (size_t p = region.begin; p < region.begin + region.points; ++p) {
+            top = std::max(top, heights[p]);
+        }
+        region.maxHeight = top;
+        region.error = 0.0f;
+    }
+
+    void evaluateScalar(size_t begin, size_t end) {
+        for (size_t p = begin; p < end; ++p) {
+            heights[p] = heightOf(pointX[p], pointZ[p]);
+        }
+    }
+
+    float heightOf(float x, float z) const {
+        const size_t sources = sourceRs.size();
+        float sum = 0.0f;
+        for (size_t b = 0; b < sources; ++b) {
+            float dx = sourceX[b] - x;
+            float dy = sourceY[b] - planeY;
+            float dz = sourceZ[b] - z;
+            float distance_m = std::sqrt(dx * dx + dy * dy + dz * dz) * 1000.0f;
+            float rs = sourceRs[b];
+            sum += std::sqrt(std::max(0.0f, rs * (distance_m - rs)));
+        }
+        return 4.0f * sum;
+    }
+
+#ifdef GRAVITY_KERNEL_X86
+    __attribute__((target("avx2,fma")))
+    void evaluateAVX2(size_t begin, size_t end) {
+        const size_t sources = sourceRs.size();
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 metres = _mm256_set1_ps(1000.0f);
+        const __m256 plane = _mm256_set1_ps(planeY);
+        for (size_t p = begin; p < end; p += LANES) {
+            const __m256 x = _mm256_loadu_ps(&pointX[p]);
+            const __m256 z = _mm256_loadu_ps(&pointZ[p]);
+            __m256 sum = zero;
+            for (size_t b = 0; b < sources; ++b) {
+                __m256 dx = _mm256_sub_ps(_mm256_set1_ps(sourceX[b]), x);
+                __m256 dy = _mm256_sub_ps(_mm256_set1_ps(sourceY[b]), plane);
+                __m256 dz = _mm256_sub_ps(_mm256_set1_ps(sourceZ[b]), z);
+                __m256 distSq = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+                __m256 distance_m = _mm256_mul_ps(_mm256_sqrt_ps(distSq), metres);
+                __m256 rs = _mm256_set1_ps(sourceRs[b]);
+                __m256 inside = _mm256_max_ps(zero, _mm256_mul_ps(rs, _mm256_sub_ps(distance_m, rs)));
+                sum = _mm256_add_ps(sum, _mm256_sqrt_ps(inside));
+            }
+            _mm256_storeu_ps(&heights[p], _mm256_mul_ps(sum, _mm256_set1_ps(4.0f)));
+        }
+    }
+#endif
+};
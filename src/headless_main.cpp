@@ -0,0 +1,320 @@
+// Headless batch driver: runs a scenario for a fixed number of steps with no
+// window or GL context and writes the final state. dt is in the same
+// wall-clock seconds as the windowed app's fixed step.
+//
+//   headless <scenario> <steps> <dt> [options]
+//
+// Options:
+//   -o, --output <file>   final state file, "-" for stdout (default)
+//   --solver <name>       direct | barnes-hut | fmm
+//   --integrator <name>   euler | leapfrog | yoshida4 | hermite
+//   --eta <value>         Hermite block step accuracy
+//   --collisions <mode>   bounce | merge
+//   --threads <count>     worker threads including the caller, 0 = all cores
+//   --theta <angle>       opening angle of the selected tree solver
+//   --order <p>           FMM expansion order
+//   --softening <km>      Plummer softening of every solver
+//   --energy 1            report the relative energy drift (O(N^2))
+//   --checkpoint <file>   write a binary checkpoint at the end
+//   --checkpoint-every n  also write it every n steps, in the background
+//   --trajectory <file>   record positions and velocities to a trajectory file
+//   --trajectory-every n  steps between recorded frames (default 10)
+//   --trajectory-quantum q  resolution of the recorded values (default 0.01)
+//   --profile <file>      write a Chrome trace of the run (needs -DNBODY_PROFILE)
+//   --precision <p>       float (default) | double; double runs direct sum only
+//                         and cannot checkpoint or record trajectories
+//
+// A scenario of the form checkpoint:<file> restores a saved run; options
+// given after it override the saved settings.
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <type_traits>
+
+#include "checkpoint.hpp"
+#include "physicsengine.hpp"
+#include "profiler.hpp"
+#include "scenario.hpp"
+#include "trajectory.hpp"
+
+// --precision picks between these at run time; instantiating them whole
+// also compiles the members no run happens to call. The engine is
+// header-only, so this lives in the one translation unit that uses both.
+template class BasicPhysicsEngine<float>;
+template class BasicPhysicsEngine<double>;
+
+static void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " <scenario> <steps> <dt> [-o file] [--solver direct|barnes-hut|fmm]\n"
+              << "       [--integrator euler|leapfrog|yoshida4|hermite] [--eta value] [--collisions bounce|merge] [--threads n] [--theta angle] [--order p]\n"
+              << "       [--softening km] [--energy 1] [--checkpoint file] [--checkpoint-every n]\n"
+              << "       [--trajectory file] [--trajectory-every n] [--trajectory-quantum q] [--profile file]\n"
+              << "       [--precision float|double]\n"
+              << "Scenarios: default, cloud:<count>[:<seed>], plummer:<count>[:<seed>], disk:<count>[:<seed>],\n"
+              << "           rings:<count>[:<seed>], checkpoint:<file> or a scenario file" << std::endl;
+}
+
+static bool parseNumber(const char* text, double& value) {
+    char* end = nullptr;
+    value = std::strtod(text, &end);
+    return end != text && *end == '\0';
+}
+
+// Everything the run needs besides the engine's own settings. dt and the
+// softening stay double until they reach whichever engine runs, so the
+// double engine sees them unrounded.
+struct RunOptions {
+    std::string source;
+    Scenario scenario;
+    bool restoring = false;
+    uint64_t seed = 0;
+    long long stepCount = 0;
+    double dt = 0.0;
+    double softening = -1.0; // --softening, negative keeps the engine's
+    std::string output = "-";
+    std::string checkpointPath;
+    long long checkpointEvery = 0;
+    std::string trajectoryPath;
+    TrajectorySettings trajectorySettings;
+    std::string profilePath;
+    bool reportEnergy = false;
+};
+
+// Checkpoints and trajectories store floats, so only the float engine
+// writes them; main() rejects them for the others
+template <typename Engine>
+static int run(Engine& physics, RunOptions& options) {
+    constexpr bool SINGLE = std::is_same<Engine, PhysicsEngine>::value;
+    if (!options.restoring) {
+        options.scenario.populate(physics.getBodies(), physics.getThreadPool());
+    }
+    if (options.softening >= 0.0) {
+        physics.setSoftening(options.softening);
+    }
+    double initialEnergy = options.reportEnergy ? physics.computeEnergy() : 0.0;
+
+    const long long stepCount = options.stepCount;
+    const size_t initialCount = physics.getBodies().size();
+    size_t forceEvaluations = 0, merges = 0;
+    CheckpointWriter checkpoints;
+    TrajectoryWriter trajectory;
+    if constexpr (SINGLE) {
+        if (!options.trajectoryPath.empty()) {
+            if (!trajectory.open(options.trajectoryPath, options.trajectorySettings)) {
+                return 1;
+            }
+            trajectory.record(physics);
+        }
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (long long s = 0; s < stepCount; ++s) {
+        physics.step(options.dt);
+        forceEvaluations += physics.getForceEvaluations();
+        merges += physics.getMergeCount();
+        if constexpr (SINGLE) {
+            trajectory.record(physics);
+            if (options.checkpointEvery > 0 && (s + 1) % options.checkpointEvery == 0 && s + 1 < stepCount &&
+                !checkpoints.submit(physics, options.seed, options.checkpointPath)) {
+                std::cerr << "Checkpoint at step " << physics.getStepCount() << " skipped, previous one still writing" << std::endl;
+            }
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cerr << (options.restoring ? options.source : options.scenario.getName()) << ": " << initialCount << " bodies, "
+              << stepCount << " steps in " << seconds << " s";
+    if (seconds > 0.0) std::cerr << " (" << stepCount / seconds << " steps/s)";
+    std::cerr << ", " << physics.getThreadCount() << " threads, " << (SINGLE ? "" : "double precision, ")
+              << forceEvaluations << " body force evaluations" << std::endl;
+    if (merges > 0) {
+        std::cerr << merges << " bodies merged, " << physics.getBodies().size() << " remain" << std::endl;
+    }
+    if (options.reportEnergy) {
+        double finalEnergy = physics.computeEnergy();
+        std::cerr << "energy " << initialEnergy << " -> " << finalEnergy << ", relative drift "
+                  << std::abs((finalEnergy - initialEnergy) / initialEnergy) << std::endl;
+    }
+
+    if (trajectory.isOpen()) {
+        if (!trajectory.close()) {
+            return 1;
+        }
+        std::cerr << options.trajectoryPath << ": " << trajectory.getRecordedFrames() << " frames, "
+                  << trajectory.getFileSize() << " bytes";
+        if (trajectory.getDroppedFrames() > 0) std::cerr << ", " << trajectory.getDroppedFrames() << " dropped";
+        std::cerr << std::endl;
+    }
+    if (!options.profilePath.empty()) {
+        long long events = Profiler::instance().writeChromeTrace(options.profilePath);
+        if (events < 0) {
+            return 1;
+        }
+        std::cerr << options.profilePath << ": " << events << " profile events" << std::endl;
+    }
+    if (!checkpoints.wait()) {
+        return 1;
+    }
+    if constexpr (SINGLE) {
+        if (!options.checkpointPath.empty() && !Checkpoint::write(physics, options.seed, options.checkpointPath)) {
+            return 1;
+        }
+    }
+    return Scenario::writeState(physics.getBodies(), options.output) ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    PROFILE_THREAD("main");
+    if (argc < 4) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    double steps = 0.0, dt = 0.0;
+    if (!parseNumber(argv[2], steps) || steps < 0.0 || steps != std::floor(steps) || !parseNumber(argv[3], dt)) {
+        std::cerr << "Invalid step count or dt" << std::endl;
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    PhysicsEngine physics;
+    RunOptions options;
+    options.stepCount = static_cast<long long>(steps);
+    options.dt = dt;
+    bool doublePrecision = false;
+    bool thetaGiven = false;
+    double theta = 0.0;
+
+    // Restore first so options can override the saved settings
+    options.source = argv[1];
+    options.restoring = options.source.compare(0, 11, "checkpoint:") == 0;
+    options.scenario = Scenario(options.source);
+    if (options.restoring) {
+        if (!Checkpoint::restore(options.source.substr(11), physics, &options.seed)) {
+            return 1;
+        }
+    } else {
+        if (!Scenario::load(options.source, options.scenario)) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        options.seed = options.scenario.getSeed();
+    }
+
+    for (int a = 4; a < argc; ++a) {
+        std::string option = argv[a];
+        if (a + 1 >= argc) {
+            std::cerr << "Missing value for " << option << std::endl;
+            return 1;
+        }
+        std::string value = argv[++a];
+        double number = 0.0;
+
+        if (option == "-o" || option == "--output") {
+            options.output = value;
+        } else if (option == "--checkpoint") {
+            options.checkpointPath = value;
+        } else if (option == "--trajectory") {
+            options.trajectoryPath = value;
+        } else if (option == "--profile") {
+            if (!Profiler::ENABLED) {
+                std::cerr << "--profile needs a build with -DNBODY_PROFILE" << std::endl;
+                return 1;
+            }
+            options.profilePath = value;
+        } else if (option == "--precision") {
+            if (value == "float") doublePrecision = false;
+            else if (value == "double") doublePrecision = true;
+            else {
+                std::cerr << "Unknown precision '" << value << "'" << std::endl;
+                return 1;
+            }
+        } else if (option == "--solver") {
+            if (value == "direct") physics.setGravitySolver(GravitySolver::DirectSum);
+            else if (value == "barnes-hut") physics.setGravitySolver(GravitySolver::BarnesHut);
+            else if (value == "fmm") physics.setGravitySolver(GravitySolver::FastMultipole);
+            else {
+                std::cerr << "Unknown solver '" << value << "'" << std::endl;
+                return 1;
+            }
+        } else if (option == "--integrator") {
+            if (value == "euler") physics.setIntegrator(Integrator::SymplecticEuler);
+            else if (value == "leapfrog") physics.setIntegrator(Integrator::Leapfrog);
+            else if (value == "yoshida4") physics.setIntegrator(Integrator::Yoshida4);
+            else if (value == "hermite") physics.setIntegrator(Integrator::Hermite);
+            else {
+                std::cerr << "Unknown integrator '" << value << "'" << std::endl;
+                return 1;
+            }
+        } else if (option == "--collisions") {
+            if (value == "bounce") physics.setCollisionMode(CollisionMode::Bounce);
+            else if (value == "merge") physics.setCollisionMode(CollisionMode::Merge);
+            else {
+                std::cerr << "Unknown collision mode '" << value << "'" << std::endl;
+                return 1;
+            }
+        } else if (!parseNumber(value.c_str(), number) || number < 0.0) {
+            std::cerr << "Invalid value '" << value << "' for " << option << std::endl;
+            return 1;
+        } else if (option == "--threads") {
+            physics.setThreadCount(static_cast<size_t>(number));
+        } else if (option == "--theta") {
+            thetaGiven = true;
+            theta = number;
+        } else if (option == "--order") {
+            physics.setExpansionOrder(static_cast<int>(number));
+        } else if (option == "--softening") {
+            options.softening = number;
+        } else if (option == "--eta") {
+            physics.setHermiteAccuracy(number);
+        } else if (option == "--energy") {
+            options.reportEnergy = number != 0.0;
+        } else if (option == "--checkpoint-every") {
+            options.checkpointEvery = static_cast<long long>(number);
+        } else if (option == "--trajectory-every") {
+            if (number < 1.0) {
+                std::cerr << "--trajectory-every must be at least 1" << std::endl;
+                return 1;
+            }
+            options.trajectorySettings.interval = static_cast<uint32_t>(number);
+        } else if (option == "--trajectory-quantum") {
+            if (!(number > 0.0)) {
+                std::cerr << "--trajectory-quantum must be positive" << std::endl;
+                return 1;
+            }
+            options.trajectorySettings.positionQuantum = number;
+            options.trajectorySettings.velocityQuantum = number;
+        } else {
+            std::cerr << "Unknown option " << option << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (thetaGiven) {
+        if (physics.getGravitySolver() == GravitySolver::FastMultipole) {
+            physics.setMultipoleOpeningAngle(static_cast<float>(theta));
+        } else {
+            physics.setOpeningAngle(static_cast<float>(theta));
+        }
+    }
+
+    if (options.checkpointEvery > 0 && options.checkpointPath.empty()) {
+        std::cerr << "--checkpoint-every needs --checkpoint" << std::endl;
+        return 1;
+    }
+    if (!doublePrecision) {
+        return run(physics, options);
+    }
+
+    if (options.restoring || !options.checkpointPath.empty() || !options.trajectoryPath.empty()) {
+        std::cerr << "Checkpoints and trajectories need --precision float" << std::endl;
+        return 1;
+    }
+    if (physics.getGravitySolver() != GravitySolver::DirectSum && physics.getIntegrator() != Integrator::Hermite) {
+        std::cerr << "Double precision has no tree solvers, using direct summation" << std::endl;
+    }
+    DoublePhysicsEngine precise;
+    precise.copySettings(physics);
+    return run(precise, options);
+}
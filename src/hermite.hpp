@@ -0,0 +1,293 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "bodystore.hpp"
+#include "threadpool.hpp"
+
+// Fourth-order Hermite predictor-corrector with hierarchical block steps.
+//
+// Every body has its own step h / 2^level, chosen from its acceleration
+// and jerk (Aarseth's criterion), where h is the engine's fixed step. All
+// bodies are synchronized again at the end of each fixed step. In between,
+// only the block of bodies due at the next block time has its acceleration
+// and jerk recomputed; the others are just predicted from their Taylor
+// series. Time is counted in integer ticks of h / 2^MAX_LEVEL, so block
+// boundaries compare exactly.
+//
+// Forces come from direct summation with the same Plummer softening as the
+// direct-sum kernel, since the tree solvers provide no jerk. Everything is
+// computed in double precision and written back in the store's precision.
+class HermiteIntegrator {
+public:
+    static constexpr int MAX_LEVEL = 30;
+
+private:
+    // Predicted state of every body at the current block time
+    std::vector<double> predX, predY, predZ;
+    std::vector<double> predVX, predVY, predVZ;
+    std::vector<double> gravitatingMass;
+    std::vector<uint64_t> ticks;        // time reached within the current step
+    std::vector<uint8_t> levels;
+    std::vector<uint32_t> active;
+    std::vector<double> newAcc, newJerk; // 3 per active body
+
+    double eta;
+    double startEta;
+    bool valid;
+    uint64_t revision;
+    size_t forceEvaluations;
+    size_t blockCount;
+
+public:
+    HermiteIntegrator()
+        : eta(0.02), startEta(0.01), valid(false), revision(0), forceEvaluations(0), blockCount(0) {}
+
+    // Aarseth accuracy parameter; smaller values take smaller steps
+    void setAccuracy(double value) { eta = std::max(1.0e-6, value); }
+    double getAccuracy() const { return eta; }
+
+    // Forgets accelerations, jerks and step sizes; the next step starts over
+    void invalidate() { valid = false; }
+
+    // Whether the store's accelerations, jerks and steps are this
+    // integrator's, and taking them over after they were restored
+    bool isCurrent(uint64_t storeRevision) const { return valid && revision == storeRevision; }
+    void resume(uint64_t storeRevision) {
+        valid = true;
+        revision = storeRevision;
+    }
+
+    // Bodies whose forces were computed during the last step, counted once
+    // per block they were active in, and the number of blocks
+    size_t getForceEvaluations() const { return forceEvaluations; }
+    size_t getBlockCount() const { return blockCount; }
+
+    // Advances every body by h simulation time units
+    template <typename Real>
+    void step(BasicBodyStore<Real>& bodies, double h, double G, double softeningSq, ThreadPool& pool) {
+        const size_t count = bodies.size();
+        forceEvaluations = 0;
+        blockCount = 0;
+        if (count == 0 || h <= 0.0) return;
+
+        const Real* mass = bodies.mass();
+        const uint8_t* initializing = bodies.initializing();
+        gravitatingMass.resize(count);
+        for (size_t j = 0; j < count; ++j) {
+            gravitatingMass[j] = initializing[j] ? 0.0 : G * mass[j];
+        }
+        predX.resize(count); predY.resize(count); predZ.resize(count);
+        predVX.resize(count); predVY.resize(count); predVZ.resize(count);
+        ticks.assign(count, 0);
+        levels.resize(count);
+
+        if (!valid || revision != bodies.getRevision()) {
+            initialize(bodies, h, softeningSq, pool);
+        } else {
+            // Snap the stored steps onto the power-of-two ladder of this h
+            const Real* timeStep = bodies.timeStep();
+            for (size_t i = 0; i < count; ++i) {
+                levels[i] = levelFor(timeStep[i], h);
+            }
+        }
+
+        const uint64_t end = uint64_t(1) << MAX_LEVEL;
+        const double tick = h / double(end);
+        uint64_t now = 0;
+        while (now < end) {
+            uint64_t next = end;
+            for (size_t i = 0; i < count; ++i) {
+                if (initializing[i]) continue;
+                next = std::min(next, ticks[i] + stepTicks(levels[i]));
+            }
+            active.clear();
+            for (size_t i = 0; i < count; ++i) {
+                if (!initializing[i] && ticks[i] + stepTicks(levels[i]) == next) {
+                    active.push_back(static_cast<uint32_t>(i));
+                }
+            }
+            if (active.empty()) break;
+
+            predict(bodies, next, tick, pool);
+            evaluate(softeningSq, pool);
+            correct(bodies, next, tick, h, pool);
+
+            forceEvaluations += active.size();
+            ++blockCount;
+            now = next;
+        }
+
+        valid = true;
+        revision = bodies.getRevision();
+    }
+
+private:
+    static uint64_t stepTicks(int level) { return uint64_t(1) << (MAX_LEVEL - level); }
+
+    // Smallest level whose step h / 2^level does not exceed dt
+    static uint8_t levelFor(double dt, double h) {
+        if (!(dt > 0.0)) return MAX_LEVEL;
+        int level = static_cast<int>(std::ceil(std::log2(h / dt) - 1.0e-9));
+        return static_cast<uint8_t>(std::min(std::max(level, 0), MAX_LEVEL));
+    }
+
+    // Accelerations and jerks of every body from the current state, and a
+    // conservative first step of startEta * |a| / |j|
+    template <typename Real>
+    void initialize(BasicBodyStore<Real>& bodies, double h, double softeningSq, ThreadPool& pool) {
+        const size_t count = bodies.size();
+        const uint8_t* initializing = bodies.initializing();
+
+        active.clear();
+        for (size_t i = 0; i < count; ++i) {
+            if (!initializing[i]) active.push_back(static_cast<uint32_t>(i));
+        }
+        predict(bodies, 0, 0.0, pool);
+        evaluate(softeningSq, pool);
+
+        Real* ax = bodies.ax(); Real* ay = bodies.ay(); Real* az = bodies.az();
+        Real* jx = bodies.jx(); Real* jy = bodies.jy(); Real* jz = bodies.jz();
+        Real* timeStep = bodies.timeStep();
+        for (size_t k = 0; k < active.size(); ++k) {
+            uint32_t i = active[k];
+            const double* a = &newAcc[3 * k];
+            const double* j = &newJerk[3 * k];
+            ax[i] = static_cast<Real>(a[0]); ay[i] = static_cast<Real>(a[1]); az[i] = static_cast<Real>(a[2]);
+            jx[i] = static_cast<Real>(j[0]); jy[i] = static_cast<Real>(j[1]); jz[i] = static_cast<Real>(j[2]);
+
+            double aNorm = std::sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+            double jNorm = std::sqrt(j[0] * j[0] + j[1] * j[1] + j[2] * j[2]);
+            double dt = jNorm > 0.0 ? startEta * aNorm / jNorm : h;
+            levels[i] = levelFor(dt, h);
+            timeStep[i] = static_cast<Real>(h / double(uint64_t(1) << levels[i]));
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (initializing[i]) levels[i] = 0;
+        }
+    }
+
+    // Taylor expansion of every body to block time `target`
+    template <typename Real>
+    void predict(const BasicBodyStore<Real>& bodies, uint64_t target, double tick, ThreadPool& pool) {
+        const Real* x = bodies.x(); const Real* y = bodies.y(); const Real* z = bodies.z();
+        const Real* vx = bodies.vx(); const Real* vy = bodies.vy(); const Real* vz = bodies.vz();
+        const Real* ax = bodies.ax(); const Real* ay = bodies.ay(); const Real* az = bodies.az();
+        const Real* jx = bodies.jx(); const Real* jy = bodies.jy(); const Real* jz = bodies.jz();
+        const uint8_t* initializing = bodies.initializing();
+
+        pool.parallelFor(bodies.size(), 4096, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                double dt = initializing[i] ? 0.0 : double(target - ticks[i]) * tick;
+                double dt2 = dt * dt / 2.0, dt3 = dt * dt * dt / 6.0;
+                predX[i] = x[i] + vx[i] * dt + ax[i] * dt2 + jx[i] * dt3;
+                predY[i] = y[i] + vy[i] * dt + ay[i] * dt2 + jy[i] * dt3;
+                predZ[i] = z[i] + vz[i] * dt + az[i] * dt2 + jz[i] * dt3;
+                predVX[i] = vx[i] + ax[i] * dt + jx[i] * dt2;
+                predVY[i] = vy[i] + ay[i] * dt + jy[i] * dt2;
+                predVZ[i] = vz[i] + az[i] * dt + jz[i] * dt2;
+            }
+        });
+    }
+
+    // Acceleration and jerk of every active body from all predicted bodies
+    void evaluate(double softeningSq, ThreadPool& pool) {
+        const size_t count = predX.size();
+        newAcc.resize(3 * active.size());
+        newJerk.resize(3 * active.size());
+
+        pool.parallelFor(active.size(), 16, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+                const uint32_t i = active[k];
+                double a[3] = {0.0, 0.0, 0.0};
+                double j[3] = {0.0, 0.0, 0.0};
+
+                for (size_t s = 0; s < count; ++s) {
+                    double dx = predX[s] - predX[i];
+                    double dy = predY[s] - predY[i];
+                    double dz = predZ[s] - predZ[i];
+                    double distSq = dx * dx + dy * dy + dz * dz;
+                    if (distSq <= 0.0) continue;
+                    double dvx = predVX[s] - predVX[i];
+                    double dvy = predVY[s] - predVY[i];
+                    double dvz = predVZ[s] - predVZ[i];
+
+                    double r2 = distSq + softeningSq;
+                    double invDist = 1.0 / std::sqrt(r2);
+                    double m = gravitatingMass[s] * invDist * invDist * invDist;
+                    double rv = 3.0 * (dx * dvx + dy * dvy + dz * dvz) / r2;
+                    a[0] += m * dx;
+                    a[1] += m * dy;
+                    a[2] += m * dz;
+                    j[0] += m * (dvx - rv * dx);
+                    j[1] += m * (dvy - rv * dy);
+                    j[2] += m * (dvz - rv * dz);
+                }
+
+                std::copy(a, a + 3, &newAcc[3 * k]);
+                std::copy(j, j + 3, &newJerk[3 * k]);
+            }
+        });
+    }
+
+    // Hermite corrector for the active block, then each body's next step.
+    // A step may shrink freely but only doubles when the body's time is a
+    // multiple of the doubled step, so blocks stay aligned.
+    template <typename Real>
+    void correct(BasicBodyStore<Real>& bodies, uint64_t target, double tick, double h, ThreadPool& pool) {
+        Real* x = bodies.x(); Real* y = bodies.y(); Real* z = bodies.z();
+        Real* vx = bodies.vx(); Real* vy = bodies.vy(); Real* vz = bodies.vz();
+        Real* ax = bodies.ax(); Real* ay = bodies.ay(); Real* az = bodies.az();
+        Real* jx = bodies.jx(); Real* jy = bodies.jy(); Real* jz = bodies.jz();
+        Real* timeStep = bodies.timeStep();
+
+        pool.parallelFor(active.size(), 64, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+                const uint32_t i = active[k];
+                const double dt = double(target - ticks[i]) * tick;
+                const double* a1 = &newAcc[3 * k];
+                const double* j1 = &newJerk[3 * k];
+                Real* pos[3] = {&x[i], &y[i], &z[i]};
+                Real* vel[3] = {&vx[i], &vy[i], &vz[i]};
+                Real* acc[3] = {&ax[i], &ay[i], &az[i]};
+                Real* jerk[3] = {&jx[i], &jy[i], &jz[i]};
+
+                double a1Sq = 0.0, j1Sq = 0.0, a2Sq = 0.0, a3Sq = 0.0;
+                for (int d = 0; d < 3; ++d) {
+                    const double a0 = *acc[d], j0 = *jerk[d], v0 = *vel[d];
+                    const double v1 = v0 + (a0 + a1[d]) * dt / 2.0 + (j0 - j1[d]) * dt * dt / 12.0;
+                    *pos[d] = static_cast<Real>(*pos[d] + (v0 + v1) * dt / 2.0 + (a0 - a1[d]) * dt * dt / 12.0);
+                    *vel[d] = static_cast<Real>(v1);
+                    *acc[d] = static_cast<Real>(a1[d]);
+                    *jerk[d] = static_cast<Real>(j1[d]);
+
+                    // Higher derivatives from the Hermite interpolant, at the end of the step
+                    const double a3 = (12.0 * (a0 - a1[d]) + 6.0 * dt * (j0 + j1[d])) / (dt * dt * dt);
+                    const double a2 = (-6.0 * (a0 - a1[d]) - dt * (4.0 * j0 + 2.0 * j1[d])) / (dt * dt) + a3 * dt;
+                    a1Sq += a1[d] * a1[d];
+                    j1Sq += j1[d] * j1[d];
+                    a2Sq += a2 * a2;
+                    a3Sq += a3 * a3;
+                }
+
+                int level = levels[i];
+                const double denominator = std::sqrt(j1Sq * a3Sq) + a2Sq;
+                if (denominator > 0.0) {
+                    const double ideal = std::sqrt(eta * (std::sqrt(a1Sq * a2Sq) + j1Sq) / denominator);
+                    const int wanted = levelFor(ideal, h);
+                    if (wanted > level) {
+                        level = wanted;
+                    } else if (wanted < level && level > 0 && target % stepTicks(level - 1) == 0) {
+                        --level;
+                    }
+                }
+                levels[i] = static_cast<uint8_t>(level);
+                ticks[i] = target;
+                timeStep[i] = static_cast<Real>(h / double(uint64_t(1) << level));
+            }
+        });
+    }
+};
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "constants.hpp"
+#include "bodystore.hpp"
+#include "threadpool.hpp"
+
+// Counter-based random numbers: draw n of stream s is a hash of the seed,
+// s and n, with no state carried between streams. Every body draws from
+// its own stream, so a scene is the same whichever thread builds which body.
+class CounterRandom {
+public:
+    static constexpr double TWO_PI = 6.283185307179586;
+
+private:
+    static constexpr uint64_t GOLDEN = 0x9E3779B97F4A7C15ull;
+
+    uint64_t key;
+    uint64_t counter;
+
+public:
+    CounterRandom(uint64_t seed, uint64_t stream) : key(mix(seed ^ mix(stream + GOLDEN))), counter(0) {}
+
+    uint64_t next() { return mix(key + ++counter * GOLDEN); }
+
+    // Uniform in (0, 1]
+    double uniform() { return double((next() >> 11) + 1) * 0x1.0p-53; }
+
+    // Standard normal, by Box-Muller
+    double normal() {
+        const double radius = std::sqrt(-2.0 * std::log(uniform()));
+        return radius * std::cos(TWO_PI * uniform());
+    }
+
+    // Uniform on the unit sphere
+    glm::dvec3 direction() {
+        const double cosTheta = 2.0 * uniform() - 1.0;
+        const double sinTheta = std::sqrt(std::max(0.0, 1.0 - cosTheta * cosTheta));
+        const double phi = TWO_PI * uniform();
+        return glm::dvec3(sinTheta * std::cos(phi), cosTheta, sinTheta * std::sin(phi));
+    }
+
+private:
+    // SplitMix64 finalizer
+    static uint64_t mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+};
+
+// Equilibrium initial conditions written straight into a body store. The
+// bodies are appended in one block and filled in parallel, body i from
+// stream i of the seed, so the result does not depend on the thread count.
+// Discs and rings lie in the x-z plane, the grid's, and all orbit the same
+// way. The central body of a disc or ring system is added by the caller;
+// the orbits assume it sits at rest at the origin. A Plummer sphere is
+// shifted to zero total momentum so it does not drift off.
+class InitialConditions {
+public:
+    // Plummer sphere of PLUMMER_MASS in total with scale radius PLUMMER_RADIUS
+    static constexpr double PLUMMER_MASS = 1.0e25;
+    static constexpr double PLUMMER_RADIUS = 5000.0;
+
+    // Exponential disc around a star of DISK_CENTRAL_MASS
+    static constexpr double DISK_CENTRAL_MASS = 1.989e25;
+    static constexpr double DISK_CENTRAL_DENSITY = 8000.0;
+    static constexpr double DISK_MASS = 2.0e24;
+    static constexpr double DISK_SCALE_LENGTH = 2500.0;
+
+    // Ring particles around a planet of RING_PLANET_MASS
+    static constexpr double RING_PLANET_MASS = 5.68e24;
+    static constexpr double RING_MASS = 5.68e22;
+
+    static constexpr double STAR_DENSITY = 3344.0;
+    static constexpr double ICE_DENSITY = 900.0;
+
+private:
+    // Bodies handed to one task
+    static constexpr size_t GRAIN = 4096;
+    // Cut-offs in scale lengths, so no body starts far outside the view
+    static constexpr double PLUMMER_CUTOFF = 10.0;
+    static constexpr double DISK_CUTOFF = 7.0;
+    static constexpr double DISK_INNER_CUT = 3.0; // in central star radii, so no body starts inside it
+    static constexpr double DISK_THICKNESS = 0.05; // vertical scale per scale length
+    static constexpr double DISK_DISPERSION = 0.05; // random velocity per circular velocity
+    static constexpr double RING_THICKNESS = 2.0;  // km
+    static constexpr double RING_DISPERSION = 0.002;
+
+    // Inner and outer radius of each ring, in km
+    struct Band {
+        double inner, outer;
+    };
+    static constexpr Band RING_BANDS[] = {{700.0, 950.0}, {1000.0, 1450.0}, {1550.0, 1900.0}, {2050.0, 2150.0}};
+    static constexpr size_t BAND_COUNT = sizeof(RING_BANDS) / sizeof(RING_BANDS[0]);
+
+public:
+    // Aarseth, Henon and Wielen's sampling of the Plummer model: radius by
+    // inverting the cumulative mass, speed by rejection from the
+    // distribution function, both directions isotropic
+    template <typename Real>
+    static void plummer(BasicBodyStore<Real>& store, size_t count, uint64_t seed, ThreadPool& pool) {
+        const double mass = PLUMMER_MASS / double(count);
+        const double velocityScale = std::sqrt(Constants::SIMULATION_G * PLUMMER_MASS / PLUMMER_RADIUS);
+        const size_t first = generate(store, count, seed, STAR_DENSITY, pool, [&](CounterRandom& random, glm::dvec3& position, glm::dvec3& velocity) {
+            double r;
+            do {
+                r = 1.0 / std::sqrt(std::pow(random.uniform(), -2.0 / 3.0) - 1.0);
+            } while (!(r <= PLUMMER_CUTOFF));
+
+            double q, g;
+            do {
+                q = random.uniform();
+                g = 0.1 * random.uniform();
+            } while (g > q * q * std::pow(1.0 - q * q, 3.5));
+            const double speed = q * std::sqrt(2.0) * std::pow(1.0 + r * r, -0.25);
+
+            position = random.direction() * (r * PLUMMER_RADIUS);
+            velocity = random.direction() * (speed * velocityScale);
+            return mass;
+        });
+        removeMeanVelocity(store, first, count, pool);
+    }
+
+    // Surface density falling off as exp(-R / DISK_SCALE_LENGTH), sampled
+    // as a gamma(2) radius between the inner and outer cut, on circular
+    // orbits about the central star and the disc mass inside them, plus a
+    // small random velocity
+    template <typename Real>
+    static void disk(BasicBodyStore<Real>& store, size_t count, uint64_t seed, ThreadPool& pool) {
+        const double mass = DISK_MASS / double(count);
+        const double innerCut =
+            DISK_INNER_CUT * DoubleBodyStore::computeRadius(DISK_CENTRAL_MASS, DISK_CENTRAL_DENSITY) / DISK_SCALE_LENGTH;
+        const double innerMass = enclosedDiskFraction(innerCut);
+        const double truncatedMass = enclosedDiskFraction(DISK_CUTOFF) - innerMass;
+        generate(store, count, seed, STAR_DENSITY, pool, [&](CounterRandom& random, glm::dvec3& position, glm::dvec3& velocity) {
+            double x;
+            do {
+                x = -std::log(random.uniform() * random.uniform());
+            } while (!(x >= innerCut && x <= DISK_CUTOFF));
+            const double radius = x * DISK_SCALE_LENGTH;
+            const double enclosed =
+                DISK_CENTRAL_MASS + DISK_MASS * (enclosedDiskFraction(x) - innerMass) / truncatedMass;
+            const double circular = std::sqrt(Constants::SIMULATION_G * enclosed / radius);
+
+            const double phi = CounterRandom::TWO_PI * random.uniform();
+            const glm::dvec3 outward(std::cos(phi), 0.0, std::sin(phi));
+            position = outward * radius;
+            position.y = random.normal() * DISK_THICKNESS * DISK_SCALE_LENGTH;
+            velocity = glm::dvec3(outward.z, 0.0, -outward.x) * circular;
+            velocity += glm::dvec3(random.normal(), random.normal(), random.normal()) * (DISK_DISPERSION * circular);
+            return mass;
+        });
+    }
+
+    // Particles spread evenly over the area of RING_BANDS, on Keplerian
+    // orbits about the planet
+    template <typename Real>
+    static void rings(BasicBodyStore<Real>& store, size_t count, uint64_t seed, ThreadPool& pool) {
+        const double mass = RING_MASS / double(count);
+        double totalArea = 0.0;
+        for (size_t b = 0; b < BAND_COUNT; ++b) totalArea += bandArea(b);
+
+        generate(store, count, seed, ICE_DENSITY, pool, [&](CounterRandom& random, glm::dvec3& position, glm::dvec3& velocity) {
+            // A uniform point in the total area, mapped onto the band it falls in
+            double pick = random.uniform() * totalArea;
+            size_t b = 0;
+            while (b + 1 < BAND_COUNT && pick > bandArea(b)) pick -= bandArea(b++);
+            const double inner = RING_BANDS[b].inner;
+            const double radius = std::sqrt(inner * inner + std::min(pick, bandArea(b)));
+            const double circular = std::sqrt(Constants::SIMULATION_G * RING_PLANET_MASS / radius);
+
+            const double phi = CounterRandom::TWO_PI * random.uniform();
+            const glm::dvec3 outward(std::cos(phi), 0.0, std::sin(phi));
+            position = outward * radius;
+            position.y = random.normal() * RING_THICKNESS;
+            velocity = glm::dvec3(outward.z, 0.0, -outward.x) * circular;
+            velocity += glm::dvec3(random.normal(), random.normal(), random.normal()) * (RING_DISPERSION * circular);
+            return mass;
+        });
+    }
+
+private:
+    // Appends count bodies and fills body i from stream i; sample sets the
+    // position and velocity and returns the mass. Returns the first slot.
+    template <typename Real, typename Sampler>
+    static size_t generate(BasicBodyStore<Real>& store, size_t count, uint64_t seed, double density, ThreadPool& pool,
+                         Sampler&& sample) {
+        const size_t first = store.append(count);
+        pool.parallelFor(count, GRAIN, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                CounterRandom random(seed, i);
+                glm::dvec3 position, velocity;
+                const double mass = sample(random, position, velocity);
+                store.place(first + i, position, velocity, mass, density);
+            }
+        });
+        return first;
+    }
+
+    // Subtracts the mass-weighted mean velocity of count bodies from first.
+    // Chunk sums are added in chunk order, so the shift is the same for
+    // every thread count.
+    template <typename Real>
+    static void removeMeanVelocity(BasicBodyStore<Real>& store, size_t first, size_t count, ThreadPool& pool) {
+        if (count == 0) return;
+        Real* vx = store.vx() + first;
+        Real* vy = store.vy() + first;
+        Real* vz = store.vz() + first;
+        const Real* mass = store.mass() + first;
+
+        std::vector<double> sums(4 * ((count + GRAIN - 1) / GRAIN), 0.0); // momentum x, y, z and mass per chunk
+        pool.parallelFor(count, GRAIN, [&](size_t begin, size_t end) {
+            double* sum = &sums[4 * (begin / GRAIN)];
+            for (size_t i = begin; i < end; ++i) {
+                sum[0] += double(mass[i]) * vx[i];
+                sum[1] += double(mass[i]) * vy[i];
+                sum[2] += double(mass[i]) * vz[i];
+                sum[3] += mass[i];
+            }
+        });
+        double momentumX = 0.0, momentumY = 0.0, momentumZ = 0.0, total = 0.0;
+        for (size_t c = 0; c < sums.size(); c += 4) {
+            momentumX += sums[c];
+            momentumY += sums[c + 1];
+            momentumZ += sums[c + 2];
+            total += sums[c + 3];
+        }
+        if (total <= 0.0) return;
+
+        const double meanX = momentumX / total, meanY = momentumY / total, meanZ = momentumZ / total;
+        pool.parallelFor(count, GRAIN, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                vx[i] = static_cast<Real>(vx[i] - meanX);
+                vy[i] = static_cast<Real>(vy[i] - meanY);
+                vz[i] = static_cast<Real>(vz[i] - meanZ);
+            }
+        });
+    }
+
+    // Area of a ring band, without the factor pi
+    static double bandArea(size_t b) {
+        return RING_BANDS[b].outer * RING_BANDS[b].outer - RING_BANDS[b].inner * RING_BANDS[b].inner;
+    }
+
+    // Fraction of an untruncated exponential disc's mass within x scale lengths
+    static double enclosedDiskFraction(double x) { return 1.0 - (1.0 + x) * std::exp(-x); }
+};
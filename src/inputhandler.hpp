@@ -3,29 +3,31 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
+#include <iostream>
 
 #include "../interfaces/ISimulationCallbacks.hpp"
 
 #include "camera.hpp"
 #include "physicsengine.hpp"
+#include "simulationthread.hpp"
 #include "object.hpp"
 #include "constants.hpp"
 
 class InputHandler {
 private:
     Camera& camera;
-    PhysicsEngine& physics;
+    SimulationThread& simulation; // engine changes are posted, never made here
     std::vector<std::shared_ptr<Object>>& objects;
     float& deltaTime;
     bool& running;
     ISimulationCallbacks& callbacks;
 
 public:
-    InputHandler(Camera& camera, PhysicsEngine& physics, 
+    InputHandler(Camera& camera, SimulationThread& simulation, 
                  std::vector<std::shared_ptr<Object>>& objects, 
                  float& deltaTime, bool& running,
                  ISimulationCallbacks& callbacks)
-        : camera(camera), physics(physics), objects(objects), 
+        : camera(camera), simulation(simulation), objects(objects), 
           deltaTime(deltaTime), running(running), callbacks(callbacks) {}
 
     void processInput(GLFWwindow* window) {
@@ -47,13 +49,112 @@ public:
         static bool kKeyPressed = false;
         if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS) {
             if (!kKeyPressed) {
-                physics.setPaused(!physics.isPaused());
+                simulation.post([](PhysicsEngine& physics) { physics.setPaused(!physics.isPaused()); });
                 kKeyPressed = true;
             }
         } else {
             kKeyPressed = false;
         }
         
+        // Cycle gravity solver
+        static bool bKeyPressed = false;
+        if (glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS) {
+            if (!bKeyPressed) {
+                simulation.post([](PhysicsEngine& physics) { cycleGravitySolver(physics); });
+                bKeyPressed = true;
+            }
+        } else {
+            bKeyPressed = false;
+        }
+
+        // Cycle integrator
+        static bool iKeyPressed = false;
+        if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS) {
+            if (!iKeyPressed) {
+                simulation.post([](PhysicsEngine& physics) { cycleIntegrator(physics); });
+                iKeyPressed = true;
+            }
+        } else {
+            iKeyPressed = false;
+        }
+
+        // Toggle between bouncing and merging collisions
+        static bool cKeyPressed = false;
+        if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) {
+            if (!cKeyPressed) {
+                simulation.post([](PhysicsEngine& physics) { toggleCollisionMode(physics); });
+                cKeyPressed = true;
+            }
+        } else {
+            cKeyPressed = false;
+        }
+
+        // Toggle grid displacement between the vertex shader and the CPU
+        static bool gKeyPressed = false;
+        if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS) {
+            if (!gKeyPressed) {
+                callbacks.toggleGridDisplacement();
+                gKeyPressed = true;
+            }
+        } else {
+            gKeyPressed = false;
+        }
+
+        // Save a checkpoint of the running simulation
+        static bool f5KeyPressed = false;
+        if (glfwGetKey(window, GLFW_KEY_F5) == GLFW_PRESS) {
+            if (!f5KeyPressed) {
+                callbacks.saveCheckpoint();
+                f5KeyPressed = true;
+            }
+        } else {
+            f5KeyPressed = false;
+        }
+
+        // Start or stop recording a trajectory
+        static bool f6KeyPressed = false;
+        if (glfwGetKey(window, GLFW_KEY_F6) == GLFW_PRESS) {
+            if (!f6KeyPressed) {
+                callbacks.toggleTrajectory();
+                f6KeyPressed = true;
+            }
+        } else {
+            f6KeyPressed = false;
+        }
+
+        // Dump the profiler's recent scopes as a Chrome trace
+        static bool f7KeyPressed = false;
+        if (glfwGetKey(window, GLFW_KEY_F7) == GLFW_PRESS) {
+            if (!f7KeyPressed) {
+                callbacks.dumpProfile();
+                f7KeyPressed = true;
+            }
+        } else {
+            f7KeyPressed = false;
+        }
+
+        // Print tree solver accuracy against direct summation
+        static bool mKeyPressed = false;
+        if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS) {
+            if (!mKeyPressed) {
+                simulation.post([](PhysicsEngine& physics) { printAccuracyTable(physics); });
+                mKeyPressed = true;
+            }
+        } else {
+            mKeyPressed = false;
+        }
+
+        // Print per-thread busy time of the last physics step
+        static bool tKeyPressed = false;
+        if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS) {
+            if (!tKeyPressed) {
+                simulation.post([](PhysicsEngine& physics) { printThreadTimings(physics); });
+                tKeyPressed = true;
+            }
+        } else {
+            tKeyPressed = false;
+        }
+
         // Quit
         if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) {
             running = false;
@@ -68,26 +169,26 @@ public:
             
             if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) {
                 if (!shiftPressed) {
-                    obj->setPosition(obj->getPosition() + glm::vec3(0.0f, moveStep, 0.0f));
+                    obj->move(glm::vec3(0.0f, moveStep, 0.0f));
                 } else {
-                    obj->setPosition(obj->getPosition() + glm::vec3(0.0f, 0.0f, moveStep));
+                    obj->move(glm::vec3(0.0f, 0.0f, moveStep));
                 }
             }
             
             if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS) {
                 if (!shiftPressed) {
-                    obj->setPosition(obj->getPosition() + glm::vec3(0.0f, -moveStep, 0.0f));
+                    obj->move(glm::vec3(0.0f, -moveStep, 0.0f));
                 } else {
-                    obj->setPosition(obj->getPosition() + glm::vec3(0.0f, 0.0f, -moveStep));
+                    obj->move(glm::vec3(0.0f, 0.0f, -moveStep));
                 }
             }
             
             if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) {
-                obj->setPosition(obj->getPosition() + glm::vec3(moveStep, 0.0f, 0.0f));
+                obj->move(glm::vec3(moveStep, 0.0f, 0.0f));
             }
             
             if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) {
-                obj->setPosition(obj->getPosition() + glm::vec3(-moveStep, 0.0f, 0.0f));
+                obj->move(glm::vec3(-moveStep, 0.0f, 0.0f));
             }
             
             // Increase mass when right mouse button is held
@@ -97,6 +198,88 @@ public:
         }
     }
 
+    // Engine changes, run on the simulation thread
+    static void cycleGravitySolver(PhysicsEngine& physics) {
+        switch (physics.getGravitySolver()) {
+            case GravitySolver::DirectSum:
+                physics.setGravitySolver(GravitySolver::BarnesHut);
+                std::cout << "Gravity solver: Barnes-Hut" << std::endl;
+                break;
+            case GravitySolver::BarnesHut:
+                physics.setGravitySolver(GravitySolver::FastMultipole);
+                std::cout << "Gravity solver: fast multipole" << std::endl;
+                break;
+            case GravitySolver::FastMultipole:
+                physics.setGravitySolver(GravitySolver::DirectSum);
+                std::cout << "Gravity solver: direct sum ("
+                          << GravityKernel::instructionSetName(physics.getInstructionSet()) << ")" << std::endl;
+                break;
+        }
+    }
+
+    static void cycleIntegrator(PhysicsEngine& physics) {
+        switch (physics.getIntegrator()) {
+            case Integrator::SymplecticEuler:
+                physics.setIntegrator(Integrator::Leapfrog);
+                std::cout << "Integrator: leapfrog" << std::endl;
+                break;
+            case Integrator::Leapfrog:
+                physics.setIntegrator(Integrator::Yoshida4);
+                std::cout << "Integrator: Yoshida 4th order" << std::endl;
+                break;
+            case Integrator::Yoshida4:
+                physics.setIntegrator(Integrator::Hermite);
+                std::cout << "Integrator: Hermite block steps" << std::endl;
+                break;
+            case Integrator::Hermite:
+                physics.setIntegrator(Integrator::SymplecticEuler);
+                std::cout << "Integrator: symplectic Euler" << std::endl;
+                break;
+        }
+    }
+
+    static void toggleCollisionMode(PhysicsEngine& physics) {
+        if (physics.getCollisionMode() == CollisionMode::Bounce) {
+            physics.setCollisionMode(CollisionMode::Merge);
+            std::cout << "Collisions: merge" << std::endl;
+        } else {
+            physics.setCollisionMode(CollisionMode::Bounce);
+            std::cout << "Collisions: bounce" << std::endl;
+        }
+    }
+
+    static void printAccuracyTable(PhysicsEngine& physics) {
+        const float thetas[] = {0.2f, 0.3f, 0.5f, 0.7f, 1.0f};
+        const int orders[] = {2, 4, 6};
+        float previousTheta = physics.getOpeningAngle();
+        int previousOrder = physics.getExpansionOrder();
+
+        std::cout << "Tree solvers vs direct sum (" << physics.getBodies().size() << " bodies)\n"
+                  << "  solver      theta  order  max rel err   rms rel err" << std::endl;
+        for (float theta : thetas) {
+            physics.setOpeningAngle(theta);
+            SolverAccuracy acc = physics.measureAccuracy(GravitySolver::BarnesHut);
+            std::cout << "  Barnes-Hut  " << theta << "\t-\t" << acc.maxRelativeError << "\t" << acc.rmsRelativeError << std::endl;
+        }
+        physics.setOpeningAngle(previousTheta);
+        for (int order : orders) {
+            physics.setExpansionOrder(order);
+            SolverAccuracy acc = physics.measureAccuracy(GravitySolver::FastMultipole);
+            std::cout << "  FMM         " << physics.getMultipoleOpeningAngle() << "\t" << order << "\t"
+                      << acc.maxRelativeError << "\t" << acc.rmsRelativeError << std::endl;
+        }
+        physics.setExpansionOrder(previousOrder);
+    }
+
+    static void printThreadTimings(const PhysicsEngine& physics) {
+        std::vector<ThreadPool::ThreadTiming> timings = physics.getThreadTimings();
+        std::cout << "Physics threads (" << timings.size() << "), last step\n"
+                  << "  thread  busy ms   tasks" << std::endl;
+        for (size_t t = 0; t < timings.size(); ++t) {
+            std::cout << "  " << t << "\t" << timings[t].busySeconds * 1000.0 << "\t" << timings[t].tasks << std::endl;
+        }
+    }
+
     // Static callback functions
     static void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
         auto* callbacks = static_cast<ISimulationCallbacks*>(glfwGetWindowUserPointer(window));
@@ -1,9 +1,9 @@
 #include "simulation_app.hpp"
 
-int main() {
+int main(int argc, char** argv) {
     SimulationApp app;
     
-    if (!app.initialize()) {
+    if (!app.initialize(argc > 1 ? argv[1] : "default")) {
         return -1;
     }
     
@@ -3,159 +3,139 @@
 #include <vector>
 
 #include "../interfaces/IPhysicsObject.hpp"
-#include "../interfaces/IDrawable.hpp"
 
 #include "./constants.hpp"
-#include "../src/utils.hpp"
+#include "./bodystore.hpp"
+#include "./simulationthread.hpp"
 
-class Object : public IDrawable, public IPhysicsObject {
+// A body as the app sees it: reads come from the latest snapshot the
+// simulation thread published, changes are posted to it as commands. The
+// sphere itself is the Renderer's shared instanced mesh.
+class Object : public IPhysicsObject {
 private:
-    GLuint VAO, VBO;
-    glm::vec3 position;
-    glm::vec3 velocity;
-    glm::vec3 lastPosition;
+    // A body whose add command has not reached a snapshot yet, with the
+    // changes posted since applied
+    struct Pending {
+        glm::vec3 position;
+        glm::vec3 velocity;
+        float mass;
+        float density;
+    };
+
+    SimulationThread& simulation;
+    BodyId id;
     glm::vec4 color;
-    float mass;
-    float density;
-    float radius;
-    size_t vertexCount;
-    bool initializing;
     bool launched;
+    bool initializing; // as last requested, the snapshot may lag behind
     bool isGlowing;
+    bool hasPending;
+    Pending pending;
 
 public:
-    Object(const glm::vec3& initPosition, 
-           const glm::vec3& initVelocity, 
-           float mass, 
-           float density = 3344.0f, 
+    Object(SimulationThread& simulation,
+           BodyId id,
            const glm::vec4& color = glm::vec4(1.0f, 0.0f, 0.0f, 1.0f),
-           bool glow = false) 
-        : position(initPosition),
-          velocity(initVelocity),
-          lastPosition(initPosition),
+           bool glow = false,
+           bool initializing = false)
+        : simulation(simulation),
+          id(id),
           color(color),
-          mass(mass),
-          density(density),
-          initializing(false),
           launched(false),
-          isGlowing(glow) {
-        
-        updateRadius();
-        std::vector<float> vertices = generateVertices();
-        vertexCount = vertices.size();
-        Utils::createVBOVAO(VAO, VBO, vertices.data(), vertexCount);
-    }
+          initializing(initializing),
+          isGlowing(glow),
+          hasPending(false),
+          pending{glm::vec3(0.0f), glm::vec3(0.0f), 0.0f, 1.0f} {}
 
-    ~Object() {
-        glDeleteVertexArrays(1, &VAO);
-        glDeleteBuffers(1, &VBO);
+    // Values the getters report until the body reaches a snapshot, taken
+    // from the add command posted for it
+    void setPendingAdd(const glm::vec3& position, const glm::vec3& velocity, float mass, float density) {
+        pending = {position, velocity, mass, density};
+        hasPending = true;
     }
 
-    // IDrawable implementation
-    void draw(const ShaderProgram& shader) const override {
-        shader.setVec4("objectColor", color);
-        shader.setBool("isGrid", false);
-        shader.setBool("GLOW", isGlowing);
-        
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, position);
-        shader.setMat4("model", model);
-        
-        glBindVertexArray(VAO);
-        glDrawArrays(GL_TRIANGLES, 0, vertexCount / 3);
-        glBindVertexArray(0);
+    // Position blended between the last two physics steps, see BodyStore
+    glm::vec3 getDisplayPosition(float blend) const {
+        return exists() ? bodies().getDisplayPosition(id, blend) : getPosition();
     }
 
-    // IPhysicsObject implementation
-    void updatePhysics(float deltaTime) override {
-        if (!initializing) {
-            position += velocity * (deltaTime / 94.0f);
-        }
+    // IPhysicsObject implementation; until the body reaches a snapshot the
+    // getters report its pending add, or zero if there is none
+    glm::vec3 getPosition() const override {
+        return exists() ? bodies().getPosition(id) : awaited() ? pending.position : glm::vec3(0.0f);
+    }
+    glm::vec3 getVelocity() const override {
+        return exists() ? bodies().getVelocity(id) : awaited() ? pending.velocity : glm::vec3(0.0f);
+    }
+    float getMass() const override { return exists() ? bodies().getMass(id) : awaited() ? pending.mass : 0.0f; }
+    float getRadius() const override {
+        if (exists()) return bodies().getRadius(id);
+        return awaited() ? BodyStore::computeRadius(pending.mass, pending.density) : 0.0f;
     }
 
-    glm::vec3 getPosition() const override { return position; }
-    glm::vec3 getVelocity() const override { return velocity; }
-    float getMass() const override { return mass; }
-    float getRadius() const override { return radius; }
-    
-    void setVelocity(const glm::vec3& vel) override { velocity = vel; }
-    
-    void accelerate(const glm::vec3& acc) override {
-        velocity += acc / 96.0f;
+    void setVelocity(const glm::vec3& vel) override {
+        if (awaited()) pending.velocity = vel;
+        post([vel](BodyStore& store, BodyId target) { store.setVelocity(target, vel); });
     }
 
     // Object-specific methods
-    void setPosition(const glm::vec3& pos) { position = pos; }
-    void setMass(float newMass) { 
-        mass = newMass; 
-        updateRadius();
-        updateVertices();
+    BodyId getId() const { return id; }
+
+    // Whether the current snapshot holds the body
+    bool exists() const { return bodies().contains(id); }
+
+    // False once the body has been merged into another; a body still on
+    // its way to the simulation thread counts as alive
+    bool isAlive() const { return id >= bodies().nextId() || bodies().contains(id); }
+
+    void setPosition(const glm::vec3& pos) {
+        if (awaited()) pending.position = pos;
+        post([pos](BodyStore& store, BodyId target) { store.setPosition(target, pos); });
+    }
+
+    // Relative, so moves posted before the snapshot catches up all add up
+    void move(const glm::vec3& offset) {
+        if (awaited()) pending.position += offset;
+        post([offset](BodyStore& store, BodyId target) {
+            store.setPosition(target, store.getPosition(target) + offset);
+        });
+    }
+
+    void setMass(float newMass) {
+        if (awaited()) pending.mass = newMass;
+        post([newMass](BodyStore& store, BodyId target) { store.setMass(target, newMass); });
     }
-    
+
     void increaseMass(float factor) {
-        mass *= factor;
-        updateRadius();
-        updateVertices();
+        if (awaited()) pending.mass *= factor;
+        post([factor](BodyStore& store, BodyId target) { store.setMass(target, store.getMass(target) * factor); });
     }
-    
+
     bool isInitializing() const { return initializing; }
-    void setInitializing(bool init) { initializing = init; }
-    
+    void setInitializing(bool init) {
+        initializing = init;
+        post([init](BodyStore& store, BodyId target) { store.setInitializing(target, init); });
+    }
+
     bool isLaunched() const { return launched; }
     void setLaunched(bool launch) { launched = launch; }
-    
+
     const glm::vec4& getColor() const { return color; }
-    
-    float checkCollision(const Object& other) const {
-        float distance = glm::length(other.position - position);
-        if (other.radius + radius > distance) {
-            return -0.2f; // Collision occurred, return bounce factor
-        }
-        return 1.0f; // No collision
-    }
+    bool isGlowingBody() const { return isGlowing; }
 
 private:
-    void updateRadius() {
-        radius = pow(((3.0f * mass / density) / (4.0f * Constants::PI)), (1.0f/3.0f)) / Constants::SIZE_RATIO;
-    }
-    
-    void updateVertices() {
-        std::vector<float> vertices = generateVertices();
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
-    }
-    
-    std::vector<float> generateVertices() const {
-        std::vector<float> vertices;
-        int stacks = 10;
-        int sectors = 10;
-
-        // Generate sphere vertices
-        for (float i = 0.0f; i <= stacks; ++i) {
-            float theta1 = (i / stacks) * glm::pi<float>();
-            float theta2 = (i+1) / stacks * glm::pi<float>();
-            
-            for (float j = 0.0f; j < sectors; ++j) {
-                float phi1 = j / sectors * 2 * glm::pi<float>();
-                float phi2 = (j+1) / sectors * 2 * glm::pi<float>();
-                
-                glm::vec3 v1 = Utils::sphericalToCartesian(radius, theta1, phi1);
-                glm::vec3 v2 = Utils::sphericalToCartesian(radius, theta1, phi2);
-                glm::vec3 v3 = Utils::sphericalToCartesian(radius, theta2, phi1);
-                glm::vec3 v4 = Utils::sphericalToCartesian(radius, theta2, phi2);
-
-                // Triangle 1: v1-v2-v3
-                vertices.insert(vertices.end(), {v1.x, v1.y, v1.z});
-                vertices.insert(vertices.end(), {v2.x, v2.y, v2.z});
-                vertices.insert(vertices.end(), {v3.x, v3.y, v3.z});
-                
-                // Triangle 2: v2-v4-v3
-                vertices.insert(vertices.end(), {v2.x, v2.y, v2.z});
-                vertices.insert(vertices.end(), {v4.x, v4.y, v4.z});
-                vertices.insert(vertices.end(), {v3.x, v3.y, v3.z});
-            }
-        }
-        
-        return vertices;
+    const BodyStore& bodies() const { return simulation.getSnapshot(); }
+
+    // Whether the getters should report the pending add
+    bool awaited() const { return hasPending && !exists(); }
+
+    // Runs a change to this body on the simulation thread, unless it was
+    // merged away in the meantime
+    template <typename Change>
+    void post(Change change) {
+        BodyId target = id;
+        simulation.post([target, change](PhysicsEngine& physics) {
+            BodyStore& store = physics.getBodies();
+            if (store.contains(target)) change(store, target);
+        });
     }
 };
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "bodystore.hpp"
+
+struct OctreeNode {
+    float centerX, centerY, centerZ;
+    float halfSize;
+    float comX, comY, comZ;
+    float mass;
+    float radius;        // distance from the center of mass to the farthest body
+    uint32_t firstChild; // children are stored contiguously, 0 for leaves
+    uint32_t childCount;
+    uint32_t begin, end; // range into Octree::getOrder()
+};
+
+// Flat octree rebuilt from a BodyStore every step. Bodies are sorted into an
+// index permutation so every node covers one contiguous range of it, and
+// their positions and masses are copied out in that order, so a node's
+// bodies can be streamed without going through the permutation.
+class Octree {
+private:
+    std::vector<OctreeNode> nodes;
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> scratch;
+    std::vector<float> sortedX, sortedY, sortedZ, sortedMass;
+    const BodyStore* bodies;
+    uint32_t leafCapacity;
+
+    static constexpr int MAX_DEPTH = 32;
+
+public:
+    explicit Octree(uint32_t leafCapacity = 8) : bodies(nullptr), leafCapacity(leafCapacity) {}
+
+    void setLeafCapacity(uint32_t capacity) { leafCapacity = std::max(1u, capacity); }
+    uint32_t getLeafCapacity() const { return leafCapacity; }
+
+    const std::vector<OctreeNode>& getNodes() const { return nodes; }
+    const std::vector<uint32_t>& getOrder() const { return order; }
+    bool empty() const { return nodes.empty(); }
+
+    // Body k of getOrder(), for k in a node's [begin, end)
+    const float* x() const { return sortedX.data(); }
+    const float* y() const { return sortedY.data(); }
+    const float* z() const { return sortedZ.data(); }
+    const float* mass() const { return sortedMass.data(); }
+
+    // Bodies still being initialized exert no gravity and are left out
+    void build(const BodyStore& store) {
+        bodies = &store;
+        nodes.clear();
+        order.clear();
+
+        const size_t count = store.size();
+        const float* x = store.x();
+        const float* y = store.y();
+        const float* z = store.z();
+        const uint8_t* initializing = store.initializing();
+
+        float minX = 0.0f, minY = 0.0f, minZ = 0.0f;
+        float maxX = 0.0f, maxY = 0.0f, maxZ = 0.0f;
+        for (size_t i = 0; i < count; ++i) {
+            if (initializing[i]) continue;
+            if (order.empty()) {
+                minX = maxX = x[i];
+                minY = maxY = y[i];
+                minZ = maxZ = z[i];
+            }
+            minX = std::min(minX, x[i]); maxX = std::max(maxX, x[i]);
+            minY = std::min(minY, y[i]); maxY = std::max(maxY, y[i]);
+            minZ = std::min(minZ, z[i]); maxZ = std::max(maxZ, z[i]);
+            order.push_back(static_cast<uint32_t>(i));
+        }
+        if (order.empty()) return;
+
+        scratch.resize(order.size());
+        float halfSize = 0.5f * std::max({maxX - minX, maxY - minY, maxZ - minZ});
+        halfSize = halfSize * 1.001f + 1.0e-3f;
+
+        OctreeNode root = {};
+        root.centerX = 0.5f * (minX + maxX);
+        root.centerY = 0.5f * (minY + maxY);
+        root.centerZ = 0.5f * (minZ + maxZ);
+        root.halfSize = halfSize;
+        root.begin = 0;
+        root.end = static_cast<uint32_t>(order.size());
+        nodes.push_back(root);
+        buildNode(0, 0);
+
+        const float* mass = store.mass();
+        sortedX.resize(order.size());
+        sortedY.resize(order.size());
+        sortedZ.resize(order.size());
+        sortedMass.resize(order.size());
+        for (size_t k = 0; k < order.size(); ++k) {
+            sortedX[k] = x[order[k]];
+            sortedY[k] = y[order[k]];
+            sortedZ[k] = z[order[k]];
+            sortedMass[k] = mass[order[k]];
+        }
+    }
+
+private:
+    void buildNode(uint32_t nodeIndex, int depth) {
+        const float* x = bodies->x();
+        const float* y = bodies->y();
+        const float* z = bodies->z();
+        const float* mass = bodies->mass();
+
+        OctreeNode node = nodes[nodeIndex];
+        uint32_t count = node.end - node.begin;
+
+        if (count <= leafCapacity || depth >= MAX_DEPTH) {
+            double m = 0.0, cx = 0.0, cy = 0.0, cz = 0.0;
+            for (uint32_t k = node.begin; k < node.end; ++k) {
+                uint32_t i = order[k];
+                m += mass[i];
+                cx += double(mass[i]) * x[i];
+                cy += double(mass[i]) * y[i];
+                cz += double(mass[i]) * z[i];
+            }
+            finishNode(nodeIndex, m, cx, cy, cz, count);
+
+            OctreeNode& leaf = nodes[nodeIndex];
+            float radiusSq = 0.0f;
+            for (uint32_t k = leaf.begin; k < leaf.end; ++k) {
+                uint32_t i = order[k];
+                float dx = x[i] - leaf.comX, dy = y[i] - leaf.comY, dz = z[i] - leaf.comZ;
+                radiusSq = std::max(radiusSq, dx * dx + dy * dy + dz * dz);
+            }
+            leaf.radius = std::sqrt(radiusSq);
+            return;
+        }
+
+        // Counting sort of the node's bodies into octants
+        uint32_t octantCount[8] = {};
+        for (uint32_t k = node.begin; k < node.end; ++k) {
+            uint32_t i = order[k];
+            ++octantCount[octantOf(node, x[i], y[i], z[i])];
+        }
+        uint32_t octantStart[8];
+        uint32_t offset = node.begin;
+        for (int o = 0; o < 8; ++o) {
+            octantStart[o] = offset;
+            offset += octantCount[o];
+        }
+        uint32_t cursor[8];
+        std::copy(octantStart, octantStart + 8, cursor);
+        for (uint32_t k = node.begin; k < node.end; ++k) {
+            uint32_t i = order[k];
+            scratch[cursor[octantOf(node, x[i], y[i], z[i])]++] = i;
+        }
+        std::copy(scratch.begin() + node.begin, scratch.begin() + node.end, order.begin() + node.begin);
+
+        uint32_t firstChild = static_cast<uint32_t>(nodes.size());
+        uint32_t childCount = 0;
+        float childHalf = node.halfSize * 0.5f;
+        for (int o = 0; o < 8; ++o) {
+            if (octantCount[o] == 0) continue;
+            OctreeNode child = {};
+            child.centerX = node.centerX + ((o & 1) ? childHalf : -childHalf);
+            child.centerY = node.centerY + ((o & 2) ? childHalf : -childHalf);
+            child.centerZ = node.centerZ + ((o & 4) ? childHalf : -childHalf);
+            child.halfSize = childHalf;
+            child.begin = octantStart[o];
+            child.end = octantStart[o] + octantCount[o];
+            nodes.push_back(child);
+            ++childCount;
+        }
+        nodes[nodeIndex].firstChild = firstChild;
+        nodes[nodeIndex].childCount = childCount;
+
+        double m = 0.0, cx = 0.0, cy = 0.0, cz = 0.0;
+        for (uint32_t c = firstChild; c < firstChild + childCount; ++c) {
+            buildNode(c, depth + 1);
+            const OctreeNode& child = nodes[c];
+            m += child.mass;
+            cx += double(child.mass) * child.comX;
+            cy += double(child.mass) * child.comY;
+            cz += double(child.mass) * child.comZ;
+        }
+        finishNode(nodeIndex, m, cx, cy, cz, count);
+
+        OctreeNode& parent = nodes[nodeIndex];
+        float radius = 0.0f;
+        for (uint32_t c = firstChild; c < firstChild + childCount; ++c) {
+            const OctreeNode& child = nodes[c];
+            float dx = child.comX - parent.comX, dy = child.comY - parent.comY, dz = child.comZ - parent.comZ;
+            radius = std::max(radius, std::sqrt(dx * dx + dy * dy + dz * dz) + child.radius);
+        }
+        parent.radius = radius;
+    }
+
+    void finishNode(uint32_t nodeIndex, double m, double cx, double cy, double cz, uint32_t count) {
+        OctreeNode& node = nodes[nodeIndex];
+        node.mass = static_cast<float>(m);
+        if (m > 0.0) {
+            node.comX = static_cast<float>(cx / m);
+            node.comY = static_cast<float>(cy / m);
+            node.comZ = static_cast<float>(cz / m);
+        } else {
+            // Massless bodies only: fall back to the geometric centroid
+            const float* x = bodies->x();
+            const float* y = bodies->y();
+            const float* z = bodies->z();
+            double sx = 0.0, sy = 0.0, sz = 0.0;
+            for (uint32_t k = node.begin; k < node.end; ++k) {
+                sx += x[order[k]];
+                sy += y[order[k]];
+                sz += z[order[k]];
+            }
+            node.comX = static_cast<float>(sx / count);
+            node.comY = static_cast<float>(sy / count);
+            node.comZ = static_cast<float>(sz / count);
+        }
+    }
+
+    static int octantOf(const OctreeNode& node, float px, float py, float pz) {
+        return (px >= node.centerX ? 1 : 0) | (py >= node.centerY ? 2 : 0) | (pz >= node.centerZ ? 4 : 0);
+    }
+};
@@ -1,68 +1,635 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
 #include <vector>
-#include <memory>
 #include <glm/glm.hpp>
 
 #include "constants.hpp"
-#include "object.hpp"
+#include "bodystore.hpp"
+#include "barneshut.hpp"
+#include "broadphase.hpp"
+#include "fmm.hpp"
+#include "gravitykernel.hpp"
+#include "hermite.hpp"
+#include "profiler.hpp"
+#include "threadpool.hpp"
+
+enum class GravitySolver {
+    DirectSum,
+    BarnesHut,
+    FastMultipole
+};
+
+// Leapfrog is kick-drift-kick. Yoshida4 chains three leapfrog steps into a
+// fourth-order symplectic step. SymplecticEuler is the original
+// drift-then-kick update, kept for comparison. Hermite gives every body its
+// own block step and always uses direct summation.
+enum class Integrator {
+    SymplecticEuler,
+    Leapfrog,
+    Yoshida4,
+    Hermite
+};
+
+// Bounce flips and damps the velocity of touching bodies. Merge combines
+// them into one body that keeps their mass and momentum.
+enum class CollisionMode {
+    Bounce,
+    Merge
+};
+
+// Relative acceleration error of a solver against direct summation
+struct SolverAccuracy {
+    double maxRelativeError;
+    double rmsRelativeError;
+    double meanRelativeError;
+};
+
+// The engine is compiled once per precision. PhysicsEngine (float) runs the
+// windowed app and everything that saves or draws bodies; DoublePhysicsEngine
+// is for validation runs. Integrator, solver and collision mode are template
+// arguments of the step that runs them, so each combination is its own
+// inlined loop nest and the runtime settings only pick which one a step
+// calls. The tree solvers are single precision only.
+template <typename Real>
+class BasicPhysicsEngine {
+public:
+    // Whether Barnes-Hut and FMM are available; without them every solver
+    // setting falls back to direct summation
+    static constexpr bool TREE_SOLVERS = std::is_same<Real, float>::value;
 
-class PhysicsEngine {
 private:
+    // Bodies handed to one force or collision task
+    static constexpr size_t TILE_SIZE = 64;
+    // Bodies handed to one drift or kick task
+    static constexpr size_t STREAM_SIZE = 4096;
+    // Fixed steps one update may take before the backlog is dropped
+    static constexpr int MAX_SUBSTEPS = 8;
+
     bool paused;
+    ThreadPool pool;
+    BasicBodyStore<Real> bodies;
+    GravitySolver solver;
+    Integrator integrator;
+    CollisionMode collisionMode;
+    Real fixedStep;   // wall-clock seconds per step
+    Real accumulator; // wall-clock time not yet simulated
+    double simulationTime; // simulation units advanced
+    uint64_t stepCount;
+    bool forcesValid;  // the store's accelerations match its positions
+    uint64_t forceRevision;
+    size_t forceEvaluations;
+    BarnesHut barnesHut;
+    FastMultipole fastMultipole;
+    BasicGravityKernel<Real> directKernel;
+    HermiteIntegrator hermite;
+    BasicSweepAndPrune<Real> broadPhase;
+    std::vector<CollisionPair> contacts;
+    std::vector<uint16_t> contactCounts;
+    std::vector<Real> impactTimes; // earliest contact as a fraction of the step
+    std::vector<uint32_t> mergedInto; // slot each body was absorbed by, itself if none
+    std::vector<uint8_t> absorbed;
+    size_t mergeCount;
+    std::vector<Real> gravitatingMass; // G * mass, zero for bodies still being initialized
 
 public:
-    PhysicsEngine() : paused(true) {}
+    BasicPhysicsEngine()
+        : paused(true), solver(GravitySolver::DirectSum), integrator(Integrator::Leapfrog),
+          collisionMode(CollisionMode::Bounce),
+          fixedStep(Real(1) / Real(60)), accumulator(0), simulationTime(0.0), stepCount(0), forcesValid(false), forceRevision(0),
+          forceEvaluations(0), mergeCount(0) {
+        setSoftening(Constants::SOFTENING_LENGTH);
+    }
 
     void setPaused(bool pause) { paused = pause; }
     bool isPaused() const { return paused; }
 
-    void update(std::vector<std::shared_ptr<Object>>& objects, float deltaTime) {
-        if (paused) return;
-        
-        // Apply gravitational forces between objects
-        for (size_t i = 0; i < objects.size(); ++i) {
-            auto& obj1 = objects[i];
-            
-            // Skip objects that are being initialized
-            if (obj1->isInitializing()) continue;
-            
-            // Update position based on velocity
-            obj1->updatePhysics(deltaTime);
-            
-            // Apply gravitational forces from other objects
-            for (size_t j = 0; j < objects.size(); ++j) {
-                if (i == j) continue;
-                
-                auto& obj2 = objects[j];
-                if (obj2->isInitializing()) continue;
-                
-                applyGravitationalForce(obj1, obj2);
-                
-                // Check for collisions
-                float collisionFactor = obj1->checkCollision(*obj2);
-                if (collisionFactor < 1.0f) {
-                    obj1->setVelocity(obj1->getVelocity() * collisionFactor);
+    void setGravitySolver(GravitySolver s) {
+        solver = TREE_SOLVERS ? s : GravitySolver::DirectSum;
+        forcesValid = false;
+    }
+    GravitySolver getGravitySolver() const { return solver; }
+
+    void setIntegrator(Integrator i) {
+        integrator = i;
+        forcesValid = false;
+        hermite.invalidate();
+    }
+    Integrator getIntegrator() const { return integrator; }
+
+    void setCollisionMode(CollisionMode mode) { collisionMode = mode; }
+    CollisionMode getCollisionMode() const { return collisionMode; }
+
+    // Aarseth accuracy parameter of the Hermite block steps
+    void setHermiteAccuracy(double eta) { hermite.setAccuracy(eta); }
+    double getHermiteAccuracy() const { return hermite.getAccuracy(); }
+
+    // Per-body force evaluations during the last step; a full direct or tree
+    // evaluation counts every body once, a Hermite block only its members
+    size_t getForceEvaluations() const { return forceEvaluations; }
+
+    // Broad-phase candidates and touching pairs found by the last step
+    size_t getCandidatePairCount() const { return broadPhase.getPairs().size(); }
+    size_t getContactCount() const { return contacts.size(); }
+
+    // Bodies absorbed into others by the last step in merge mode
+    size_t getMergeCount() const { return mergeCount; }
+
+    // Simulation advances in steps of this many wall-clock seconds,
+    // independent of the frame rate
+    void setFixedTimeStep(Real seconds) { fixedStep = std::max(Real(1.0e-6), seconds); }
+    Real getFixedTimeStep() const { return fixedStep; }
+
+    void setOpeningAngle(float theta) {
+        barnesHut.setOpeningAngle(theta);
+        forcesValid = false;
+    }
+    float getOpeningAngle() const { return barnesHut.getOpeningAngle(); }
+
+    // FMM acceptance is (r_A + r_B) < theta * distance, so it is not
+    // interchangeable with the Barnes-Hut cell-size angle
+    void setMultipoleOpeningAngle(float theta) {
+        fastMultipole.setOpeningAngle(theta);
+        forcesValid = false;
+    }
+    float getMultipoleOpeningAngle() const { return fastMultipole.getOpeningAngle(); }
+
+    void setExpansionOrder(int order) {
+        fastMultipole.setOrder(order);
+        forcesValid = false;
+    }
+    int getExpansionOrder() const { return fastMultipole.getOrder(); }
+
+    // Plummer softening length of every solver, in store units
+    void setSoftening(Real epsilon) {
+        directKernel.setSoftening(epsilon);
+        barnesHut.setSoftening(static_cast<float>(epsilon));
+        fastMultipole.setSoftening(static_cast<float>(epsilon));
+        forcesValid = false;
+        hermite.invalidate();
+    }
+    Real getSoftening() const { return directKernel.getSoftening(); }
+
+    // Defaults to the widest vector unit the CPU supports
+    void setInstructionSet(GravityKernel::InstructionSet set) {
+        directKernel.setInstructionSet(set);
+        barnesHut.setInstructionSet(set);
+        fastMultipole.setInstructionSet(set);
+    }
+    GravityKernel::InstructionSet getInstructionSet() const { return directKernel.getInstructionSet(); }
+
+    // Includes the thread calling update(); results are identical for any count
+    void setThreadCount(size_t threads) { pool.setThreadCount(threads); }
+    size_t getThreadCount() const { return pool.getThreadCount(); }
+
+    // Busy time per thread during the last step; entry 0 is the caller
+    std::vector<ThreadPool::ThreadTiming> getThreadTimings() const { return pool.getTimings(); }
+
+    ThreadPool& getThreadPool() { return pool; }
+
+    // Simulation time units advanced and fixed steps taken
+    double getSimulationTime() const { return simulationTime; }
+    uint64_t getStepCount() const { return stepCount; }
+
+    // Whether the store's accelerations (and for Hermite its jerks and block
+    // steps) belong to its current positions
+    bool hasCurrentForces() const { return forcesValid && forceRevision == bodies.getRevision(); }
+    bool hasCurrentHermiteState() const { return hermite.isCurrent(bodies.getRevision()); }
+
+    // Takes over a store whose columns were restored wholesale, so the next
+    // step continues exactly where the saved run left off
+    void resumeState(double time, uint64_t steps, bool forcesCurrent, bool hermiteCurrent) {
+        simulationTime = time;
+        stepCount = steps;
+        accumulator = 0;
+        forcesValid = forcesCurrent;
+        forceRevision = bodies.getRevision();
+        if (hermiteCurrent) {
+            hermite.resume(bodies.getRevision());
+        } else {
+            hermite.invalidate();
+        }
+    }
+
+    // Takes over every setting of an engine of any precision; bodies, time
+    // and cached forces are left alone
+    template <typename Other>
+    void copySettings(const BasicPhysicsEngine<Other>& other) {
+        paused = other.isPaused();
+        setGravitySolver(other.getGravitySolver());
+        setIntegrator(other.getIntegrator());
+        setCollisionMode(other.getCollisionMode());
+        setHermiteAccuracy(other.getHermiteAccuracy());
+        setFixedTimeStep(static_cast<Real>(other.getFixedTimeStep()));
+        setOpeningAngle(other.getOpeningAngle());
+        setMultipoleOpeningAngle(other.getMultipoleOpeningAngle());
+        setExpansionOrder(other.getExpansionOrder());
+        setSoftening(static_cast<Real>(other.getSoftening()));
+        setInstructionSet(other.getInstructionSet());
+        setThreadCount(other.getThreadCount());
+    }
+
+    BasicBodyStore<Real>& getBodies() { return bodies; }
+    const BasicBodyStore<Real>& getBodies() const { return bodies; }
+
+    // Banks the frame time and runs as many fixed steps as it covers. A
+    // frame too slow to catch up drops the rest of its backlog. Returns the
+    // number of steps taken.
+    int update(float deltaTime) {
+        if (paused) return 0;
+        PROFILE_SCOPE("physics update");
+
+        accumulator += deltaTime;
+        int steps = 0;
+        while (accumulator >= fixedStep && steps < MAX_SUBSTEPS) {
+            step(fixedStep);
+            accumulator -= fixedStep;
+            ++steps;
+        }
+        if (accumulator >= fixedStep) {
+            accumulator = 0;
+        }
+        return steps;
+    }
+
+    // Wall-clock time update() must bank before it takes another step
+    float timeUntilNextStep() const {
+        return static_cast<float>(paused ? fixedStep : std::max(Real(0), fixedStep - accumulator));
+    }
+
+    // Advances the simulation by exactly one step of the given wall-clock length
+    void step(Real seconds) {
+        PROFILE_SCOPE("physics step");
+        pool.resetTimings();
+        forceEvaluations = 0;
+        mergeCount = 0;
+        const Real h = seconds / Real(Constants::TIME_SCALE);
+        const size_t count = bodies.size();
+        std::copy(bodies.x(), bodies.x() + count, bodies.previousX());
+        std::copy(bodies.y(), bodies.y() + count, bodies.previousY());
+        std::copy(bodies.z(), bodies.z() + count, bodies.previousZ());
+
+        (this->*stepFunction(integrator, solver))(h);
+
+        // Check for collisions; a bounce or merge moves bodies, so cached
+        // forces and Hermite jerks are stale
+        const bool moved = collisionMode == CollisionMode::Merge ? resolveCollisions<CollisionMode::Merge>()
+                                                                 : resolveCollisions<CollisionMode::Bounce>();
+        if (moved) {
+            forcesValid = false;
+            hermite.invalidate();
+        }
+        simulationTime += h;
+        ++stepCount;
+    }
+
+    // Kinetic plus softened pairwise potential energy in simulation units,
+    // summed in double precision; O(N^2), meant for diagnostics
+    double computeEnergy() {
+        const size_t count = bodies.size();
+        const Real* x = bodies.x();
+        const Real* y = bodies.y();
+        const Real* z = bodies.z();
+        const Real* vx = bodies.vx();
+        const Real* vy = bodies.vy();
+        const Real* vz = bodies.vz();
+        const Real* mass = bodies.mass();
+        const uint8_t* initializing = bodies.initializing();
+        const double G = gravitationalConstant();
+        const double softeningSq = double(getSoftening()) * getSoftening();
+
+        std::vector<double> partial(count, 0.0);
+        pool.parallelFor(count, TILE_SIZE, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                if (initializing[i]) continue;
+                double energy = 0.5 * mass[i] * (double(vx[i]) * vx[i] + double(vy[i]) * vy[i] + double(vz[i]) * vz[i]);
+                for (size_t j = i + 1; j < count; ++j) {
+                    if (initializing[j]) continue;
+                    double dx = double(x[j]) - x[i];
+                    double dy = double(y[j]) - y[i];
+                    double dz = double(z[j]) - z[i];
+                    double distSq = dx * dx + dy * dy + dz * dz;
+                    if (distSq <= 0.0) continue;
+                    energy -= G * mass[i] * mass[j] / std::sqrt(distSq + softeningSq);
                 }
+                partial[i] = energy;
             }
+        });
+
+        double total = 0.0;
+        for (double e : partial) total += e;
+        return total;
+    }
+
+    // Compares the given solver, with its current opening angle and expansion
+    // order, against direct summation without advancing the simulation
+    SolverAccuracy measureAccuracy(GravitySolver candidate) {
+        const size_t count = bodies.size();
+        std::vector<Real> reference(3 * count), approx(3 * count);
+        computeAccelerations(GravitySolver::DirectSum, reference.data(), reference.data() + count, reference.data() + 2 * count);
+        computeAccelerations(candidate, approx.data(), approx.data() + count, approx.data() + 2 * count);
+
+        SolverAccuracy result = {0.0, 0.0, 0.0};
+        const uint8_t* initializing = bodies.initializing();
+        size_t samples = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (initializing[i]) continue;
+            glm::dvec3 ref(reference[i], reference[count + i], reference[2 * count + i]);
+            glm::dvec3 err = glm::dvec3(approx[i], approx[count + i], approx[2 * count + i]) - ref;
+            double refLength = glm::length(ref);
+            if (refLength <= 0.0) continue;
+
+            double relative = glm::length(err) / refLength;
+            result.maxRelativeError = std::max(result.maxRelativeError, relative);
+            result.rmsRelativeError += relative * relative;
+            result.meanRelativeError += relative;
+            ++samples;
+        }
+        if (samples > 0) {
+            result.rmsRelativeError = std::sqrt(result.rmsRelativeError / samples);
+            result.meanRelativeError /= samples;
         }
+        return result;
     }
 
 private:
-    void applyGravitationalForce(std::shared_ptr<Object>& obj1, std::shared_ptr<Object>& obj2) {
-        glm::vec3 direction = obj2->getPosition() - obj1->getPosition();
-        float distance = glm::length(direction);
-        
-        if (distance > 0) {
-            direction = glm::normalize(direction);
-            distance *= 1000.0f; // Convert to meters
-            
-            // Calculate gravitational force
-            double force = (Constants::G * obj1->getMass() * obj2->getMass()) / (distance * distance);
-            float acceleration = force / obj1->getMass();
-            
-            // Apply acceleration
-            obj1->accelerate(direction * acceleration);
-        }
-    }
-};
\ No newline at end of file
+    using StepFunction = void (BasicPhysicsEngine::*)(Real);
+
+    static Real gravitationalConstant() { return static_cast<Real>(Constants::SIMULATION_G); }
+
+    // The compiled step for an integrator and solver; Hermite always sums
+    // directly, so it has one
+    static StepFunction stepFunction(Integrator method, GravitySolver forces) {
+        switch (method) {
+            case Integrator::SymplecticEuler:
+                return stepFor<Integrator::SymplecticEuler>(forces);
+            case Integrator::Yoshida4:
+                return stepFor<Integrator::Yoshida4>(forces);
+            case Integrator::Hermite:
+                return &BasicPhysicsEngine::advance<Integrator::Hermite, GravitySolver::DirectSum>;
+            case Integrator::Leapfrog:
+            default:
+                return stepFor<Integrator::Leapfrog>(forces);
+        }
+    }
+
+    template <Integrator Method>
+    static StepFunction stepFor(GravitySolver forces) {
+        if constexpr (TREE_SOLVERS) {
+            if (forces == GravitySolver::BarnesHut) return &BasicPhysicsEngine::advance<Method, GravitySolver::BarnesHut>;
+            if (forces == GravitySolver::FastMultipole) return &BasicPhysicsEngine::advance<Method, GravitySolver::FastMultipole>;
+        }
+        return &BasicPhysicsEngine::advance<Method, GravitySolver::DirectSum>;
+    }
+
+    template <Integrator Method, GravitySolver Forces>
+    void advance(Real h) {
+        if constexpr (Method == Integrator::SymplecticEuler) {
+            drift(h);
+            computeForces<Forces>();
+            kick(h);
+        } else if constexpr (Method == Integrator::Yoshida4) {
+            const double cbrt2 = std::cbrt(2.0);
+            const Real outer = static_cast<Real>(1.0 / (2.0 - cbrt2));
+            const Real inner = static_cast<Real>(-cbrt2 / (2.0 - cbrt2));
+            kickDriftKick<Forces>(outer * h);
+            kickDriftKick<Forces>(inner * h);
+            kickDriftKick<Forces>(outer * h);
+        } else if constexpr (Method == Integrator::Hermite) {
+            PROFILE_SCOPE("hermite block step");
+            const double softening = getSoftening();
+            hermite.step(bodies, h, gravitationalConstant(), softening * softening, pool);
+            forceEvaluations += hermite.getForceEvaluations();
+        } else {
+            kickDriftKick<Forces>(h);
+        }
+    }
+
+    // Refreshes the store's accelerations
+    template <GravitySolver Forces>
+    void computeForces() {
+        computeAccelerations<Forces>(bodies.ax(), bodies.ay(), bodies.az());
+        forceEvaluations += bodies.size();
+        forcesValid = true;
+        forceRevision = bodies.getRevision();
+    }
+
+    // Reuses the accelerations from the end of the last step unless
+    // something changed the bodies or the solver since
+    template <GravitySolver Forces>
+    void kickDriftKick(Real h) {
+        if (!forcesValid || forceRevision != bodies.getRevision()) {
+            computeForces<Forces>();
+        }
+        kick(Real(0.5) * h);
+        drift(h);
+        computeForces<Forces>();
+        kick(Real(0.5) * h);
+    }
+
+    void drift(Real h) {
+        PROFILE_SCOPE("drift");
+        Real* x = bodies.x();
+        Real* y = bodies.y();
+        Real* z = bodies.z();
+        const Real* vx = bodies.vx();
+        const Real* vy = bodies.vy();
+        const Real* vz = bodies.vz();
+        const uint8_t* initializing = bodies.initializing();
+
+        pool.parallelFor(bodies.size(), STREAM_SIZE, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                if (initializing[i]) continue;
+                x[i] += vx[i] * h;
+                y[i] += vy[i] * h;
+                z[i] += vz[i] * h;
+            }
+        });
+    }
+
+    void kick(Real h) {
+        PROFILE_SCOPE("kick");
+        Real* vx = bodies.vx();
+        Real* vy = bodies.vy();
+        Real* vz = bodies.vz();
+        const Real* ax = bodies.ax();
+        const Real* ay = bodies.ay();
+        const Real* az = bodies.az();
+        const uint8_t* initializing = bodies.initializing();
+
+        pool.parallelFor(bodies.size(), STREAM_SIZE, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                if (initializing[i]) continue;
+                vx[i] += ax[i] * h;
+                vy[i] += ay[i] * h;
+                vz[i] += az[i] * h;
+            }
+        });
+    }
+
+    void computeAccelerations(GravitySolver method, Real* ax, Real* ay, Real* az) {
+        if constexpr (TREE_SOLVERS) {
+            if (method == GravitySolver::BarnesHut) return computeAccelerations<GravitySolver::BarnesHut>(ax, ay, az);
+            if (method == GravitySolver::FastMultipole) return computeAccelerations<GravitySolver::FastMultipole>(ax, ay, az);
+        }
+        computeAccelerations<GravitySolver::DirectSum>(ax, ay, az);
+    }
+
+    template <GravitySolver Forces>
+    void computeAccelerations(Real* ax, Real* ay, Real* az) {
+        if constexpr (Forces == GravitySolver::BarnesHut) {
+            PROFILE_SCOPE("barnes-hut forces");
+            barnesHut.computeAccelerations(bodies, gravitationalConstant(), ax, ay, az, pool);
+        } else if constexpr (Forces == GravitySolver::FastMultipole) {
+            PROFILE_SCOPE("fmm forces");
+            fastMultipole.computeAccelerations(bodies, gravitationalConstant(), ax, ay, az, pool);
+        } else {
+            PROFILE_SCOPE("direct sum forces");
+            computeDirectSum(ax, ay, az);
+        }
+    }
+
+    // Direct O(N^2) summation over the position columns, each pair once.
+    // Initializing bodies get a zero gravitating mass so they pull on
+    // nothing but are still pulled.
+    void computeDirectSum(Real* ax, Real* ay, Real* az) {
+        const size_t count = bodies.size();
+        const Real* mass = bodies.mass();
+        const uint8_t* initializing = bodies.initializing();
+
+        const Real G = gravitationalConstant();
+        gravitatingMass.resize(count);
+        for (size_t j = 0; j < count; ++j) {
+            gravitatingMass[j] = initializing[j] ? Real(0) : G * mass[j];
+        }
+
+        directKernel.computeAccelerations(bodies.x(), bodies.y(), bodies.z(), gravitatingMass.data(), count,
+                                          ax, ay, az, pool);
+    }
+
+    // Continuous collision detection over the step just taken. Bodies are
+    // taken to move in a straight line from their previous to their current
+    // position; sweep-and-prune finds pairs whose swept boxes meet and each
+    // pair is then solved once for the time its spheres first touch. In
+    // merge mode bodies still overlapping at the end of the step also count
+    // as touching. Returns whether any body bounced or merged.
+    template <CollisionMode Mode>
+    bool resolveCollisions() {
+        PROFILE_SCOPE("collisions");
+        const Real* x = bodies.x();
+        const Real* y = bodies.y();
+        const Real* z = bodies.z();
+        const Real* px = bodies.previousX();
+        const Real* py = bodies.previousY();
+        const Real* pz = bodies.previousZ();
+        const Real* radius = bodies.radius();
+
+        const std::vector<CollisionPair>& candidates = broadPhase.findPairs(bodies, pool);
+        impactTimes.assign(bodies.size(), Real(1));
+        contacts.clear();
+        for (const CollisionPair& pair : candidates) {
+            const uint32_t i = pair.first, j = pair.second;
+            const Real dx = x[j] - x[i], dy = y[j] - y[i], dz = z[j] - z[i];
+            const Real reach = radius[i] + radius[j];
+            Real t = impactTime(px[j] - px[i], py[j] - py[i], pz[j] - pz[i], dx, dy, dz, reach);
+            if (t > Real(1)) {
+                if (Mode != CollisionMode::Merge || dx * dx + dy * dy + dz * dz >= reach * reach) continue;
+                t = Real(1);
+            }
+            impactTimes[i] = std::min(impactTimes[i], t);
+            impactTimes[j] = std::min(impactTimes[j], t);
+            contacts.push_back(pair);
+        }
+        if (contacts.empty()) return false;
+
+        if constexpr (Mode == CollisionMode::Merge) {
+            mergeContacts();
+        } else {
+            bounceContacts();
+        }
+        return true;
+    }
+
+    // Every contact a body takes part in flips and damps its velocity, as
+    // before. Only bodies in contact are re-positioned: they travel to their
+    // earliest impact and spend the rest of the step on the bounced velocity.
+    void bounceContacts() {
+        const size_t count = bodies.size();
+        Real* x = bodies.x();
+        Real* y = bodies.y();
+        Real* z = bodies.z();
+        const Real* px = bodies.previousX();
+        const Real* py = bodies.previousY();
+        const Real* pz = bodies.previousZ();
+        Real* vx = bodies.vx();
+        Real* vy = bodies.vy();
+        Real* vz = bodies.vz();
+
+        contactCounts.assign(count, 0);
+        for (const CollisionPair& pair : contacts) {
+            ++contactCounts[pair.first];
+            ++contactCounts[pair.second];
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (contactCounts[i] == 0) continue;
+            Real factor = 1;
+            for (uint16_t c = 0; c < contactCounts[i]; ++c) {
+                factor *= Real(-0.2); // Collision occurred, apply bounce factor
+            }
+            const Real t = impactTimes[i];
+            const Real after = factor * (Real(1) - t);
+            x[i] = px[i] + (x[i] - px[i]) * (t + after);
+            y[i] = py[i] + (y[i] - py[i]) * (t + after);
+            z[i] = pz[i] + (z[i] - pz[i]) * (t + after);
+            vx[i] *= factor;
+            vy[i] *= factor;
+            vz[i] *= factor;
+        }
+    }
+
+    // Contacts are merged in broad-phase order, so a body touching several
+    // others collects them all; the heavier body of each pair survives and
+    // the store is compacted once at the end
+    void mergeContacts() {
+        const size_t count = bodies.size();
+        const Real* mass = bodies.mass();
+
+        mergedInto.resize(count);
+        for (size_t i = 0; i < count; ++i) mergedInto[i] = static_cast<uint32_t>(i);
+        absorbed.assign(count, 0);
+        for (const CollisionPair& pair : contacts) {
+            uint32_t a = survivorOf(pair.first), b = survivorOf(pair.second);
+            if (a == b) continue;
+            if (mass[b] > mass[a] || (mass[b] == mass[a] && b < a)) std::swap(a, b);
+            bodies.absorb(a, b);
+            mergedInto[b] = a;
+            absorbed[b] = 1;
+        }
+        mergeCount += bodies.compact(absorbed);
+    }
+
+    uint32_t survivorOf(uint32_t slot) const {
+        while (mergedInto[slot] != slot) slot = mergedInto[slot];
+        return slot;
+    }
+
+    // First t in [0, 1] at which |d0 + (d1 - d0) t| <= reach, or 2 if the
+    // spheres are not closing on each other during the step
+    static Real impactTime(Real d0x, Real d0y, Real d0z, Real d1x, Real d1y, Real d1z, Real reach) {
+        const Real ex = d1x - d0x, ey = d1y - d0y, ez = d1z - d0z;
+        const Real b = d0x * ex + d0y * ey + d0z * ez;
+        if (b >= 0) return Real(2); // separating or at rest relative to each other
+
+        const Real c = d0x * d0x + d0y * d0y + d0z * d0z - reach * reach;
+        if (c < 0) return Real(0); // already overlapping and closing
+        const Real a = ex * ex + ey * ey + ez * ez;
+        const Real discriminant = b * b - a * c;
+        if (discriminant < 0) return Real(2);
+        return (-b - std::sqrt(discriminant)) / a;
+    }
+};
+
+using PhysicsEngine = BasicPhysicsEngine<float>;
+using DoublePhysicsEngine = BasicPhysicsEngine<double>;
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Scoped timers for finding where a frame or a step goes. Built with
+// NBODY_PROFILE defined, every PROFILE_SCOPE records its begin and end on
+// the calling thread into that thread's ring buffer; writeChromeTrace()
+// dumps all rings as Chrome trace JSON, which chrome://tracing and
+// Perfetto open. Without NBODY_PROFILE the macros expand to nothing.
+//
+// A ring is written only by its own thread and keeps the newest
+// RING_CAPACITY scopes. The dump copies rings while they are written and
+// drops whatever the owner may have overwritten during the copy, so
+// recording never takes a lock.
+class Profiler {
+public:
+#ifdef NBODY_PROFILE
+    static constexpr bool ENABLED = true;
+#else
+    static constexpr bool ENABLED = false;
+#endif
+    static constexpr size_t RING_CAPACITY = size_t(1) << 16;
+
+private:
+    struct Event {
+        std::atomic<const char*> name{nullptr};
+        std::atomic<int64_t> begin{0}, end{0}; // nanoseconds since the profiler started
+    };
+
+    struct Ring {
+        std::unique_ptr<Event[]> events{new Event[RING_CAPACITY]};
+        std::atomic<uint64_t> written{0};
+        uint32_t threadId = 0;
+        std::string threadName; // guarded by the profiler mutex
+    };
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Ring>> rings; // never shrinks, rings outlive their threads
+    std::chrono::steady_clock::time_point epoch;
+
+    Profiler() : epoch(std::chrono::steady_clock::now()) {}
+
+public:
+    static Profiler& instance() {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    int64_t now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    void record(const char* name, int64_t begin, int64_t end) {
+        Ring& ring = threadRing();
+        const uint64_t index = ring.written.load(std::memory_order_relaxed);
+        Event& event = ring.events[index % RING_CAPACITY];
+        // Pairs with the fence in copyRing: a dump that sees any of these
+        // stores also sees every earlier count
+        std::atomic_thread_fence(std::memory_order_release);
+        event.name.store(name, std::memory_order_relaxed);
+        event.begin.store(begin, std::memory_order_relaxed);
+        event.end.store(end, std::memory_order_relaxed);
+        ring.written.store(index + 1, std::memory_order_release);
+    }
+
+    // Labels the calling thread's track in the trace
+    void nameThread(const std::string& name) {
+        Ring& ring = threadRing();
+        std::lock_guard<std::mutex> lock(mutex);
+        ring.threadName = name;
+    }
+
+    // Innermost scope open on the calling thread, so work it hands to
+    // other threads can carry its name
+    static const char*& currentScope() {
+        thread_local const char* scope = nullptr;
+        return scope;
+    }
+
+    // Writes every recorded scope still in the rings and returns how many,
+    // or -1 if the file could not be written
+    long long writeChromeTrace(const std::string& path) {
+        std::ofstream out(path);
+        if (!out) {
+            std::cerr << "Failed to open '" << path << "' for writing" << std::endl;
+            return -1;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t total = 0;
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"nbody\"}}";
+        std::vector<Snapshot> events;
+        for (const std::unique_ptr<Ring>& ring : rings) {
+            const std::string threadName = ring->threadName.empty()
+                ? "thread " + std::to_string(ring->threadId) : ring->threadName;
+            out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring->threadId
+                << ",\"args\":{\"name\":\"" << threadName << "\"}}";
+
+            copyRing(*ring, events);
+            for (const Snapshot& event : events) {
+                out << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"nbody\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                    << ring->threadId << ",\"ts\":" << event.begin / 1000 << '.' << pad3(event.begin % 1000)
+                    << ",\"dur\":" << (event.end - event.begin) / 1000 << '.' << pad3((event.end - event.begin) % 1000)
+                    << '}';
+            }
+            total += events.size();
+        }
+        out << "\n]}\n";
+        out.close();
+        if (!out) {
+            std::cerr << "Failed to write profile '" << path << "'" << std::endl;
+            return -1;
+        }
+        return static_cast<long long>(total);
+    }
+
+private:
+    struct Snapshot {
+        const char* name;
+        int64_t begin, end;
+    };
+
+    Ring& threadRing() {
+        thread_local Ring* ring = nullptr;
+        if (!ring) {
+            std::lock_guard<std::mutex> lock(mutex);
+            rings.push_back(std::make_unique<Ring>());
+            ring = rings.back().get();
+            ring->threadId = static_cast<uint32_t>(rings.size());
+        }
+        return *ring;
+    }
+
+    // Keeps only the slots the owner cannot have reused while they were
+    // copied, including the one it may be writing right now
+    static void copyRing(const Ring& ring, std::vector<Snapshot>& events) {
+        events.clear();
+        const uint64_t end = ring.written.load(std::memory_order_acquire);
+        const uint64_t begin = end > RING_CAPACITY ? end - RING_CAPACITY : 0;
+        for (uint64_t index = begin; index < end; ++index) {
+            const Event& event = ring.events[index % RING_CAPACITY];
+            events.push_back({event.name.load(std::memory_order_relaxed), event.begin.load(std::memory_order_relaxed),
+                              event.end.load(std::memory_order_relaxed)});
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint64_t after = ring.written.load(std::memory_order_relaxed) + 1;
+        const uint64_t overwritten = after > RING_CAPACITY ? after - RING_CAPACITY : 0;
+        if (overwritten > begin) {
+            events.erase(events.begin(), events.begin() + static_cast<ptrdiff_t>(std::min<uint64_t>(overwritten - begin, events.size())));
+        }
+    }
+
+    static std::string pad3(int64_t value) {
+        std::string digits = std::to_string(value);
+        return std::string(3 - std::min<size_t>(3, digits.size()), '0') + digits;
+    }
+};
+
+#ifdef NBODY_PROFILE
+
+// Times the rest of the enclosing block
+class ProfileScope {
+private:
+    const char* name;
+    const char* outer;
+    int64_t begin;
+
+public:
+    explicit ProfileScope(const char* name)
+        : name(name), outer(Profiler::currentScope()), begin(Profiler::instance().now()) {
+        Profiler::currentScope() = name;
+    }
+
+    ~ProfileScope() {
+        Profiler::instance().record(name, begin, Profiler::instance().now());
+        Profiler::currentScope() = outer;
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+// name must outlive the program's last dump; string literals do
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_THREAD(name) Profiler::instance().nameThread(name)
+#define PROFILE_CURRENT_SCOPE() Profiler::currentScope()
+
+#else
+
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_THREAD(name) ((void)0)
+#define PROFILE_CURRENT_SCOPE() nullptr
+
+#endif
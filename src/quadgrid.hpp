@@ -0,0 +1,368 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "bodystore.hpp"
+#include "threadpool.hpp"
+
+// Quadtree layout of the spacetime grid's lines. Cells are split where a
+// straight grid line would miss the curved displacement the most, i.e.
+// where the displacement gradient changes fastest across the cell, and
+// merged again once the bodies have moved away. The number of line
+// vertices never exceeds the budget the grid is given.
+//
+// Cells live on an integer lattice of 2^MAX_DEPTH units per side. Every
+// leaf emits its north and east edges (and the border its south and west
+// ones), cut wherever a smaller neighbour has a corner, so no line ends in
+// the middle of another.
+class QuadGrid {
+public:
+    static constexpr int BASE_DEPTH = 3;
+    static constexpr int MAX_DEPTH = 9;
+
+private:
+    static constexpr int SIDE = 1 << MAX_DEPTH;
+    static constexpr int NO_CHILDREN = -1;
+    // A split cell is merged back only once its error falls well below the
+    // tolerance, so cells near the threshold do not flicker
+    static constexpr float MERGE_FRACTION = 0.25f;
+    // Splits traded for merges per refinement once the budget is full
+    static constexpr int MAX_TRADES = 16;
+    static constexpr int REFINE_ROUNDS = 3;
+    // Cells handed to one error estimation task
+    static constexpr size_t NODE_GRAIN = 32;
+
+    struct Node {
+        int x, z, size;  // lattice units
+        int firstChild;  // four consecutive nodes, or NO_CHILDREN
+        int parent;
+        float error;
+    };
+
+    float halfSize;
+    float unit;  // world size of one lattice unit
+    float tolerance;
+    size_t vertexBudget;
+    float verticesPerLeaf;
+    std::vector<Node> nodes;
+    std::vector<int> freeBlocks;
+    std::vector<int> leaves;
+
+    std::vector<float> pointX, pointZ;
+    std::vector<uint32_t> lines; // pairs of point indices
+    std::unordered_map<uint64_t, uint32_t> pointIndex;
+
+    std::vector<float> lastX, lastY, lastZ;
+    uint64_t lastRevision;
+
+public:
+    // Square [-size/2, size/2] drawn with at most vertexBudget line vertices.
+    // Cells are never merged above BASE_DEPTH, so a smaller budget is raised
+    // to what that uniform grid needs.
+    QuadGrid(float size, size_t vertexBudget)
+        : halfSize(size / 2.0f), unit(size / SIDE), tolerance(0.5f),
+          vertexBudget(std::max(vertexBudget, baseVertexCount())),
+          verticesPerLeaf(4.0f), lastRevision(~uint64_t(0)) {
+        nodes.push_back({0, 0, SIDE, NO_CHILDREN, -1, 0.0f});
+        for (int depth = 0; depth < BASE_DEPTH; ++depth) {
+            collectLeaves();
+            for (int leaf : std::vector<int>(leaves)) split(leaf);
+        }
+        collectLeaves();
+        buildLines();
+    }
+
+    // Largest estimated gap, in grid units, between a cell's straight lines
+    // and the displacement it spans before the cell is split
+    void setTolerance(float units) {
+        tolerance = std::max(1.0e-3f, units);
+        lastRevision = ~uint64_t(0);
+    }
+    float getTolerance() const { return tolerance; }
+
+    const std::vector<float>& getPointX() const { return pointX; }
+    const std::vector<float>& getPointZ() const { return pointZ; }
+    const std::vector<uint32_t>& getLines() const { return lines; }
+    size_t getVertexCount() const { return lines.size(); }
+    size_t getVertexBudget() const { return vertexBudget; }
+    size_t getLeafCount() const { return leaves.size(); }
+
+    // Splits and merges cells for the given sources (padded columns with
+    // rs = 0 allowed). Does nothing until a body has moved by half the finest
+    // cell or the store changed. Returns whether the lines changed.
+    bool refine(const BodyStore& bodies, ThreadPool& pool, const float* x, const float* y, const float* z,
+                const float* rs, size_t sources, float planeY) {
+        if (!needsRefinement(bodies)) return false;
+
+        pool.parallelFor(nodes.size(), NODE_GRAIN, [&](size_t begin, size_t end) {
+            for (size_t n = begin; n < end; ++n) {
+                if (nodes[n].size > 0) nodes[n].error = cellError(nodes[n], x, y, z, rs, sources, planeY);
+            }
+        });
+
+        // Merge cells whose children are all leaves and fit comfortably
+        bool changed = false;
+        for (size_t n = 0; n < nodes.size(); ++n) {
+            if (isMergeable(int(n)) && nodes[n].error < tolerance * MERGE_FRACTION) {
+                merge(int(n));
+                changed = true;
+            }
+        }
+        collectLeaves();
+
+        // Each round lays the lines out again, which refreshes the vertex
+        // cost per leaf the budget is checked with
+        for (int round = 0; round < REFINE_ROUNDS; ++round) {
+            if (!splitCells(x, y, z, rs, sources, planeY)) break;
+            changed = true;
+            layOut();
+        }
+        if (!changed) return false;
+        layOut();
+        return true;
+    }
+
+private:
+    // Splits the worst leaves while the budget lasts, a level at a time.
+    // Returns whether any leaf was split.
+    bool splitCells(const float* x, const float* y, const float* z, const float* rs, size_t sources, float planeY) {
+        bool splitAny = false;
+        for (int pass = 0; pass < MAX_DEPTH; ++pass) {
+            std::vector<int> candidates;
+            for (int leaf : leaves) {
+                if (nodes[leaf].error > tolerance && nodes[leaf].size > 1) candidates.push_back(leaf);
+            }
+            if (candidates.empty()) break;
+            sortByError(candidates, true);
+
+            bool splitThisPass = false;
+            int trades = 0;
+            for (int leaf : candidates) {
+                // A trade below may have merged this candidate away, and
+                // its node block may since hold another cell's children
+                if (!isLeaf(leaf) || nodes[leaf].size <= 1 || nodes[leaf].error <= tolerance) continue;
+                if (!fitsBudget(leaves.size() + 3)) {
+                    // Trade the cheapest mergeable cell for this one
+                    int cheapest = cheapestMergeable(leaf);
+                    if (cheapest < 0 || trades >= MAX_TRADES ||
+                        nodes[cheapest].error * 4.0f >= nodes[leaf].error) break;
+                    merge(cheapest);
+                    ++trades;
+                }
+                split(leaf, x, y, z, rs, sources, planeY);
+                splitThisPass = true;
+                collectLeaves();
+            }
+            if (!splitThisPass) break;
+            splitAny = true;
+        }
+        return splitAny;
+    }
+
+    // Builds the lines and merges the cheapest cells until they fit
+    void layOut() {
+        buildLines();
+        while (lines.size() > vertexBudget) {
+            int cheapest = cheapestMergeable(-1);
+            if (cheapest < 0) break;
+            merge(cheapest);
+            collectLeaves();
+            buildLines();
+        }
+    }
+
+    bool needsRefinement(const BodyStore& bodies) {
+        const size_t count = bodies.size();
+        bool moved = bodies.getRevision() != lastRevision || lastX.size() != count;
+        const float limit = 0.5f * unit;
+        for (size_t b = 0; b < count && !moved; ++b) {
+            float dx = bodies.x()[b] - lastX[b], dy = bodies.y()[b] - lastY[b], dz = bodies.z()[b] - lastZ[b];
+            moved = dx * dx + dy * dy + dz * dz > limit * limit;
+        }
+        if (!moved) return false;
+
+        lastRevision = bodies.getRevision();
+        lastX.assign(bodies.x(), bodies.x() + count);
+        lastY.assign(bodies.y(), bodies.y() + count);
+        lastZ.assign(bodies.z(), bodies.z() + count);
+        return true;
+    }
+
+    // Vertices per leaf are taken from the last layout; any overshoot from
+    // a change in the mix of cell sizes is trimmed after building
+    bool fitsBudget(size_t leafCount) const { return leafCount * verticesPerLeaf <= vertexBudget; }
+
+    // A straight segment of length s across displacement h misses it by
+    // about s^2 |h''| / 8. For 4 sqrt(rs (1000 d - rs)), |h''| is close to
+    // sqrt(1000 rs) / d^1.5, taken at the cell's nearest point and never
+    // closer than half the cell, so cells on top of a body still converge.
+    float cellError(const Node& node, const float* x, const float* y, const float* z, const float* rs,
+                    size_t sources, float planeY) const {
+        const float size = node.size * unit;
+        const float minX = -halfSize + node.x * unit, maxX = minX + size;
+        const float minZ = -halfSize + node.z * unit, maxZ = minZ + size;
+        float error = 0.0f;
+        for (size_t b = 0; b < sources; ++b) {
+            if (rs[b] <= 0.0f) continue;
+            const float ox = std::max({minX - x[b], x[b] - maxX, 0.0f});
+            const float oy = y[b] - planeY;
+            const float oz = std::max({minZ - z[b], z[b] - maxZ, 0.0f});
+            const float distance = std::max(std::sqrt(ox * ox + oy * oy + oz * oz), 0.5f * size);
+            error += std::sqrt(1000.0f * rs[b]) / (distance * std::sqrt(distance));
+        }
+        return error * size * size / 8.0f;
+    }
+
+    // Live cells have a nonzero size
+    bool isLeaf(int n) const { return nodes[n].size > 0 && nodes[n].firstChild == NO_CHILDREN; }
+
+    // Line vertices of the uniform grid at BASE_DEPTH
+    static size_t baseVertexCount() {
+        const size_t cells = size_t(1) << BASE_DEPTH;
+        return 4 * cells * (cells + 1);
+    }
+
+    bool isMergeable(int n) const {
+        const Node& node = nodes[n];
+        if (node.size == 0 || node.firstChild == NO_CHILDREN || node.size > (SIDE >> BASE_DEPTH)) return false;
+        for (int c = 0; c < 4; ++c) {
+            if (nodes[node.firstChild + c].firstChild != NO_CHILDREN) return false;
+        }
+        return true;
+    }
+
+    // Mergeable cell with the smallest error that is not an ancestor of keep
+    int cheapestMergeable(int keep) const {
+        int best = -1;
+        for (size_t n = 0; n < nodes.size(); ++n) {
+            if (!isMergeable(int(n)) || (keep >= 0 && nodes[keep].parent == int(n))) continue;
+            if (best < 0 || nodes[n].error < nodes[best].error) best = int(n);
+        }
+        return best;
+    }
+
+    void sortByError(std::vector<int>& cells, bool descending) const {
+        std::sort(cells.begin(), cells.end(), [&](int a, int b) {
+            if (nodes[a].error != nodes[b].error) {
+                return descending ? nodes[a].error > nodes[b].error : nodes[a].error < nodes[b].error;
+            }
+            return a < b;
+        });
+    }
+
+    void split(int n) {
+        int first;
+        if (!freeBlocks.empty()) {
+            first = freeBlocks.back();
+            freeBlocks.pop_back();
+        } else {
+            first = static_cast<int>(nodes.size());
+            nodes.resize(nodes.size() + 4);
+        }
+        const Node parent = nodes[n];
+        const int half = parent.size / 2;
+        for (int c = 0; c < 4; ++c) {
+            nodes[first + c] = {parent.x + (c & 1) * half, parent.z + (c >> 1) * half, half, NO_CHILDREN, n, 0.0f};
+        }
+        nodes[n].firstChild = first;
+    }
+
+    void split(int n, const float* x, const float* y, const float* z, const float* rs, size_t sources, float planeY) {
+        split(n);
+        for (int c = 0; c < 4; ++c) {
+            Node& child = nodes[nodes[n].firstChild + c];
+            child.error = cellError(child, x, y, z, rs, sources, planeY);
+        }
+    }
+
+    // Children are marked free by a zero size
+    void merge(int n) {
+        const int first = nodes[n].firstChild;
+        for (int c = 0; c < 4; ++c) nodes[first + c].size = 0;
+        freeBlocks.push_back(first);
+        nodes[n].firstChild = NO_CHILDREN;
+    }
+
+    void collectLeaves() {
+        leaves.clear();
+        std::vector<int> stack(1, 0);
+        while (!stack.empty()) {
+            int n = stack.back();
+            stack.pop_back();
+            if (nodes[n].firstChild == NO_CHILDREN) {
+                leaves.push_back(n);
+                continue;
+            }
+            for (int c = 3; c >= 0; --c) stack.push_back(nodes[n].firstChild + c);
+        }
+    }
+
+    // Leaf containing the lattice point, which must lie inside the square
+    int leafAt(int x, int z) const {
+        int n = 0;
+        while (nodes[n].firstChild != NO_CHILDREN) {
+            const Node& node = nodes[n];
+            const int half = node.size / 2;
+            n = node.firstChild + (x >= node.x + half ? 1 : 0) + (z >= node.z + half ? 2 : 0);
+        }
+        return n;
+    }
+
+    uint32_t point(int x, int z) {
+        const uint64_t key = uint64_t(uint32_t(z)) << 32 | uint32_t(x);
+        auto found = pointIndex.find(key);
+        if (found != pointIndex.end()) return found->second;
+        const uint32_t index = static_cast<uint32_t>(pointX.size());
+        pointIndex.emplace(key, index);
+        pointX.push_back(-halfSize + x * unit);
+        pointZ.push_back(-halfSize + z * unit);
+        return index;
+    }
+
+    void addLine(int x0, int z0, int x1, int z1) {
+        lines.push_back(point(x0, z0));
+        lines.push_back(point(x1, z1));
+    }
+
+    void buildLines() {
+        pointX.clear();
+        pointZ.clear();
+        lines.clear();
+        pointIndex.clear();
+        for (int leaf : leaves) {
+            const Node& node = nodes[leaf];
+            const int x1 = node.x + node.size, z1 = node.z + node.size;
+            if (node.z == 0) addLine(node.x, 0, x1, 0);
+            if (node.x == 0) addLine(0, node.z, 0, z1);
+
+            // North edge, cut at the corners of smaller cells above
+            if (z1 == SIDE) {
+                addLine(node.x, z1, x1, z1);
+            } else {
+                for (int x = node.x; x < x1;) {
+                    const Node& above = nodes[leafAt(x, z1)];
+                    const int end = std::min(x1, above.x + above.size);
+                    addLine(x, z1, end, z1);
+                    x = end;
+                }
+            }
+
+            // East edge, cut at the corners of smaller cells to the right
+            if (x1 == SIDE) {
+                addLine(x1, node.z, x1, z1);
+            } else {
+                for (int z = node.z; z < z1;) {
+                    const Node& right = nodes[leafAt(x1, z)];
+                    const int end = std::min(z1, right.z + right.size);
+                    addLine(x1, z, x1, end);
+                    z = end;
+                }
+            }
+        }
+        verticesPerLeaf = float(lines.size()) / leaves.size();
+    }
+};
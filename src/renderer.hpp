@@ -4,26 +4,62 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 
-#include "../interfaces/IDrawable.hpp"
 #include "shaderprogram.hpp"
+#include "frustum.hpp"
 #include "grid.hpp"
+#include "profiler.hpp"
 #include "object.hpp"
+#include "renderqueue.hpp"
 #include "shaders.hpp"
+#include "spheremesh.hpp"
 
 
 class Renderer {
+public:
+    // Uniform buffer binding of the Frame block (view, projection)
+    static constexpr GLuint FRAME_BLOCK_BINDING = 1;
+
 private:
     ShaderProgram shader;
+    ShaderProgram gridShader; // displaces the grid from the GridBodies block
+    ShaderProgram sphereShader;
+    GLint sphereGlowLocation;
+    GLuint frameBuffer;
+    SphereMeshCache sphereMeshes;
+    RenderQueue queue;
+    std::vector<RenderRun> drawRuns; // latched by upload() for submit()
     glm::mat4 projection;
+    glm::mat4 recordedView;          // view the queue was culled for
+    float viewportHeight;
+    size_t culledCount;
 
 public:
     Renderer(int width, int height) 
-        : shader(Shaders::vertexShaderSource, Shaders::fragmentShaderSource) {
+        : shader(Shaders::vertexShaderSource, Shaders::fragmentShaderSource),
+          gridShader(Shaders::gridVertexShaderSource, Shaders::fragmentShaderSource),
+          sphereShader(Shaders::sphereVertexShaderSource, Shaders::sphereFragmentShaderSource),
+          sphereGlowLocation(sphereShader.getUniformLocation("GLOW")),
+          recordedView(1.0f),
+          viewportHeight(static_cast<float>(height)),
+          culledCount(0) {
+        gridShader.bindUniformBlock("GridBodies", Grid::BODY_BLOCK_BINDING);
+        shader.bindUniformBlock("Frame", FRAME_BLOCK_BINDING);
+        gridShader.bindUniformBlock("Frame", FRAME_BLOCK_BINDING);
+        sphereShader.bindUniformBlock("Frame", FRAME_BLOCK_BINDING);
         
         // Set up projection matrix
         projection = glm::perspective(glm::radians(45.0f), 
                                      static_cast<float>(width) / static_cast<float>(height), 
                                      0.1f, 750000.0f);
+
+        // Frame block: view at 0, projection at 64, written once here
+        glGenBuffers(1, &frameBuffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, frameBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, 2 * sizeof(glm::mat4), nullptr, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), glm::value_ptr(recordedView));
+        glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::mat4), sizeof(glm::mat4), glm::value_ptr(projection));
+        glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, frameBuffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
         
         // Set up OpenGL state
         glEnable(GL_DEPTH_TEST);
@@ -31,27 +67,90 @@ public:
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     }
 
+    ~Renderer() {
+        glDeleteBuffers(1, &frameBuffer);
+    }
+
+    Renderer(const Renderer&) = delete;
+    Renderer& operator=(const Renderer&) = delete;
+
     void beginFrame() {
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         shader.use();
-        shader.setMat4("projection", projection);
     }
 
-    void updateCamera(const Camera& camera) {
-        shader.setMat4("view", camera.getViewMatrix());
+    // Records the grid and every body inside the view frustum, at the given
+    // blend between their last two steps, into the queue and sorts it.
+    // Touches no GL state, so it may run on another thread while submit()
+    // draws the previous frame.
+    void record(const std::vector<std::shared_ptr<Object>>& objects, const glm::mat4& cameraView, float blend) {
+        PROFILE_SCOPE("record draw list");
+        recordedView = cameraView;
+        Frustum frustum(projection * cameraView);
+        queue.clear();
+        queue.pushGrid();
+        culledCount = 0;
+        for (const auto& obj : objects) {
+            if (!obj->exists()) continue; // not in the snapshot yet
+            glm::vec3 position = obj->getDisplayPosition(blend);
+            float radius = obj->getRadius();
+            if (!frustum.intersectsSphere(position, radius)) {
+                ++culledCount;
+                continue;
+            }
+            float pixels = SphereMeshCache::projectedRadius(position, radius, cameraView, projection, viewportHeight);
+            const glm::vec4& color = obj->getColor();
+            queue.pushSphere(obj->isGlowingBody(), SphereMeshCache::levelFor(pixels),
+                             {position.x, position.y, position.z, radius, color.x, color.y, color.z, color.w});
+        }
+        queue.sort();
+    }
+
+    // Sends the recorded instances and view to the GPU and keeps the runs,
+    // after which the next record() may start
+    void upload() {
+        PROFILE_SCOPE("renderer upload");
+        sphereMeshes.upload(queue.getInstances());
+        drawRuns = queue.getRuns();
+        glBindBuffer(GL_UNIFORM_BUFFER, frameBuffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), glm::value_ptr(recordedView));
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
     }
 
-    void render(const IDrawable& drawable) {
-        drawable.draw(shader);
+    // One draw per (state, level of detail) run of the uploaded frame
+    void submit(const Grid& grid) {
+        PROFILE_SCOPE("submit draws");
+        bool sphereShaderBound = false;
+        RenderState glowState = RenderState::Grid;
+        for (const RenderRun& run : drawRuns) {
+            if (run.state == RenderState::Grid) {
+                for (uint32_t k = 0; k < run.count; ++k) drawGrid(grid);
+                continue;
+            }
+            if (!sphereShaderBound) {
+                sphereShader.use();
+                sphereShaderBound = true;
+            }
+            if (run.state != glowState) {
+                sphereShader.setBool(sphereGlowLocation, run.state == RenderState::Glowing);
+                glowState = run.state;
+            }
+            sphereMeshes.draw(run.level, run.first, run.count);
+        }
+        shader.use();
     }
 
-    void render(const std::vector<std::shared_ptr<Object>>& objects, const Grid& grid) {
-        // Draw grid
-        render(grid);
-        
-        // Draw objects
-        for (const auto& obj : objects) {
-            render(*obj);
+    // Bodies skipped by frustum culling in the last record
+    size_t getCulledCount() const { return culledCount; }
+
+private:
+    void drawGrid(const Grid& grid) {
+        if (grid.isGpuDisplaced()) {
+            gridShader.use();
+            grid.draw(gridShader);
+        } else {
+            shader.use();
+            grid.draw(shader);
         }
     }
-};
\ No newline at end of file
+};
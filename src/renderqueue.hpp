@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "spheremesh.hpp"
+
+// State a run of draws needs bound; runs are issued in this order
+enum class RenderState : uint8_t {
+    Grid,
+    Glowing,
+    Plain
+};
+
+struct RenderCommand {
+    RenderState state;
+    uint8_t level;     // sphere level of detail, 0 for the grid
+    uint32_t instance; // index into the recorded instances, unused for the grid
+};
+
+// Consecutive commands sharing state and level
+struct RenderRun {
+    RenderState state;
+    uint8_t level;
+    uint32_t first, count; // block of sorted instances; count of grid draws for the grid
+};
+
+// Per-frame command buffer. Draws are recorded in any order, then a
+// counting sort on (state, level) turns every pair into one run over a
+// contiguous block of instances, so the renderer binds each state once
+// and issues one draw call per run.
+class RenderQueue {
+private:
+    static constexpr int KEY_COUNT = 3 * SphereMeshCache::LEVEL_COUNT;
+
+    std::vector<RenderCommand> commands;
+    std::vector<SphereInstance> recorded;
+    std::vector<SphereInstance> sorted;
+    std::vector<RenderRun> runs;
+
+public:
+    void clear() {
+        commands.clear();
+        recorded.clear();
+    }
+
+    void pushGrid() {
+        commands.push_back({RenderState::Grid, 0, 0});
+    }
+
+    void pushSphere(bool glowing, int level, const SphereInstance& instance) {
+        commands.push_back({glowing ? RenderState::Glowing : RenderState::Plain, static_cast<uint8_t>(level),
+                            static_cast<uint32_t>(recorded.size())});
+        recorded.push_back(instance);
+    }
+
+    // Orders the instances by key and rebuilds the runs
+    void sort() {
+        uint32_t counts[KEY_COUNT] = {};
+        for (const RenderCommand& command : commands) ++counts[keyOf(command)];
+
+        uint32_t next[KEY_COUNT];
+        uint32_t first = 0;
+        runs.clear();
+        for (int key = 0; key < KEY_COUNT; ++key) {
+            next[key] = first;
+            if (counts[key] == 0) continue;
+            RenderState state = static_cast<RenderState>(key / SphereMeshCache::LEVEL_COUNT);
+            uint8_t level = static_cast<uint8_t>(key % SphereMeshCache::LEVEL_COUNT);
+            if (state == RenderState::Grid) {
+                runs.push_back({state, level, 0, counts[key]});
+            } else {
+                runs.push_back({state, level, first, counts[key]});
+                first += counts[key];
+            }
+        }
+
+        sorted.resize(recorded.size());
+        for (const RenderCommand& command : commands) {
+            if (command.state == RenderState::Grid) continue;
+            sorted[next[keyOf(command)]++] = recorded[command.instance];
+        }
+    }
+
+    const std::vector<SphereInstance>& getInstances() const { return sorted; }
+    const std::vector<RenderRun>& getRuns() const { return runs; }
+    size_t size() const { return commands.size(); }
+
+private:
+    static int keyOf(const RenderCommand& command) {
+        return static_cast<int>(command.state) * SphereMeshCache::LEVEL_COUNT + command.level;
+    }
+};
@@ -0,0 +1,287 @@
+#pragma once
+
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "constants.hpp"
+#include "bodystore.hpp"
+#include "initialconditions.hpp"
+#include "threadpool.hpp"
+
+// Kept in double so validation runs of the double engine start from the
+// exact values; float stores round them when the body is added
+struct BodySpec {
+    glm::dvec3 position;
+    glm::dvec3 velocity;
+    double mass;
+    double density;
+    glm::vec4 color;
+    bool glowing;
+};
+
+// Initial conditions shared by the windowed app and the headless driver.
+// A scenario is either built in ("default", "cloud:<count>[:<seed>]",
+// "plummer:", "disk:" or "rings:<count>[:<seed>]") or a text file with one
+// body per line:
+//   px py pz vx vy vz mass density [r g b a [glow]]
+// Blank lines and lines starting with '#' are ignored. writeState() emits
+// the same format, so a final state can be fed back in as a scenario.
+// The plummer, disk and rings scenes keep their many light bodies as a
+// generator run straight into the store rather than as BodySpecs.
+class Scenario {
+public:
+    enum class Generator { None, Plummer, Disk, Rings };
+
+    // Largest <count> a built-in scenario accepts
+    static constexpr size_t MAX_COUNT = size_t(1) << 24;
+
+private:
+    std::string name;
+    std::vector<BodySpec> bodies;
+    uint64_t seed; // of the generator that built it, 0 if none
+    Generator generator;
+    size_t generatedCount;
+    glm::vec4 generatedColor;
+
+public:
+    Scenario() : Scenario("empty") {}
+    explicit Scenario(const std::string& name)
+        : name(name), seed(0), generator(Generator::None), generatedCount(0),
+          generatedColor(1.0f, 0.0f, 0.0f, 1.0f) {}
+
+    const std::string& getName() const { return name; }
+    uint64_t getSeed() const { return seed; }
+    const std::vector<BodySpec>& getBodies() const { return bodies; }
+    size_t getGeneratedCount() const { return generator == Generator::None ? 0 : generatedCount; }
+    const glm::vec4& getGeneratedColor() const { return generatedColor; }
+
+    void addBody(const glm::dvec3& position, const glm::dvec3& velocity, double mass, double density,
+                 const glm::vec4& color = glm::vec4(1.0f, 0.0f, 0.0f, 1.0f), bool glowing = false) {
+        bodies.push_back({position, velocity, mass, density, color, glowing});
+    }
+
+    // Adds every body to the store, the listed ones first, and returns
+    // their ids in scenario order
+    template <typename Real>
+    std::vector<BodyId> populate(BasicBodyStore<Real>& store, ThreadPool& pool) const {
+        std::vector<BodyId> ids;
+        ids.reserve(bodies.size() + getGeneratedCount());
+        store.reserve(store.size() + bodies.size() + getGeneratedCount());
+        for (const BodySpec& spec : bodies) {
+            ids.push_back(store.add(spec.position, spec.velocity, spec.mass, spec.density));
+        }
+        const size_t first = store.size();
+        generate(store, pool);
+        for (size_t slot = first; slot < store.size(); ++slot) {
+            ids.push_back(store.idAt(slot));
+        }
+        return ids;
+    }
+
+    // Appends the generated bodies alone, for callers that add the listed
+    // ones themselves
+    template <typename Real>
+    void generate(BasicBodyStore<Real>& store, ThreadPool& pool) const {
+        switch (generator) {
+            case Generator::None: break;
+            case Generator::Plummer: InitialConditions::plummer(store, generatedCount, seed, pool); break;
+            case Generator::Disk: InitialConditions::disk(store, generatedCount, seed, pool); break;
+            case Generator::Rings: InitialConditions::rings(store, generatedCount, seed, pool); break;
+        }
+    }
+
+    // Two planets around a star
+    static Scenario defaultScene() {
+        Scenario scenario("default");
+        scenario.addBody(glm::dvec3(-5000, 650, -350), glm::dvec3(30000, 15000, 0),
+                         5.97219 * pow(10, 22), 5515, glm::vec4(0.0f, 1.0f, 1.0f, 1.0f));
+        scenario.addBody(glm::dvec3(5000, 650, -350), glm::dvec3(15000, 30000, 0),
+                         5.97219 * pow(10, 22), 5515, glm::vec4(0.0f, 1.0f, 1.0f, 1.0f));
+        scenario.addBody(glm::dvec3(0, 0, -350), glm::dvec3(0, 0, 0),
+                         1.989 * pow(10, 25), 8000, glm::vec4(1.0f, 0.929f, 0.176f, 1.0f), true);
+        return scenario;
+    }
+
+    // Gaussian cloud of default-mass bodies, reproducible for a given seed
+    static Scenario cloud(size_t count, uint32_t seed = 1) {
+        Scenario scenario("cloud:" + std::to_string(count) + ":" + std::to_string(seed));
+        scenario.seed = seed;
+        std::mt19937 rng(seed);
+        std::normal_distribution<float> position(0.0f, 5000.0f);
+        std::normal_distribution<float> velocity(0.0f, 1000.0f);
+        for (size_t i = 0; i < count; ++i) {
+            glm::dvec3 p(position(rng), position(rng), position(rng));
+            glm::dvec3 v(velocity(rng), velocity(rng), velocity(rng));
+            scenario.addBody(p, v, Constants::DEFAULT_MASS, 3344.0f);
+        }
+        return scenario;
+    }
+
+    // Plummer sphere of count stars in virial equilibrium
+    static Scenario plummer(size_t count, uint64_t seed = 1) {
+        Scenario scenario = generated("plummer", Generator::Plummer, count, seed);
+        scenario.generatedColor = glm::vec4(1.0f, 0.85f, 0.6f, 1.0f);
+        return scenario;
+    }
+
+    // Star with an exponential disc of count bodies on near-circular orbits
+    static Scenario disk(size_t count, uint64_t seed = 1) {
+        Scenario scenario = generated("disk", Generator::Disk, count, seed);
+        scenario.addBody(glm::dvec3(0.0), glm::dvec3(0.0), InitialConditions::DISK_CENTRAL_MASS,
+                         InitialConditions::DISK_CENTRAL_DENSITY, glm::vec4(1.0f, 0.929f, 0.176f, 1.0f), true);
+        scenario.generatedColor = glm::vec4(0.0f, 1.0f, 1.0f, 1.0f);
+        return scenario;
+    }
+
+    // Planet with count ring particles in four bands
+    static Scenario rings(size_t count, uint64_t seed = 1) {
+        Scenario scenario = generated("rings", Generator::Rings, count, seed);
+        scenario.addBody(glm::dvec3(0.0), glm::dvec3(0.0), InitialConditions::RING_PLANET_MASS, 5515,
+                         glm::vec4(0.82f, 0.71f, 0.55f, 1.0f));
+        scenario.generatedColor = glm::vec4(0.9f, 0.9f, 0.95f, 1.0f);
+        return scenario;
+    }
+
+    // Resolves a built-in name or reads a scenario file
+    static bool load(const std::string& source, Scenario& scenario) {
+        if (source == "default") {
+            scenario = defaultScene();
+            return true;
+        }
+        for (const char* kind : {"plummer", "disk", "rings"}) {
+            const std::string prefix = std::string(kind) + ":";
+            if (source.compare(0, prefix.size(), prefix) != 0) continue;
+            size_t count;
+            uint64_t seed;
+            if (!parseCountAndSeed(source.c_str() + prefix.size(), std::numeric_limits<uint64_t>::max(), count, seed)) {
+                std::cerr << "Invalid " << kind << " scenario '" << source << "', expected " << kind
+                          << ":<count>[:<seed>] with count 1 to " << MAX_COUNT << std::endl;
+                return false;
+            }
+            if (prefix == "plummer:") scenario = plummer(count, seed);
+            else if (prefix == "disk:") scenario = disk(count, seed);
+            else scenario = rings(count, seed);
+            return true;
+        }
+        if (source.compare(0, 6, "cloud:") == 0) {
+            size_t count;
+            uint64_t seed;
+            if (!parseCountAndSeed(source.c_str() + 6, std::numeric_limits<uint32_t>::max(), count, seed)) {
+                std::cerr << "Invalid cloud scenario '" << source << "', expected cloud:<count>[:<seed>] with count 1 to "
+                          << MAX_COUNT << " and a 32-bit seed" << std::endl;
+                return false;
+            }
+            scenario = cloud(count, static_cast<uint32_t>(seed));
+            return true;
+        }
+        return loadFile(source, scenario);
+    }
+
+private:
+    // "<count>[:<seed>]" in decimal digits only, count 1 to MAX_COUNT and
+    // seed at most maxSeed; the seed defaults to 1
+    static bool parseCountAndSeed(const char* text, uint64_t maxSeed, size_t& count, uint64_t& seed) {
+        uint64_t value;
+        if (!parseUnsigned(text, MAX_COUNT, value) || value == 0) return false;
+        count = static_cast<size_t>(value);
+        seed = 1;
+        if (*text == ':' && !parseUnsigned(++text, maxSeed, seed)) return false;
+        return *text == '\0';
+    }
+
+    // Advances text past the digits it parsed. strtoull alone would take
+    // a sign or leading blanks, and wrap "-1" to its largest value.
+    static bool parseUnsigned(const char*& text, uint64_t max, uint64_t& value) {
+        if (*text < '0' || *text > '9') return false;
+        char* end = nullptr;
+        errno = 0;
+        const unsigned long long parsed = std::strtoull(text, &end, 10);
+        if (errno == ERANGE || parsed > max) return false;
+        value = parsed;
+        text = end;
+        return true;
+    }
+
+    static Scenario generated(const char* kind, Generator generator, size_t count, uint64_t seed) {
+        Scenario scenario(std::string(kind) + ":" + std::to_string(count) + ":" + std::to_string(seed));
+        scenario.seed = seed;
+        scenario.generator = generator;
+        scenario.generatedCount = count;
+        return scenario;
+    }
+
+public:
+    static bool loadFile(const std::string& path, Scenario& scenario) {
+        std::ifstream file(path);
+        if (!file) {
+            std::cerr << "Failed to open scenario '" << path << "'" << std::endl;
+            return false;
+        }
+
+        Scenario result(path);
+        std::string line;
+        for (int lineNumber = 1; std::getline(file, line); ++lineNumber) {
+            size_t first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos || line[first] == '#') continue;
+
+            std::istringstream in(line);
+            BodySpec spec = {};
+            spec.color = glm::vec4(1.0f, 0.0f, 0.0f, 1.0f);
+            if (!(in >> spec.position.x >> spec.position.y >> spec.position.z
+                     >> spec.velocity.x >> spec.velocity.y >> spec.velocity.z
+                     >> spec.mass >> spec.density)) {
+                std::cerr << path << ":" << lineNumber << ": expected px py pz vx vy vz mass density" << std::endl;
+                return false;
+            }
+            if (spec.mass < 0.0 || spec.density <= 0.0) {
+                std::cerr << path << ":" << lineNumber << ": mass must be >= 0 and density > 0" << std::endl;
+                return false;
+            }
+            float r, g, b, a;
+            if (in >> r >> g >> b >> a) {
+                spec.color = glm::vec4(r, g, b, a);
+                int glow = 0;
+                if (in >> glow) spec.glowing = glow != 0;
+            }
+            result.bodies.push_back(spec);
+        }
+
+        scenario = result;
+        return true;
+    }
+
+    // Writes positions, velocities, masses and densities in scenario format
+    // with enough digits to round-trip the store's precision; "-" writes to stdout
+    template <typename Real>
+    static bool writeState(const BasicBodyStore<Real>& store, const std::string& path) {
+        std::ofstream file;
+        if (path != "-") {
+            file.open(path);
+            if (!file) {
+                std::cerr << "Failed to open '" << path << "' for writing" << std::endl;
+                return false;
+            }
+        }
+        std::ostream& out = path == "-" ? std::cout : file;
+
+        out.precision(std::numeric_limits<Real>::max_digits10);
+        out << "# px py pz vx vy vz mass density\n";
+        for (size_t i = 0; i < store.size(); ++i) {
+            out << store.x()[i] << ' ' << store.y()[i] << ' ' << store.z()[i] << ' '
+                << store.vx()[i] << ' ' << store.vy()[i] << ' ' << store.vz()[i] << ' '
+                << store.mass()[i] << ' ' << store.density()[i] << '\n';
+        }
+        out.flush();
+        return static_cast<bool>(out);
+    }
+};
@@ -5,13 +5,17 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <algorithm>
 #include <iostream>
+#include <string>
+#include <unordered_map>
 
 #include "shaders.hpp"
 
 class ShaderProgram {
 private:
     GLuint programId;
+    std::unordered_map<std::string, GLint> uniformLocations; // resolved at link time
     
 public:
     ShaderProgram(const char* vertexSource, const char* fragmentSource) {
@@ -33,6 +37,7 @@ public:
         glAttachShader(programId, fragmentShader);
         glLinkProgram(programId);
         checkCompileErrors(programId, "PROGRAM");
+        resolveUniforms();
 
         // Delete shaders as they're linked into the program and no longer necessary
         glDeleteShader(vertexShader);
@@ -47,33 +52,76 @@ public:
         glUseProgram(programId);
     }
 
-    void setBool(const std::string& name, bool value) const {
-        glUniform1i(glGetUniformLocation(programId, name.c_str()), static_cast<int>(value));
+    // Location of a default-block uniform, -1 when the program lacks it.
+    // Resolve once and pass the location to the setters on hot paths.
+    GLint getUniformLocation(const std::string& name) const {
+        auto found = uniformLocations.find(name);
+        return found != uniformLocations.end() ? found->second : -1;
     }
 
-    void setInt(const std::string& name, int value) const {
-        glUniform1i(glGetUniformLocation(programId, name.c_str()), value);
+    void setBool(GLint location, bool value) const {
+        glUniform1i(location, static_cast<int>(value));
     }
 
-    void setFloat(const std::string& name, float value) const {
-        glUniform1f(glGetUniformLocation(programId, name.c_str()), value);
+    void setInt(GLint location, int value) const {
+        glUniform1i(location, value);
     }
 
-    void setVec3(const std::string& name, const glm::vec3& value) const {
-        glUniform3fv(glGetUniformLocation(programId, name.c_str()), 1, glm::value_ptr(value));
+    void setFloat(GLint location, float value) const {
+        glUniform1f(location, value);
     }
 
-    void setVec4(const std::string& name, const glm::vec4& value) const {
-        glUniform4fv(glGetUniformLocation(programId, name.c_str()), 1, glm::value_ptr(value));
+    void setVec3(GLint location, const glm::vec3& value) const {
+        glUniform3fv(location, 1, glm::value_ptr(value));
     }
 
-    void setMat4(const std::string& name, const glm::mat4& mat) const {
-        glUniformMatrix4fv(glGetUniformLocation(programId, name.c_str()), 1, GL_FALSE, glm::value_ptr(mat));
+    void setVec4(GLint location, const glm::vec4& value) const {
+        glUniform4fv(location, 1, glm::value_ptr(value));
+    }
+
+    void setMat4(GLint location, const glm::mat4& mat) const {
+        glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(mat));
+    }
+
+    void setBool(const std::string& name, bool value) const { setBool(getUniformLocation(name), value); }
+    void setInt(const std::string& name, int value) const { setInt(getUniformLocation(name), value); }
+    void setFloat(const std::string& name, float value) const { setFloat(getUniformLocation(name), value); }
+    void setVec3(const std::string& name, const glm::vec3& value) const { setVec3(getUniformLocation(name), value); }
+    void setVec4(const std::string& name, const glm::vec4& value) const { setVec4(getUniformLocation(name), value); }
+    void setMat4(const std::string& name, const glm::mat4& mat) const { setMat4(getUniformLocation(name), mat); }
+
+    // Points the named uniform block at a GL_UNIFORM_BUFFER binding
+    void bindUniformBlock(const std::string& name, GLuint binding) const {
+        GLuint index = glGetUniformBlockIndex(programId, name.c_str());
+        if (index != GL_INVALID_INDEX) {
+            glUniformBlockBinding(programId, index, binding);
+        }
     }
 
     GLuint getId() const { return programId; }
 
 private:
+    // Looks up every active uniform once so setters never ask the driver
+    void resolveUniforms() {
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(programId, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(programId, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::string name(static_cast<size_t>(std::max(maxLength, 1)), '\0');
+        for (GLint i = 0; i < count; ++i) {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(programId, static_cast<GLuint>(i), maxLength, &length, &size, &type, &name[0]);
+            std::string uniform = name.substr(0, static_cast<size_t>(length));
+            GLint location = glGetUniformLocation(programId, uniform.c_str());
+            if (location < 0) continue; // member of a uniform block
+            if (uniform.size() > 3 && uniform.compare(uniform.size() - 3, 3, "[0]") == 0) {
+                uniform.resize(uniform.size() - 3);
+            }
+            uniformLocations[uniform] = location;
+        }
+    }
+
     void checkCompileErrors(GLuint shader, const std::string& type) {
         GLint success;
         char infoLog[1024];
@@ -1,13 +1,16 @@
 #pragma once
 
-// Shader sources
+// Shader sources. Every vertex shader reads the camera from the Frame
+// block, which the renderer fills once per frame.
 namespace Shaders {
     const char* vertexShaderSource = R"glsl(
     #version 330 core
     layout(location=0) in vec3 aPos;
     uniform mat4 model;
-    uniform mat4 view;
-    uniform mat4 projection;
+    layout(std140) uniform Frame {
+        mat4 view;
+        mat4 projection;
+    };
     out float lightIntensity;
     void main() {
         gl_Position = projection * view * model * vec4(aPos, 1.0);
@@ -17,6 +20,71 @@ namespace Shaders {
         lightIntensity = max(dot(normal, dirToCenter), 0.15);
     })glsl";
 
+    // Instanced unit sphere; position and radius and color come per
+    // instance, lighting as for the single-object shader. Glowing and plain
+    // bodies are drawn in separate runs that set GLOW.
+    const char* sphereVertexShaderSource = R"glsl(
+    #version 330 core
+    layout(location=0) in vec3 aPos;
+    layout(location=1) in vec4 instancePlacement;
+    layout(location=2) in vec4 instanceColor;
+    layout(std140) uniform Frame {
+        mat4 view;
+        mat4 projection;
+    };
+    out float lightIntensity;
+    flat out vec4 objectColor;
+    void main() {
+        vec3 worldPos = instancePlacement.xyz + aPos * instancePlacement.w;
+        gl_Position = projection * view * vec4(worldPos, 1.0);
+        vec3 dirToCenter = normalize(-worldPos);
+        lightIntensity = max(dot(aPos, dirToCenter), 0.15);
+        objectColor = instanceColor;
+    })glsl";
+
+    const char* sphereFragmentShaderSource = R"glsl(
+    #version 330 core
+    in float lightIntensity;
+    flat in vec4 objectColor;
+    uniform bool GLOW;
+    out vec4 FragColor;
+    void main() {
+        if (GLOW) {
+            FragColor = vec4(objectColor.rgb * 100000, objectColor.a);
+        } else {
+            float fade = smoothstep(0.0, 10.0, lightIntensity*10);
+            FragColor = vec4(objectColor.rgb * fade, objectColor.a);
+        }
+    })glsl";
+
+    // Flat grid displaced on the GPU. Each entry of the GridBodies block is
+    // a body's position and Schwarzschild radius (m); the array length must
+    // match Grid::MAX_GPU_BODIES. std140 vec4 arrays pack tightly.
+    const char* gridVertexShaderSource = R"glsl(
+    #version 330 core
+    layout(location=0) in vec3 aPos;
+    layout(std140) uniform GridBodies {
+        vec4 bodies[1024];
+    };
+    uniform int bodyCount;
+    uniform float planeY;
+    uniform mat4 model;
+    layout(std140) uniform Frame {
+        mat4 view;
+        mat4 projection;
+    };
+    out float lightIntensity;
+    void main() {
+        float sum = 0.0;
+        for (int b = 0; b < bodyCount; ++b) {
+            vec4 body = bodies[b];
+            float distance_m = length(body.xyz - vec3(aPos.x, planeY, aPos.z)) * 1000.0;
+            sum += sqrt(max(0.0, body.w * (distance_m - body.w)));
+        }
+        gl_Position = projection * view * model * vec4(aPos.x, 4.0 * sum, aPos.z, 1.0);
+        lightIntensity = 1.0;
+    })glsl";
+
     const char* fragmentShaderSource = R"glsl(
     #version 330 core
     in float lightIntensity;
@@ -4,13 +4,21 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <memory>
 
 #include "camera.hpp"   
+#include "checkpoint.hpp"
 #include "renderer.hpp"
 #include "physicsengine.hpp"
+#include "profiler.hpp"
+#include "simulationthread.hpp"
+#include "taskgraph.hpp"
+#include "trajectory.hpp"
+#include "threadpool.hpp"
+#include "scenario.hpp"
 #include "object.hpp"
 #include "grid.hpp"
 #include "inputhandler.hpp"
@@ -21,13 +29,28 @@
 
 class SimulationApp : public ISimulationCallbacks {
 private:
+    static constexpr size_t GRID_THREADS = 2;
+    static constexpr size_t FRAME_THREADS = 2;
+    static constexpr const char* CHECKPOINT_FILE = "simulation.ckpt";
+    static constexpr const char* TRAJECTORY_FILE = "simulation.trj";
+    static constexpr const char* PROFILE_FILE = "profile.json";
+
     GLFWwindow* window;
     Camera camera;
-    PhysicsEngine physics;
+    PhysicsEngine physics;          // owned by the simulation thread once it runs
+    SimulationThread simulation;
+    ThreadPool gridPool;            // grid updates on the render thread
     std::unique_ptr<Renderer> renderer;
     std::unique_ptr<Grid> grid;
     std::vector<std::shared_ptr<Object>> objects;
     std::unique_ptr<InputHandler> inputHandler;
+    TaskGraph frameGraph;           // CPU work of the next frame
+    glm::mat4 frameView;            // camera the next frame is recorded for
+    bool snapshotChanged;           // the next frame's snapshot is a new one
+    CheckpointWriter checkpoints;   // fed from the simulation thread
+    uint64_t seed;                  // scenario seed, stored in checkpoints
+    TrajectoryWriter trajectory;    // simulation thread only
+    bool recordingTrajectory;
     
     float deltaTime;
     float lastFrame;
@@ -38,17 +61,41 @@ public:
         : window(nullptr),
           camera(400.0f, 300.0f),
           physics(),
+          simulation(physics),
+          gridPool(GRID_THREADS),
+          frameGraph(FRAME_THREADS),
+          frameView(1.0f),
+          snapshotChanged(false),
+          seed(0),
+          recordingTrajectory(false),
           deltaTime(0.0f),
           lastFrame(0.0f),
           running(true) {}
 
     ~SimulationApp() {
+        frameGraph.wait();
+        simulation.stop();
         if (window) {
             glfwTerminate();
         }
     }
 
-    bool initialize() {
+    bool initialize(const std::string& scenarioSource = "default") {
+        // A checkpoint restores the engine itself, anything else is a scenario
+        const bool restoring = scenarioSource.compare(0, 11, "checkpoint:") == 0;
+        Scenario scenario;
+        std::vector<BodyAppearance> appearance;
+        if (restoring) {
+            if (!Checkpoint::restore(scenarioSource.substr(11), physics, &seed, &appearance)) {
+                return false;
+            }
+        } else {
+            if (!Scenario::load(scenarioSource, scenario)) {
+                return false;
+            }
+            seed = scenario.getSeed();
+        }
+
         // Initialize GLFW
         if (!glfwInit()) {
             std::cerr << "Failed to initialize GLFW" << std::endl;
@@ -78,7 +125,7 @@ public:
         
         // Create input handler
         inputHandler = std::make_unique<InputHandler>(
-            camera, physics, objects, deltaTime, running, *this);
+            camera, simulation, objects, deltaTime, running, *this);
         
         // Set up callbacks
         glfwSetCursorPosCallback(window, InputHandler::mouseCallback);
@@ -92,47 +139,74 @@ public:
         // Create grid
         grid = std::make_unique<Grid>();
         
-        // Create initial objects
-        createInitialObjects();
+        // Create initial objects, then hand the engine to its thread
+        if (restoring) {
+            adoptRestoredBodies(appearance);
+        } else {
+            createInitialObjects(scenario);
+        }
+        simulation.start();
+
+        // Prepare the first frame
+        buildFrameGraph();
+        frameView = camera.getViewMatrix();
+        frameGraph.run();
         
         return true;
     }
 
+    // Renders the newest snapshot every frame while the simulation thread
+    // steps at its own pace. The frame graph prepares frame k + 1 on its
+    // workers while this thread draws frame k and waits for the swap, so a
+    // frame costs the slowest of the two rather than their sum.
     void run() {
+        PROFILE_THREAD("render");
         while (!glfwWindowShouldClose(window) && running) {
+            PROFILE_SCOPE("frame");
+
+            // Frame k's snapshot, grid and draw list are ready once the graph is idle
+            {
+                PROFILE_SCOPE("wait for frame graph");
+                frameGraph.wait();
+            }
+
             // Calculate delta time
             float currentFrame = glfwGetTime();
             deltaTime = currentFrame - lastFrame;
             lastFrame = currentFrame;
             
-            // Process input
-            inputHandler->processInput(window);
+            // Process input; callbacks may change objects, so only while the graph is idle
+            {
+                PROFILE_SCOPE("input");
+                glfwPollEvents();
+                inputHandler->processInput(window);
+            }
             
-            // Update physics
-            physics.update(objects, deltaTime);
+            // Hand frame k to the GPU, then start preparing frame k + 1
+            grid->upload();
+            renderer->upload();
+            frameView = camera.getViewMatrix();
+            frameGraph.run();
             
-            // Update grid
-            grid->updateGrid(objects);
-            
-            // Render
+            // Render frame k
             renderer->beginFrame();
-            renderer->updateCamera(camera);
-            renderer->render(objects, *grid);
+            renderer->submit(*grid);
             
-            // Swap buffers and poll events
-            glfwSwapBuffers(window);
-            glfwPollEvents();
+            // Swap buffers
+            {
+                PROFILE_SCOPE("swap buffers");
+                glfwSwapBuffers(window);
+            }
         }
+        frameGraph.wait();
     }
 
     // ISimulationCallbacks implementation
     void createObject() override {
-        objects.push_back(std::make_shared<Object>(
-            glm::vec3(0.0f, 0.0f, 0.0f),
-            glm::vec3(0.0f, 0.0f, 0.0f),
-            Constants::DEFAULT_MASS
-        ));
-        objects.back()->setInitializing(true);
+        const glm::vec3 position(0.0f, 0.0f, 0.0f), velocity(0.0f, 0.0f, 0.0f);
+        BodyId id = simulation.spawn(position, velocity, Constants::DEFAULT_MASS, 3344.0f, true);
+        objects.push_back(std::make_shared<Object>(simulation, id, glm::vec4(1.0f, 0.0f, 0.0f, 1.0f), false, true));
+        objects.back()->setPendingAdd(position, velocity, Constants::DEFAULT_MASS, 3344.0f);
     }
 
     void launchObject() override {
@@ -150,32 +224,129 @@ public:
         camera.processScroll(yoffset, deltaTime);
     }
 
+    void toggleGridDisplacement() override {
+        grid->setGpuDisplacement(!grid->getGpuDisplacement());
+        std::cout << "Grid displacement: " << (grid->getGpuDisplacement() ? "GPU" : "CPU") << std::endl;
+    }
+
+    // Writes whatever the profiler's rings still hold
+    void dumpProfile() override {
+        if (!Profiler::ENABLED) {
+            std::cout << "Profiling is compiled out; build with -DNBODY_PROFILE" << std::endl;
+            return;
+        }
+        long long events = Profiler::instance().writeChromeTrace(PROFILE_FILE);
+        if (events >= 0) {
+            std::cout << "Wrote " << events << " profile events to " << PROFILE_FILE << std::endl;
+        }
+    }
+
+    // Frames are captured on the simulation thread after each update and
+    // written in the background; stopping flushes and indexes the file
+    void toggleTrajectory() override {
+        recordingTrajectory = !recordingTrajectory;
+        if (recordingTrajectory) {
+            simulation.post([this](PhysicsEngine& engine) {
+                if (trajectory.open(TRAJECTORY_FILE)) {
+                    trajectory.record(engine);
+                    std::cout << "Recording trajectory to " << TRAJECTORY_FILE << std::endl;
+                }
+            });
+            simulation.observe([this](PhysicsEngine& engine) { trajectory.record(engine); });
+        } else {
+            simulation.observe(nullptr);
+            simulation.post([this](PhysicsEngine&) {
+                uint64_t frames = trajectory.getRecordedFrames();
+                uint64_t dropped = trajectory.getDroppedFrames();
+                if (trajectory.isOpen() && trajectory.close()) {
+                    std::cout << "Recorded " << frames << " frames to " << TRAJECTORY_FILE;
+                    if (dropped > 0) std::cout << ", " << dropped << " dropped";
+                    std::cout << std::endl;
+                }
+            });
+        }
+    }
+
+    // Captured between updates on the simulation thread, written in the
+    // background; the bodies' looks are taken here, where the objects live
+    void saveCheckpoint() override {
+        uint64_t scenarioSeed = seed;
+        std::vector<BodyAppearance> appearance;
+        appearance.reserve(objects.size());
+        for (const auto& obj : objects) {
+            const glm::vec4& color = obj->getColor();
+            appearance.push_back({obj->getId(), obj->isGlowingBody() ? 1u : 0u, {color.x, color.y, color.z, color.w}});
+        }
+        simulation.post([this, scenarioSeed, appearance](PhysicsEngine& engine) {
+            if (checkpoints.submit(engine, scenarioSeed, CHECKPOINT_FILE, appearance)) {
+                std::cout << "Saving checkpoint at step " << engine.getStepCount() << " to " << CHECKPOINT_FILE << std::endl;
+            } else {
+                std::cout << "Checkpoint skipped, the previous one is still being written" << std::endl;
+            }
+        });
+    }
+
 private:
-    void createInitialObjects() {
-        // Create initial celestial bodies
-        objects.push_back(std::make_shared<Object>(
-            glm::vec3(-5000, 650, -350),
-            glm::vec3(30000, 15000, 0),
-            5.97219 * pow(10, 22),
-            5515,
-            glm::vec4(0.0f, 1.0f, 1.0f, 1.0f)
-        ));
-        
-        objects.push_back(std::make_shared<Object>(
-            glm::vec3(5000, 650, -350),
-            glm::vec3(15000, 30000, 0),
-            5.97219 * pow(10, 22),
-            5515,
-            glm::vec4(0.0f, 1.0f, 1.0f, 1.0f)
-        ));
-        
-        objects.push_back(std::make_shared<Object>(
-            glm::vec3(0, 0, -350),
-            glm::vec3(0, 0, 0),
-            1.989 * pow(10, 25),
-            8000,
-            glm::vec4(1.0f, 0.929f, 0.176f, 1.0f),
-            true // Glowing
-        ));
+    // Snapshot -> {grid field, draw list}. Neither of the two later tasks
+    // writes what the other reads, so they run side by side. A snapshot is
+    // only published after the simulation stepped or ran a command, so an
+    // unchanged one means the grid has nothing to redo.
+    void buildFrameGraph() {
+        TaskGraph::TaskId snapshot = frameGraph.add([this] {
+            PROFILE_SCOPE("acquire snapshot");
+            snapshotChanged = simulation.acquireSnapshot();
+            if (snapshotChanged) {
+                syncObjects();
+            }
+        });
+        frameGraph.add([this] { grid->prepare(simulation.getSnapshot(), gridPool, snapshotChanged); }, {snapshot});
+        frameGraph.add([this] {
+            renderer->record(objects, frameView, simulation.getBlend(SimulationThread::Clock::now()));
+        }, {snapshot});
+    }
+
+    // Drops objects whose bodies were merged away
+    void syncObjects() {
+        objects.erase(std::remove_if(objects.begin(), objects.end(),
+                                     [](const std::shared_ptr<Object>& obj) { return !obj->isAlive(); }),
+                      objects.end());
+    }
+
+    void createInitialObjects(const Scenario& scenario) {
+        for (const BodySpec& spec : scenario.getBodies()) {
+            addObject(spec.position, spec.velocity, spec.mass, spec.density, spec.color, spec.glowing);
+        }
+        BodyStore& bodies = physics.getBodies();
+        const size_t first = bodies.size();
+        scenario.generate(bodies, physics.getThreadPool());
+        objects.reserve(objects.size() + bodies.size() - first);
+        for (size_t slot = first; slot < bodies.size(); ++slot) {
+            objects.push_back(std::make_shared<Object>(simulation, bodies.idAt(slot), scenario.getGeneratedColor()));
+        }
+    }
+
+    // Bodies missing from the checkpoint's appearance table, as in one
+    // written by the headless driver, get the default look
+    void adoptRestoredBodies(const std::vector<BodyAppearance>& appearance) {
+        const BodyStore& bodies = physics.getBodies();
+        std::vector<const BodyAppearance*> byId(bodies.nextId(), nullptr);
+        for (const BodyAppearance& entry : appearance) {
+            if (entry.id < byId.size()) byId[entry.id] = &entry;
+        }
+        for (size_t slot = 0; slot < bodies.size(); ++slot) {
+            const BodyId id = bodies.idAt(slot);
+            if (const BodyAppearance* look = byId[id]) {
+                const glm::vec4 color(look->color[0], look->color[1], look->color[2], look->color[3]);
+                objects.push_back(std::make_shared<Object>(simulation, id, color, look->glowing != 0));
+            } else {
+                objects.push_back(std::make_shared<Object>(simulation, id));
+            }
+        }
+    }
+
+    void addObject(const glm::dvec3& position, const glm::dvec3& velocity, double mass, double density,
+                   const glm::vec4& color, bool glow = false) {
+        BodyId id = physics.getBodies().add(position, velocity, mass, density);
+        objects.push_back(std::make_shared<Object>(simulation, id, color, glow));
     }
 };
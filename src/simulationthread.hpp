@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bodystore.hpp"
+#include "physicsengine.hpp"
+#include "profiler.hpp"
+#include "triplebuffer.hpp"
+
+// Runs a PhysicsEngine on its own thread. The render thread never touches
+// the engine: it changes it by posting commands, which run on the
+// simulation thread between updates in the order they were posted, and it
+// reads the bodies from snapshots published through a triple buffer after
+// every update that stepped or ran commands. A snapshot is published right
+// after its step, so it carries the time that step finished and the reader
+// blends towards it over the following step on its own clock.
+class SimulationThread {
+public:
+    using Command = std::function<void(PhysicsEngine&)>;
+    using Clock = std::chrono::steady_clock;
+
+private:
+    struct Snapshot {
+        BodyStore bodies;
+        Clock::time_point steppedAt; // when the step that left these bodies finished
+        float stepLength = 1.0f;     // wall-clock seconds per step
+    };
+
+    PhysicsEngine& physics;
+    TripleBuffer<Snapshot> snapshots;
+    Clock::time_point lastStep; // simulation thread only
+    std::thread thread;
+    std::atomic<bool> running;
+
+    std::mutex commandMutex;
+    std::condition_variable commandPosted;
+    std::vector<Command> pending;
+    std::vector<Command> executing; // simulation thread only
+    Command observer;               // simulation thread only, runs after every update that stepped
+
+    BodyId nextId; // render thread only, mirrors the ids the engine will hand out
+
+public:
+    explicit SimulationThread(PhysicsEngine& physics)
+        : physics(physics), running(false), nextId(0) {}
+
+    ~SimulationThread() { stop(); }
+
+    SimulationThread(const SimulationThread&) = delete;
+    SimulationThread& operator=(const SimulationThread&) = delete;
+
+    // Publishes the engine's current bodies and starts stepping. Bodies
+    // added directly before start() are part of the first snapshot.
+    void start() {
+        if (running) return;
+        nextId = physics.getBodies().nextId();
+        lastStep = Clock::now();
+        publish();
+        snapshots.acquire();
+        running = true;
+        thread = std::thread([this] { loop(); });
+    }
+
+    void stop() {
+        if (!running) return;
+        {
+            std::lock_guard<std::mutex> lock(commandMutex);
+            running = false;
+        }
+        commandPosted.notify_one();
+        thread.join();
+    }
+
+    // Runs the command on the simulation thread before its next update
+    void post(Command command) {
+        {
+            std::lock_guard<std::mutex> lock(commandMutex);
+            pending.push_back(std::move(command));
+        }
+        commandPosted.notify_one();
+    }
+
+    // Runs observer on the simulation thread after every update that took
+    // steps, until replaced; an empty one stops observing
+    void observe(Command newObserver) {
+        post([this, newObserver](PhysicsEngine&) { observer = newObserver; });
+    }
+
+    // Posts the addition of a body and returns the id it will get. Only the
+    // render thread adds bodies while the thread runs, so ids are known
+    // before the simulation thread gets to them.
+    BodyId spawn(const glm::vec3& position, const glm::vec3& velocity, float mass, float density,
+                 bool initializing = false) {
+        BodyId id = nextId++;
+        post([=](PhysicsEngine& engine) {
+            BodyStore& bodies = engine.getBodies();
+            BodyId added = bodies.add(glm::dvec3(position), glm::dvec3(velocity), mass, density);
+            if (initializing) bodies.setInitializing(added, true);
+        });
+        return id;
+    }
+
+    // Render thread: switches to the newest published snapshot, if any.
+    // The snapshot read afterwards stays unchanged until the next call.
+    bool acquireSnapshot() { return snapshots.acquire(); }
+    const BodyStore& getSnapshot() const { return snapshots.readBuffer().bodies; }
+
+    // Render thread: how far the snapshot's bodies are to be drawn from
+    // their previous towards their current positions at the given time
+    float getBlend(Clock::time_point now) const {
+        const Snapshot& snapshot = snapshots.readBuffer();
+        float blend = std::chrono::duration<float>(now - snapshot.steppedAt).count() / snapshot.stepLength;
+        return std::min(1.0f, std::max(0.0f, blend));
+    }
+
+private:
+    void loop() {
+        PROFILE_THREAD("simulation");
+        Clock::time_point last = Clock::now();
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(commandMutex);
+                if (!running) break;
+                executing.swap(pending);
+            }
+            {
+                PROFILE_SCOPE("commands");
+                for (Command& command : executing) command(physics);
+            }
+            bool changed = !executing.empty();
+            executing.clear();
+
+            Clock::time_point now = Clock::now();
+            bool stepped = physics.update(std::chrono::duration<float>(now - last).count()) > 0;
+            last = now;
+            if (stepped) lastStep = Clock::now();
+            if (stepped && observer) observer(physics);
+            changed |= stepped;
+            if (changed) publish();
+
+            // Sleep until the next step is due or a command arrives
+            auto wait = std::chrono::duration<float>(physics.timeUntilNextStep());
+            std::unique_lock<std::mutex> lock(commandMutex);
+            commandPosted.wait_for(lock, wait, [this] { return !running || !pending.empty(); });
+        }
+    }
+
+    // Copies into the back slot, which reuses its columns' capacity
+    void publish() {
+        PROFILE_SCOPE("publish snapshot");
+        Snapshot& snapshot = snapshots.writeBuffer();
+        snapshot.bodies = physics.getBodies();
+        snapshot.steppedAt = lastStep;
+        snapshot.stepLength = physics.getFixedTimeStep();
+        snapshots.publish();
+    }
+};
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "utils.hpp"
+
+// Per-body attributes of one instanced sphere
+struct SphereInstance {
+    float x, y, z, radius;
+    float r, g, b, a;
+};
+
+// Indexed unit spheres at a few levels of detail, shared by every body.
+// All levels live in one vertex and one index buffer. Each frame a body
+// gets the level that fits its projected radius in pixels. The instances
+// of a frame are uploaded once, grouped, and each group is drawn with one
+// glDrawElementsInstanced call. Attribute 0 is the mesh position, which is
+// also the normal of a unit sphere; 1 and 2 advance once per instance:
+// position and radius, color.
+class SphereMeshCache {
+public:
+    struct Level {
+        int stacks, sectors;
+        float maxPixels; // largest projected radius drawn at this level
+    };
+
+    static constexpr int LEVEL_COUNT = 4;
+    static constexpr Level LEVELS[LEVEL_COUNT] = {
+        {4, 6, 4.0f},     // 36 triangles
+        {8, 12, 16.0f},   // 168 triangles
+        {16, 24, 64.0f},  // 720 triangles
+        {32, 48, 1e30f},  // 2976 triangles
+    };
+
+private:
+    struct Range {
+        size_t firstIndex, indexCount;
+    };
+
+    GLuint VAO, vertexVBO, indexEBO, instanceVBO;
+    Range ranges[LEVEL_COUNT];
+    size_t instanceCapacity;
+
+public:
+    SphereMeshCache() : instanceCapacity(0) {
+        std::vector<float> vertices;
+        std::vector<GLushort> indices;
+        for (int level = 0; level < LEVEL_COUNT; ++level) {
+            ranges[level].firstIndex = indices.size();
+            appendSphere(LEVELS[level].stacks, LEVELS[level].sectors, vertices, indices);
+            ranges[level].indexCount = indices.size() - ranges[level].firstIndex;
+        }
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &vertexVBO);
+        glGenBuffers(1, &indexEBO);
+        glGenBuffers(1, &instanceVBO);
+
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, vertexVBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        for (GLuint attribute = 1; attribute <= 2; ++attribute) {
+            glEnableVertexAttribArray(attribute);
+            glVertexAttribDivisor(attribute, 1);
+        }
+        glBindVertexArray(0);
+    }
+
+    ~SphereMeshCache() {
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &vertexVBO);
+        glDeleteBuffers(1, &indexEBO);
+        glDeleteBuffers(1, &instanceVBO);
+    }
+
+    SphereMeshCache(const SphereMeshCache&) = delete;
+    SphereMeshCache& operator=(const SphereMeshCache&) = delete;
+
+    // Level for a sphere whose radius covers this many pixels on screen
+    static int levelFor(float projectedPixels) {
+        int level = 0;
+        while (level < LEVEL_COUNT - 1 && projectedPixels > LEVELS[level].maxPixels) ++level;
+        return level;
+    }
+
+    // Radius in pixels of a sphere seen through view and projection on a
+    // viewport this many pixels tall. Spheres reaching the near side of
+    // the camera count as infinitely large.
+    static float projectedRadius(const glm::vec3& center, float radius, const glm::mat4& view,
+                                 const glm::mat4& projection, float viewportHeight) {
+        glm::vec4 eye = view * glm::vec4(center, 1.0f);
+        float depth = -eye.z;
+        if (depth <= radius) return 1e30f;
+        return radius / depth * projection[1][1] * 0.5f * viewportHeight;
+    }
+
+    // Streams this frame's instances; the buffer only grows
+    void upload(const std::vector<SphereInstance>& instances) {
+        if (instances.empty()) return;
+
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        if (instances.size() > instanceCapacity) {
+            instanceCapacity = std::max(instances.size(), 2 * instanceCapacity);
+            glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(SphereInstance), nullptr, GL_STREAM_DRAW);
+        }
+        glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(SphereInstance), instances.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Draws count uploaded instances starting at first with one level's mesh
+    void draw(int level, size_t first, size_t count) const {
+        if (count == 0) return;
+
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        // GL 3.3 has no base instance, so point the attributes at the block
+        pointInstanceAttributes(first * sizeof(SphereInstance));
+        glDrawElementsInstanced(GL_TRIANGLES, static_cast<GLsizei>(ranges[level].indexCount), GL_UNSIGNED_SHORT,
+                                (void*)(ranges[level].firstIndex * sizeof(GLushort)), static_cast<GLsizei>(count));
+        glBindVertexArray(0);
+    }
+
+private:
+    static void pointInstanceAttributes(size_t offset) {
+        const GLsizei stride = sizeof(SphereInstance);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (void*)(offset + offsetof(SphereInstance, x)));
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride, (void*)(offset + offsetof(SphereInstance, r)));
+    }
+
+    // Rings of sectors + 1 vertices from pole to pole, the seam duplicated
+    // so each ring closes; the pole caps skip their degenerate triangles
+    static void appendSphere(int stacks, int sectors, std::vector<float>& vertices, std::vector<GLushort>& indices) {
+        const GLushort base = static_cast<GLushort>(vertices.size() / 3);
+        for (int i = 0; i <= stacks; ++i) {
+            float theta = static_cast<float>(i) / stacks * glm::pi<float>();
+            for (int j = 0; j <= sectors; ++j) {
+                float phi = static_cast<float>(j) / sectors * 2 * glm::pi<float>();
+                glm::vec3 v = Utils::sphericalToCartesian(1.0f, theta, phi);
+                vertices.insert(vertices.end(), {v.x, v.y, v.z});
+            }
+        }
+
+        for (int i = 0; i < stacks; ++i) {
+            for (int j = 0; j < sectors; ++j) {
+                GLushort v1 = static_cast<GLushort>(base + i * (sectors + 1) + j);
+                GLushort v2 = static_cast<GLushort>(v1 + 1);
+                GLushort v3 = static_cast<GLushort>(v1 + sectors + 1);
+                GLushort v4 = static_cast<GLushort>(v3 + 1);
+                if (i != 0) indices.insert(indices.end(), {v1, v2, v3});
+                if (i != stacks - 1) indices.insert(indices.end(), {v2, v4, v3});
+            }
+        }
+    }
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "profiler.hpp"
+
+// Small dependency-driven task graph run on its own worker threads. Tasks
+// are added once, each naming the earlier tasks whose results it reads, so
+// the graph is acyclic by construction. run() starts every task without
+// dependencies and returns at once; a finishing task releases the
+// dependents it was the last dependency of. wait() blocks until the whole
+// graph has run, after which it may be run again.
+class TaskGraph {
+public:
+    using TaskId = size_t;
+
+private:
+    struct Task {
+        std::function<void()> work;
+        std::vector<TaskId> dependents;
+        size_t dependencyCount;
+        size_t waitingOn; // dependencies not yet finished in this run
+    };
+
+    std::vector<Task> tasks;
+    std::vector<std::thread> workers;
+    std::deque<TaskId> ready;
+    std::mutex mutex;
+    std::condition_variable taskReady;
+    std::condition_variable graphDone;
+    size_t unfinished;
+    bool stopping;
+
+public:
+    explicit TaskGraph(size_t threads = 2) : unfinished(0), stopping(false) {
+        for (size_t t = 0; t < std::max<size_t>(1, threads); ++t) {
+            workers.emplace_back([this, t] {
+                PROFILE_THREAD("task graph " + std::to_string(t + 1));
+                workerLoop();
+            });
+        }
+    }
+
+    ~TaskGraph() {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        taskReady.notify_all();
+        for (std::thread& worker : workers) worker.join();
+    }
+
+    TaskGraph(const TaskGraph&) = delete;
+    TaskGraph& operator=(const TaskGraph&) = delete;
+
+    // Only while the graph is idle
+    TaskId add(std::function<void()> work, std::initializer_list<TaskId> dependencies = {}) {
+        TaskId id = tasks.size();
+        tasks.push_back({std::move(work), {}, dependencies.size(), 0});
+        for (TaskId dependency : dependencies) tasks[dependency].dependents.push_back(id);
+        return id;
+    }
+
+    void run() {
+        if (tasks.empty()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            unfinished = tasks.size();
+            for (TaskId id = 0; id < tasks.size(); ++id) {
+                tasks[id].waitingOn = tasks[id].dependencyCount;
+                if (tasks[id].waitingOn == 0) ready.push_back(id);
+            }
+        }
+        taskReady.notify_all();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        graphDone.wait(lock, [this] { return unfinished == 0; });
+    }
+
+    size_t size() const { return tasks.size(); }
+
+private:
+    void workerLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            taskReady.wait(lock, [this] { return stopping || !ready.empty(); });
+            if (ready.empty()) return; // stopping
+
+            TaskId id = ready.front();
+            ready.pop_front();
+            lock.unlock();
+            tasks[id].work();
+            lock.lock();
+
+            size_t released = 0;
+            for (TaskId dependent : tasks[id].dependents) {
+                if (--tasks[dependent].waitingOn == 0) {
+                    ready.push_back(dependent);
+                    ++released;
+                }
+            }
+            if (released > 1) taskReady.notify_all();
+            else if (released == 1) taskReady.notify_one();
+            if (--unfinished == 0) graphDone.notify_all();
+        }
+    }
+};
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "profiler.hpp"
+
+// Persistent work-stealing thread pool.
+//
+// parallelFor splits [0, count) into fixed-size chunks that only depend on
+// count and grain, never on the number of threads, so any loop whose chunks
+// write disjoint outputs gives identical results for every thread count.
+// Each worker owns a deque: it pops its own tasks from the back and steals
+// from the front of the others. The calling thread helps until its job is
+// done, which also makes nested parallelFor calls from inside a task safe.
+class ThreadPool {
+public:
+    struct ThreadTiming {
+        double busySeconds;
+        uint64_t tasks;
+    };
+
+private:
+    struct Job {
+        void (*invoke)(void* context, size_t begin, size_t end);
+        void* context;
+        const char* label; // profile scope of the caller, if any
+        std::atomic<size_t> remaining;
+    };
+
+    struct Task {
+        Job* job;
+        size_t begin;
+        size_t end;
+    };
+
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    struct alignas(64) TimingSlot {
+        std::atomic<uint64_t> busyNanoseconds{0};
+        std::atomic<uint64_t> tasks{0};
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkerQueue>> queues;   // one per worker
+    std::unique_ptr<TimingSlot[]> timings;              // slot 0 is shared by outside callers
+    std::atomic<size_t> pendingTasks;
+    std::atomic<size_t> nextQueue;
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    bool stopping;
+    size_t threadCount;
+
+    static int& currentWorker() {
+        thread_local int index = -1;
+        return index;
+    }
+    static const ThreadPool*& currentPool() {
+        thread_local const ThreadPool* pool = nullptr;
+        return pool;
+    }
+
+public:
+    // threadCount includes the calling thread, so 1 means fully serial
+    explicit ThreadPool(size_t threads = 0)
+        : pendingTasks(0), nextQueue(0), stopping(false), threadCount(0) {
+        start(threads);
+    }
+
+    ~ThreadPool() { stop(); }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    static size_t defaultThreadCount() {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    size_t getThreadCount() const { return threadCount; }
+
+    void setThreadCount(size_t threads) {
+        stop();
+        start(threads);
+    }
+
+    // Runs fn(begin, end) over [0, count) in chunks of at most grain items
+    template <typename Function>
+    void parallelFor(size_t count, size_t grain, Function&& fn) {
+        if (count == 0) return;
+        grain = std::max<size_t>(1, grain);
+        size_t chunks = (count + grain - 1) / grain;
+
+        if (workers.empty() || chunks == 1) {
+            auto begin = std::chrono::steady_clock::now();
+            for (size_t c = 0; c < chunks; ++c) {
+                fn(c * grain, std::min(count, (c + 1) * grain));
+            }
+            recordTiming(callerSlot(), begin, chunks);
+            return;
+        }
+
+        using FunctionType = typename std::remove_reference<Function>::type;
+        Job job;
+        job.invoke = [](void* context, size_t b, size_t e) { (*static_cast<FunctionType*>(context))(b, e); };
+        job.context = const_cast<void*>(static_cast<const void*>(&fn));
+        job.label = PROFILE_CURRENT_SCOPE();
+        job.remaining.store(chunks, std::memory_order_relaxed);
+
+        // Outside callers spread the chunks over every queue; workers keep
+        // them local and let idle threads steal
+        int self = currentPool() == this ? currentWorker() : -1;
+        size_t queueCount = queues.size();
+        size_t first = nextQueue.fetch_add(1, std::memory_order_relaxed);
+        pendingTasks.fetch_add(chunks, std::memory_order_release);
+        for (size_t c = 0; c < chunks; ++c) {
+            size_t q = self >= 0 ? size_t(self) : (first + c) % queueCount;
+            std::lock_guard<std::mutex> lock(queues[q]->mutex);
+            queues[q]->tasks.push_back({&job, c * grain, std::min(count, (c + 1) * grain)});
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wakeUp.notify_all();
+
+        // Help out until every chunk of this job has run
+        while (job.remaining.load(std::memory_order_acquire) != 0) {
+            Task task;
+            if (takeTask(self, task)) {
+                runTask(task, self);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    std::vector<ThreadTiming> getTimings() const {
+        std::vector<ThreadTiming> result(threadCount);
+        for (size_t t = 0; t < threadCount; ++t) {
+            result[t].busySeconds = timings[t].busyNanoseconds.load(std::memory_order_relaxed) * 1.0e-9;
+            result[t].tasks = timings[t].tasks.load(std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+    void resetTimings() {
+        for (size_t t = 0; t < threadCount; ++t) {
+            timings[t].busyNanoseconds.store(0, std::memory_order_relaxed);
+            timings[t].tasks.store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    void start(size_t threads) {
+        threadCount = threads == 0 ? defaultThreadCount() : threads;
+        timings.reset(new TimingSlot[threadCount]);
+        stopping = false;
+
+        size_t workerCount = threadCount - 1;
+        for (size_t w = 0; w < workerCount; ++w) {
+            queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+        }
+        for (size_t w = 0; w < workerCount; ++w) {
+            workers.emplace_back([this, w]() { workerLoop(static_cast<int>(w)); });
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+        queues.clear();
+    }
+
+    void workerLoop(int index) {
+        currentWorker() = index;
+        currentPool() = this;
+        PROFILE_THREAD("pool worker " + std::to_string(index + 1));
+
+        while (true) {
+            Task task;
+            if (takeTask(index, task)) {
+                runTask(task, index);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wakeUp.wait(lock, [this]() {
+                return stopping || pendingTasks.load(std::memory_order_acquire) != 0;
+            });
+            if (stopping) return;
+        }
+    }
+
+    bool takeTask(int self, Task& task) {
+        if (self >= 0) {
+            WorkerQueue& own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = own.tasks.back();
+                own.tasks.pop_back();
+                pendingTasks.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+
+        size_t queueCount = queues.size();
+        size_t start = self >= 0 ? size_t(self) + 1 : 0;
+        for (size_t k = 0; k < queueCount; ++k) {
+            WorkerQueue& victim = *queues[(start + k) % queueCount];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                pendingTasks.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void runTask(const Task& task, int self) {
+        auto begin = std::chrono::steady_clock::now();
+        {
+            PROFILE_SCOPE(task.job->label ? task.job->label : "parallel task");
+            task.job->invoke(task.job->context, task.begin, task.end);
+        }
+        recordTiming(self >= 0 ? size_t(self) + 1 : 0, begin, 1);
+        task.job->remaining.fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+    size_t callerSlot() const {
+        return currentPool() == this && currentWorker() >= 0 ? size_t(currentWorker()) + 1 : 0;
+    }
+
+    void recordTiming(size_t slot, std::chrono::steady_clock::time_point begin, uint64_t tasks) {
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin);
+        timings[slot].busyNanoseconds.fetch_add(static_cast<uint64_t>(elapsed.count()), std::memory_order_relaxed);
+        timings[slot].tasks.fetch_add(tasks, std::memory_order_relaxed);
+    }
+};
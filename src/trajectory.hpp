@@ -0,0 +1,670 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bodystore.hpp"
+#include "mappedfile.hpp"
+#include "physicsengine.hpp"
+#include "profiler.hpp"
+
+// Positions and velocities of every body at one step, in store order
+struct TrajectoryFrame {
+    uint64_t step;
+    double time;
+    std::vector<BodyId> ids;
+    std::vector<float> x, y, z, vx, vy, vz;
+
+    size_t size() const { return ids.size(); }
+};
+
+// Trajectory file format. A fixed little-endian header is followed by
+// chunks of consecutive frames and, once the writer closes, an index of
+// the chunks and a footer pointing at it. Every chunk starts from nothing,
+// so any one of them decodes on its own; a file whose writer never closed
+// is still readable by walking the chunk headers.
+//
+// Positions and velocities are quantized to multiples of a fixed quantum
+// per file. Each quantized component is predicted from the same body in
+// the previous two frames of its chunk (linearly when both exist) and
+// only the zigzag varint of the residual is stored, so smooth orbits
+// sampled densely cost one or two bytes per component.
+class Trajectory {
+public:
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t COMPONENTS = 6; // x, y, z, vx, vy, vz
+
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t interval;
+        double positionQuantum;
+        double velocityQuantum;
+    };
+    static_assert(sizeof(FileHeader) == 32, "trajectory header must not be padded");
+
+    struct ChunkHeader {
+        char magic[4];
+        uint32_t frameCount;
+        uint64_t firstStep;
+        uint64_t lastStep;
+        uint64_t payloadBytes;
+    };
+    static_assert(sizeof(ChunkHeader) == 32, "chunk header must not be padded");
+
+    // Index entry of one chunk; offset is where its header starts
+    struct ChunkInfo {
+        uint64_t offset;
+        uint64_t firstStep;
+        uint64_t lastStep;
+        uint64_t frameCount;
+    };
+    static_assert(sizeof(ChunkInfo) == 32, "index entry must not be padded");
+
+    struct Footer {
+        uint64_t indexOffset;
+        uint64_t chunkCount;
+        char magic[8];
+    };
+    static_assert(sizeof(Footer) == 24, "trajectory footer must not be padded");
+
+    static constexpr char FILE_MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'T', 'R', 'J'};
+    static constexpr char CHUNK_MAGIC[4] = {'C', 'H', 'N', 'K'};
+    static constexpr char INDEX_MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'I', 'D', 'X'};
+
+    // Quantized values stay far enough from the int64 range that
+    // predictions and residuals cannot overflow
+    static constexpr double QUANTIZED_LIMIT = 1.0e18;
+
+    static int64_t quantize(float value, double quantum) {
+        double scaled = std::nearbyint(double(value) / quantum);
+        if (!(scaled == scaled)) return 0; // NaN
+        return static_cast<int64_t>(std::max(-QUANTIZED_LIMIT, std::min(QUANTIZED_LIMIT, scaled)));
+    }
+
+    static float dequantize(int64_t value, double quantum) {
+        return static_cast<float>(double(value) * quantum);
+    }
+
+    // Predicts each body's quantized components from the previous two
+    // frames of the chunk, matched by id. Encoder and decoder run the same
+    // predictor over the same quantized values, so they agree exactly.
+    class Predictor {
+    private:
+        static constexpr uint32_t ABSENT = ~uint32_t(0);
+
+        struct History {
+            std::vector<BodyId> ids;
+            std::vector<int64_t> values; // COMPONENTS runs of ids.size() values
+            std::vector<uint32_t> indexOf; // id -> index in this frame, ABSENT if missing
+        };
+
+        History frames[3];
+        size_t current;
+        size_t framesSeen;
+        const History* previous;
+        const History* beforePrevious;
+
+    public:
+        Predictor() : current(0), framesSeen(0), previous(nullptr), beforePrevious(nullptr) {}
+
+        // Forgets everything, as at the start of a chunk
+        void reset() {
+            for (History& history : frames) {
+                for (BodyId id : history.ids) history.indexOf[id] = ABSENT;
+                history.ids.clear();
+            }
+            framesSeen = 0;
+        }
+
+        // Starts the next frame with these ids in this order
+        void beginFrame(const BodyId* ids, size_t count) {
+            current = framesSeen % 3;
+            previous = framesSeen >= 1 ? &frames[(framesSeen + 2) % 3] : nullptr;
+            beforePrevious = framesSeen >= 2 ? &frames[(framesSeen + 1) % 3] : nullptr;
+            ++framesSeen;
+
+            History& history = frames[current];
+            for (BodyId id : history.ids) history.indexOf[id] = ABSENT;
+            history.ids.assign(ids, ids + count);
+            history.values.resize(COMPONENTS * count);
+            for (size_t i = 0; i < count; ++i) {
+                if (ids[i] >= history.indexOf.size()) history.indexOf.resize(size_t(ids[i]) + 1, ABSENT);
+                history.indexOf[ids[i]] = static_cast<uint32_t>(i);
+            }
+        }
+
+        int64_t predict(size_t component, size_t index) const {
+            const History& history = frames[current];
+            const BodyId id = history.ids[index];
+            const size_t last = find(previous, id);
+            if (last == ABSENT) return 0;
+            const int64_t lastValue = previous->values[component * previous->ids.size() + last];
+            const size_t before = find(beforePrevious, id);
+            if (before == ABSENT) return lastValue;
+            return 2 * lastValue - beforePrevious->values[component * beforePrevious->ids.size() + before];
+        }
+
+        void store(size_t component, size_t index, int64_t value) {
+            History& history = frames[current];
+            history.values[component * history.ids.size() + index] = value;
+        }
+
+    private:
+        static size_t find(const History* history, BodyId id) {
+            if (!history || id >= history->indexOf.size()) return ABSENT;
+            return history->indexOf[id];
+        }
+    };
+
+    // Appends the payload of a chunk of frames
+    static void encodeChunk(const TrajectoryFrame* frames, size_t frameCount, double positionQuantum,
+                            double velocityQuantum, Predictor& predictor, std::vector<uint8_t>& out) {
+        predictor.reset();
+        const uint64_t firstStep = frames[0].step;
+        for (size_t f = 0; f < frameCount; ++f) {
+            const TrajectoryFrame& frame = frames[f];
+            const size_t count = frame.size();
+            putVarint(out, frame.step - firstStep);
+            putRaw(out, frame.time);
+            putVarint(out, count);
+
+            // Ids handed out in order mostly follow each other
+            int64_t expected = 0;
+            for (BodyId id : frame.ids) {
+                putVarint(out, zigzag(int64_t(id) - expected));
+                expected = int64_t(id) + 1;
+            }
+
+            predictor.beginFrame(frame.ids.data(), count);
+            const std::vector<float>* columns[COMPONENTS] = {&frame.x, &frame.y, &frame.z,
+                                                             &frame.vx, &frame.vy, &frame.vz};
+            for (size_t c = 0; c < COMPONENTS; ++c) {
+                const double quantum = c < 3 ? positionQuantum : velocityQuantum;
+                const float* values = columns[c]->data();
+                for (size_t i = 0; i < count; ++i) {
+                    const int64_t q = quantize(values[i], quantum);
+                    putVarint(out, zigzag(q - predictor.predict(c, i)));
+                    predictor.store(c, i, q);
+                }
+            }
+        }
+    }
+
+    // Decodes a whole chunk payload; false if it is malformed
+    static bool decodeChunk(const uint8_t* data, size_t size, const ChunkHeader& header, double positionQuantum,
+                            double velocityQuantum, Predictor& predictor, std::vector<TrajectoryFrame>& frames) {
+        predictor.reset();
+        frames.resize(header.frameCount);
+        const uint8_t* end = data + size;
+        for (TrajectoryFrame& frame : frames) {
+            uint64_t stepOffset, count;
+            if (!getVarint(data, end, stepOffset) || !getRaw(data, end, frame.time) || !getVarint(data, end, count)) {
+                return false;
+            }
+            // Every body takes at least one byte per id and component
+            if (count > size_t(end - data) / (1 + COMPONENTS)) return false;
+            frame.step = header.firstStep + stepOffset;
+
+            frame.ids.resize(count);
+            int64_t expected = 0;
+            for (size_t i = 0; i < count; ++i) {
+                uint64_t encoded;
+                if (!getVarint(data, end, encoded)) return false;
+                const int64_t id = expected + unzigzag(encoded);
+                if (id < 0 || id >= int64_t(BodyStore::INVALID_ID)) return false;
+                frame.ids[i] = static_cast<BodyId>(id);
+                expected = id + 1;
+            }
+
+            predictor.beginFrame(frame.ids.data(), count);
+            std::vector<float>* columns[COMPONENTS] = {&frame.x, &frame.y, &frame.z,
+                                                       &frame.vx, &frame.vy, &frame.vz};
+            for (size_t c = 0; c < COMPONENTS; ++c) {
+                const double quantum = c < 3 ? positionQuantum : velocityQuantum;
+                columns[c]->resize(count);
+                float* values = columns[c]->data();
+                for (size_t i = 0; i < count; ++i) {
+                    uint64_t encoded;
+                    if (!getVarint(data, end, encoded)) return false;
+                    // Wraps instead of overflowing on corrupt input, which the range check catches
+                    const int64_t q = static_cast<int64_t>(uint64_t(predictor.predict(c, i)) + uint64_t(unzigzag(encoded)));
+                    if (q < -QUANTIZED_LIMIT || q > QUANTIZED_LIMIT) return false;
+                    predictor.store(c, i, q);
+                    values[i] = dequantize(q, quantum);
+                }
+            }
+        }
+        return data == end;
+    }
+
+    static bool littleEndianHost() {
+        const uint16_t probe = 1;
+        uint8_t first;
+        std::memcpy(&first, &probe, 1);
+        return first == 1;
+    }
+
+private:
+    static uint64_t zigzag(int64_t value) {
+        return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    }
+
+    static int64_t unzigzag(uint64_t value) {
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    static void putVarint(std::vector<uint8_t>& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    static bool getVarint(const uint8_t*& data, const uint8_t* end, uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && data < end; shift += 7) {
+            const uint8_t byte = *data++;
+            value |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+
+    template <typename T>
+    static void putRaw(std::vector<uint8_t>& out, const T& value) {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    template <typename T>
+    static bool getRaw(const uint8_t*& data, const uint8_t* end, T& value) {
+        if (size_t(end - data) < sizeof(T)) return false;
+        std::memcpy(&value, data, sizeof(T));
+        data += sizeof(T);
+        return true;
+    }
+};
+
+// How often and how finely a TrajectoryWriter records
+struct TrajectorySettings {
+    uint32_t interval = 10;          // steps between frames
+    double positionQuantum = 0.01;   // store units
+    double velocityQuantum = 0.01;   // store units per simulation time unit
+    size_t framesPerChunk = 16;      // at most, fewer if the buffers would outgrow bufferBytes
+    size_t bufferBytes = size_t(256) << 20; // all chunk buffers together
+};
+
+// Appends a frame every few steps to a trajectory file without slowing
+// the stepping thread down. record() only copies the bodies into a chunk
+// buffer; full chunks are compressed and written by a background thread.
+// Memory is bounded by a fixed number of chunk buffers: when the disk
+// falls behind and all of them are queued, frames are dropped and counted
+// rather than waited for.
+class TrajectoryWriter {
+private:
+    static constexpr size_t CHUNK_BUFFERS = 3;
+
+    struct Chunk {
+        std::vector<TrajectoryFrame> frames;
+        size_t frameCount = 0;
+    };
+
+    TrajectorySettings settings;
+    std::string path;
+    std::ofstream file;
+    bool recording;
+    uint64_t nextStep;   // caller only
+    size_t chunkFrames;  // decided from the first frame's size
+    Chunk* filling;      // caller only
+    uint64_t recordedFrames, droppedFrames;
+
+    std::unique_ptr<Chunk> chunks[CHUNK_BUFFERS];
+    std::vector<Chunk*> idle;
+    std::deque<Chunk*> queued;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool stopping;
+    bool failed;
+
+    // Writer thread only
+    std::vector<Trajectory::ChunkInfo> index;
+    Trajectory::Predictor predictor;
+    std::vector<uint8_t> payload;
+    uint64_t fileOffset;
+
+public:
+    TrajectoryWriter()
+        : recording(false), nextStep(0), chunkFrames(0), filling(nullptr), recordedFrames(0), droppedFrames(0),
+          stopping(false), failed(false), fileOffset(0) {}
+
+    ~TrajectoryWriter() { close(); }
+
+    TrajectoryWriter(const TrajectoryWriter&) = delete;
+    TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+
+    // Starts a new file, replacing one at path
+    bool open(const std::string& filePath, const TrajectorySettings& options = TrajectorySettings()) {
+        close();
+        if (!Trajectory::littleEndianHost()) {
+            std::cerr << "Trajectories are little-endian; this host is not" << std::endl;
+            return false;
+        }
+        if (options.interval == 0 || !(options.positionQuantum > 0.0) || !(options.velocityQuantum > 0.0)) {
+            std::cerr << "Trajectory interval and quanta must be positive" << std::endl;
+            return false;
+        }
+        file.open(filePath, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            std::cerr << "Failed to open '" << filePath << "' for writing" << std::endl;
+            return false;
+        }
+
+        Trajectory::FileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, Trajectory::FILE_MAGIC, sizeof(header.magic));
+        header.version = Trajectory::VERSION;
+        header.interval = options.interval;
+        header.positionQuantum = options.positionQuantum;
+        header.velocityQuantum = options.velocityQuantum;
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        settings = options;
+        path = filePath;
+        recording = true;
+        nextStep = 0;
+        chunkFrames = 0;
+        filling = nullptr;
+        recordedFrames = droppedFrames = 0;
+        index.clear();
+        fileOffset = sizeof(header);
+        stopping = false;
+        failed = false;
+        idle.clear();
+        for (std::unique_ptr<Chunk>& chunk : chunks) {
+            chunk = std::make_unique<Chunk>();
+            idle.push_back(chunk.get());
+        }
+        thread = std::thread([this] { loop(); });
+        return true;
+    }
+
+    bool isOpen() const { return recording; }
+
+    // Captures the engine's bodies if a frame is due. Steps are counted by
+    // the engine, so a caller that takes several steps per call still gets
+    // a frame at the first call past every interval.
+    void record(const PhysicsEngine& engine) {
+        if (!recording || engine.getStepCount() < nextStep) return;
+        PROFILE_SCOPE("record trajectory frame");
+        const uint64_t step = engine.getStepCount();
+        nextStep = (step / settings.interval + 1) * settings.interval;
+
+        const BodyStore& bodies = engine.getBodies();
+        if (chunkFrames == 0) {
+            const size_t frameBytes = std::max<size_t>(1, bodies.size() * (sizeof(BodyId) + 6 * sizeof(float)));
+            chunkFrames = std::max<size_t>(1, std::min(settings.framesPerChunk,
+                                                       settings.bufferBytes / (CHUNK_BUFFERS * frameBytes)));
+        }
+        if (!filling) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (idle.empty()) {
+                ++droppedFrames;
+                return;
+            }
+            filling = idle.back();
+            idle.pop_back();
+        }
+
+        if (filling->frames.size() <= filling->frameCount) filling->frames.resize(filling->frameCount + 1);
+        TrajectoryFrame& frame = filling->frames[filling->frameCount++];
+        const size_t count = bodies.size();
+        frame.step = step;
+        frame.time = engine.getSimulationTime();
+        frame.ids.resize(count);
+        for (size_t i = 0; i < count; ++i) frame.ids[i] = bodies.idAt(i);
+        frame.x.assign(bodies.x(), bodies.x() + count);
+        frame.y.assign(bodies.y(), bodies.y() + count);
+        frame.z.assign(bodies.z(), bodies.z() + count);
+        frame.vx.assign(bodies.vx(), bodies.vx() + count);
+        frame.vy.assign(bodies.vy(), bodies.vy() + count);
+        frame.vz.assign(bodies.vz(), bodies.vz() + count);
+        ++recordedFrames;
+
+        if (filling->frameCount == chunkFrames) queueFilling();
+    }
+
+    // Flushes the last partial chunk, waits for the writer thread and
+    // appends the chunk index. Reports whether everything reached the disk.
+    bool close() {
+        if (!recording) return true;
+        if (filling) queueFilling();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        thread.join();
+        recording = false;
+
+        Trajectory::Footer footer;
+        std::memset(&footer, 0, sizeof(footer));
+        footer.indexOffset = fileOffset;
+        footer.chunkCount = index.size();
+        std::memcpy(footer.magic, Trajectory::INDEX_MAGIC, sizeof(footer.magic));
+        file.write(reinterpret_cast<const char*>(index.data()),
+                   static_cast<std::streamsize>(index.size() * sizeof(Trajectory::ChunkInfo)));
+        file.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+        file.close();
+        if (failed || !file) {
+            std::cerr << "Failed to write trajectory '" << path << "'" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t getRecordedFrames() const { return recordedFrames; }
+    uint64_t getDroppedFrames() const { return droppedFrames; }
+    // Bytes written so far; only settled once closed
+    uint64_t getFileSize() const { return recording ? 0 : fileOffset + index.size() * sizeof(Trajectory::ChunkInfo) + sizeof(Trajectory::Footer); }
+
+private:
+    void queueFilling() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued.push_back(filling);
+        }
+        filling = nullptr;
+        changed.notify_all();
+    }
+
+    void loop() {
+        PROFILE_THREAD("trajectory writer");
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            changed.wait(lock, [this] { return stopping || !queued.empty(); });
+            if (queued.empty()) return; // stopping with nothing left
+            Chunk* chunk = queued.front();
+            queued.pop_front();
+            lock.unlock();
+
+            bool written = writeChunk(*chunk);
+            chunk->frameCount = 0;
+
+            lock.lock();
+            if (!written) failed = true;
+            idle.push_back(chunk);
+        }
+    }
+
+    bool writeChunk(const Chunk& chunk) {
+        PROFILE_SCOPE("write trajectory chunk");
+        payload.clear();
+        Trajectory::encodeChunk(chunk.frames.data(), chunk.frameCount, settings.positionQuantum,
+                                settings.velocityQuantum, predictor, payload);
+
+        Trajectory::ChunkHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, Trajectory::CHUNK_MAGIC, sizeof(header.magic));
+        header.frameCount = static_cast<uint32_t>(chunk.frameCount);
+        header.firstStep = chunk.frames[0].step;
+        header.lastStep = chunk.frames[chunk.frameCount - 1].step;
+        header.payloadBytes = payload.size();
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
+        if (!file) return false;
+
+        index.push_back({fileOffset, header.firstStep, header.lastStep, header.frameCount});
+        fileOffset += sizeof(header) + payload.size();
+        return true;
+    }
+};
+
+// Random access to a trajectory file. Opening maps the file and reads
+// only the chunk index; a chunk is decoded when it is asked for.
+class TrajectoryReader {
+private:
+    MappedFile file;
+    std::string path;
+    Trajectory::FileHeader header;
+    std::vector<Trajectory::ChunkInfo> chunks;
+    Trajectory::Predictor predictor;
+    bool indexed;
+
+public:
+    TrajectoryReader() : indexed(false) {}
+
+    bool open(const std::string& filePath) {
+        chunks.clear();
+        path = filePath;
+        if (!Trajectory::littleEndianHost()) {
+            std::cerr << "Trajectories are little-endian; this host is not" << std::endl;
+            return false;
+        }
+        if (!file.open(filePath, MappedFile::Access::Random)) {
+            std::cerr << "Failed to map trajectory '" << filePath << "'" << std::endl;
+            return false;
+        }
+        if (file.size() < sizeof(header)) return malformed("truncated header");
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, Trajectory::FILE_MAGIC, sizeof(header.magic)) != 0) {
+            return malformed("not a trajectory");
+        }
+        if (header.version != Trajectory::VERSION) return malformed("unsupported version " + std::to_string(header.version));
+        if (header.interval == 0 || !(header.positionQuantum > 0.0) || !(header.velocityQuantum > 0.0)) {
+            return malformed("invalid settings");
+        }
+
+        indexed = readIndex();
+        if (!indexed) scanChunks();
+        return true;
+    }
+
+    uint32_t getInterval() const { return header.interval; }
+    double getPositionQuantum() const { return header.positionQuantum; }
+    double getVelocityQuantum() const { return header.velocityQuantum; }
+    // False if the writer never closed and the chunks were found by scanning
+    bool hasIndex() const { return indexed; }
+
+    size_t getChunkCount() const { return chunks.size(); }
+    const Trajectory::ChunkInfo& getChunk(size_t chunk) const { return chunks[chunk]; }
+
+    // Chunk holding the last frame at or before step; getChunkCount() if
+    // every frame comes later
+    size_t findChunk(uint64_t step) const {
+        auto after = std::upper_bound(chunks.begin(), chunks.end(), step,
+                                      [](uint64_t s, const Trajectory::ChunkInfo& c) { return s < c.firstStep; });
+        return after == chunks.begin() ? chunks.size() : static_cast<size_t>(after - chunks.begin()) - 1;
+    }
+
+    // Decodes one chunk without touching any other
+    bool readChunk(size_t chunk, std::vector<TrajectoryFrame>& frames) {
+        if (chunk >= chunks.size()) return false;
+        Trajectory::ChunkHeader chunkHeader;
+        std::memcpy(&chunkHeader, file.data() + chunks[chunk].offset, sizeof(chunkHeader));
+        const uint8_t* payload = file.data() + chunks[chunk].offset + sizeof(chunkHeader);
+        if (!Trajectory::decodeChunk(payload, chunkHeader.payloadBytes, chunkHeader, header.positionQuantum,
+                                     header.velocityQuantum, predictor, frames)) {
+            return malformed("corrupt chunk " + std::to_string(chunk));
+        }
+        return true;
+    }
+
+    // The last frame recorded at or before step
+    bool readFrame(uint64_t step, TrajectoryFrame& frame) {
+        const size_t chunk = findChunk(step);
+        std::vector<TrajectoryFrame> frames;
+        if (chunk == chunks.size() || !readChunk(chunk, frames)) return false;
+        size_t f = frames.size();
+        while (f > 1 && frames[f - 1].step > step) --f;
+        frame = std::move(frames[f - 1]);
+        return true;
+    }
+
+private:
+    // Chunk headers must be intact and in step order wherever they came from
+    bool validChunk(uint64_t offset, Trajectory::ChunkHeader& chunkHeader) const {
+        if (offset > file.size() || file.size() - offset < sizeof(chunkHeader)) return false;
+        std::memcpy(&chunkHeader, file.data() + offset, sizeof(chunkHeader));
+        if (std::memcmp(chunkHeader.magic, Trajectory::CHUNK_MAGIC, sizeof(chunkHeader.magic)) != 0) return false;
+        if (chunkHeader.frameCount == 0 || chunkHeader.lastStep < chunkHeader.firstStep) return false;
+        if (chunkHeader.payloadBytes > file.size() - offset - sizeof(chunkHeader)) return false;
+        return chunks.empty() || chunkHeader.firstStep > chunks.back().lastStep;
+    }
+
+    bool readIndex() {
+        Trajectory::Footer footer;
+        if (file.size() < sizeof(header) + sizeof(footer)) return false;
+        std::memcpy(&footer, file.data() + file.size() - sizeof(footer), sizeof(footer));
+        if (std::memcmp(footer.magic, Trajectory::INDEX_MAGIC, sizeof(footer.magic)) != 0) return false;
+        const uint64_t indexEnd = file.size() - sizeof(footer);
+        if (footer.indexOffset > indexEnd ||
+            footer.chunkCount != (indexEnd - footer.indexOffset) / sizeof(Trajectory::ChunkInfo) ||
+            (indexEnd - footer.indexOffset) % sizeof(Trajectory::ChunkInfo) != 0) {
+            return false;
+        }
+
+        const uint8_t* entries = file.data() + footer.indexOffset;
+        for (uint64_t c = 0; c < footer.chunkCount; ++c) {
+            Trajectory::ChunkInfo info;
+            std::memcpy(&info, entries + c * sizeof(info), sizeof(info));
+            Trajectory::ChunkHeader chunkHeader;
+            if (!validChunk(info.offset, chunkHeader)) {
+                chunks.clear();
+                return false;
+            }
+            chunks.push_back({info.offset, chunkHeader.firstStep, chunkHeader.lastStep, chunkHeader.frameCount});
+        }
+        return true;
+    }
+
+    // Walks the chunk headers of a file whose writer never closed, up to
+    // the first one cut short
+    void scanChunks() {
+        uint64_t offset = sizeof(header);
+        Trajectory::ChunkHeader chunkHeader;
+        while (validChunk(offset, chunkHeader)) {
+            chunks.push_back({offset, chunkHeader.firstStep, chunkHeader.lastStep, chunkHeader.frameCount});
+            offset += sizeof(chunkHeader) + chunkHeader.payloadBytes;
+        }
+    }
+
+    bool malformed(const std::string& reason) const {
+        std::cerr << "Invalid trajectory '" << path << "': " << reason << std::endl;
+        return false;
+    }
+};
@@ -0,0 +1,58 @@
+// Trajectory inspector: lists the chunks of a trajectory file, or prints
+// the frame recorded at or before a step. Only the chunk holding that
+// frame is decoded.
+//
+//   trajectory <file>          chunk list
+//   trajectory <file> <step>   frame as "id px py pz vx vy vz" lines
+
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <string>
+
+#include "trajectory.hpp"
+
+int main(int argc, char** argv) {
+    if (argc != 2 && argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <trajectory> [step]" << std::endl;
+        return 1;
+    }
+
+    TrajectoryReader reader;
+    if (!reader.open(argv[1])) {
+        return 1;
+    }
+
+    if (argc == 2) {
+        std::cout << "# every " << reader.getInterval() << " steps, quanta " << reader.getPositionQuantum()
+                  << " / " << reader.getVelocityQuantum() << (reader.hasIndex() ? "" : ", unindexed") << "\n";
+        std::cout << "# chunk offset first_step last_step frames\n";
+        for (size_t c = 0; c < reader.getChunkCount(); ++c) {
+            const Trajectory::ChunkInfo& chunk = reader.getChunk(c);
+            std::cout << c << ' ' << chunk.offset << ' ' << chunk.firstStep << ' ' << chunk.lastStep << ' '
+                      << chunk.frameCount << '\n';
+        }
+        return 0;
+    }
+
+    char* end = nullptr;
+    unsigned long long step = std::strtoull(argv[2], &end, 10);
+    if (end == argv[2] || *end != '\0') {
+        std::cerr << "Invalid step '" << argv[2] << "'" << std::endl;
+        return 1;
+    }
+    TrajectoryFrame frame;
+    if (!reader.readFrame(step, frame)) {
+        std::cerr << "No frame at or before step " << step << std::endl;
+        return 1;
+    }
+
+    std::cout.precision(std::numeric_limits<float>::max_digits10);
+    std::cout << "# step " << frame.step << " time " << frame.time << "\n";
+    std::cout << "# id px py pz vx vy vz\n";
+    for (size_t i = 0; i < frame.size(); ++i) {
+        std::cout << frame.ids[i] << ' ' << frame.x[i] << ' ' << frame.y[i] << ' ' << frame.z[i] << ' '
+                  << frame.vx[i] << ' ' << frame.vy[i] << ' ' << frame.vz[i] << '\n';
+    }
+    return 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free single-producer, single-consumer triple buffer. The writer
+// fills the back slot and publishes it by swapping it with the middle one;
+// the reader swaps the middle slot into the front when a newer one is
+// waiting. Neither side ever waits for the other, and the reader always
+// sees a complete slot the writer is no longer touching.
+template <typename T>
+class TripleBuffer {
+private:
+    static constexpr uint8_t INDEX = 0x3;
+    static constexpr uint8_t FRESH = 0x4; // middle slot not yet taken by the reader
+
+    T slots[3];
+    std::atomic<uint8_t> middle;
+    uint8_t back;  // writer only
+    uint8_t front; // reader only
+
+public:
+    TripleBuffer() : middle(1), back(0), front(2) {}
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    // Writer side
+    T& writeBuffer() { return slots[back]; }
+
+    void publish() {
+        back = middle.exchange(static_cast<uint8_t>(back | FRESH), std::memory_order_acq_rel) & INDEX;
+    }
+
+    // Reader side: takes the newest published slot, if any, and returns
+    // whether the front slot changed
+    bool acquire() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    const T& readBuffer() const { return slots[front]; }
+};
@@ -13,13 +13,14 @@ namespace Utils {
         return glm::vec3(x, y, z);
     }
     
-    void createVBOVAO(GLuint& VAO, GLuint& VBO, const float* vertices, size_t vertexCount) {
+    void createVBOVAO(GLuint& VAO, GLuint& VBO, const float* vertices, size_t vertexCount,
+                      GLenum usage = GL_STATIC_DRAW) {
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
 
         glBindVertexArray(VAO);
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(float), vertices, GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(float), vertices, usage);
 
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
         glEnableVertexAttribArray(0);
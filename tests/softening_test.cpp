@@ -0,0 +1,45 @@
+// Checks that Barnes-Hut and FMM integrate the same softened force law as
+// direct summation: with softening on, a fully opened tree and a tight,
+// high-order expansion must match the direct sum to float accuracy.
+//
+//   clang++ -std=c++17 -O2 -Isrc tests/softening_test.cpp -o bin/softening_test -lpthread
+//   ./bin/softening_test
+
+#include <iostream>
+
+#include "physicsengine.hpp"
+#include "scenario.hpp"
+
+static int failures = 0;
+
+static void expectBelow(const char* what, double value, double limit) {
+    const bool pass = value < limit;
+    std::cerr << (pass ? "PASS " : "FAIL ") << what << ": " << value << " (limit " << limit << ")" << std::endl;
+    if (!pass) ++failures;
+}
+
+int main() {
+    PhysicsEngine physics;
+    Scenario scenario;
+    if (!Scenario::load("disk:3000", scenario)) return 1;
+    scenario.populate(physics.getBodies(), physics.getThreadPool());
+
+    for (float softening : {1.0f, 50.0f}) {
+        std::cerr << "softening " << softening << " km" << std::endl;
+        physics.setSoftening(softening);
+
+        // theta = 0 opens every cell, so only float rounding remains
+        physics.setOpeningAngle(0.0f);
+        expectBelow("barnes-hut theta 0, max error", physics.measureAccuracy(GravitySolver::BarnesHut).maxRelativeError, 1.0e-4);
+        physics.setOpeningAngle(0.5f);
+        expectBelow("barnes-hut theta 0.5, rms error", physics.measureAccuracy(GravitySolver::BarnesHut).rmsRelativeError, 1.0e-2);
+
+        physics.setMultipoleOpeningAngle(0.3f);
+        physics.setExpansionOrder(10);
+        expectBelow("fmm theta 0.3 order 10, max error", physics.measureAccuracy(GravitySolver::FastMultipole).maxRelativeError, 1.0e-4);
+        physics.setMultipoleOpeningAngle(0.6f);
+        physics.setExpansionOrder(4);
+        expectBelow("fmm theta 0.6 order 4, rms error", physics.measureAccuracy(GravitySolver::FastMultipole).rmsRelativeError, 1.0e-2);
+    }
+    return failures == 0 ? 0 : 1;
+}